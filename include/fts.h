@@ -58,6 +58,9 @@ typedef struct _fts {
 
 #define FTS_NAMEONLY 0x0100
 #define FTS_STOP 0x0200
+
+#define FTS_BREADTHFIRST 0x0400 /* level order; implies FTS_NOCHDIR */
+#define FTS_SKIPFSTYPE 0x1000   /* don't enter kernel pseudo file systems */
     int fts_options;
 } FTS;
 
@@ -119,6 +122,79 @@ FTSENT* fts_children(FTS*, int);
 int fts_set(FTS*, FTSENT*, int);
 int fts_close(FTS*);
 
+/* Keep up to nfds descriptors of directories the walk changes back into,
+   so ascents and revisits skip re-opening and re-verifying them.  Evicted
+   directories are re-opened by path with the usual dev/ino checks.  0, the
+   default, disables the cache; it has no effect under FTS_NOCHDIR. */
+int fts_set_dircache(FTS*, size_t);
+
+/* Prune mounts of file system type name, as spelled in mountinfo ("fuse"
+   also matches "fuse.<subtype>"), or of statfs() magic.  As with FTS_XDEV
+   the mount point is returned but not entered.  Either call turns on
+   FTS_SKIPFSTYPE filtering, without the built-in pseudo file system set
+   unless FTS_SKIPFSTYPE was also given to fts_open(). */
+int fts_skip_fstype(FTS*, const char*);
+int fts_skip_fsmagic(FTS*, unsigned long);
+
+/* Content stage.  With a mode set, each FTS_F entry fts_read() returns is
+   opened relative to its directory and its data is available through
+   fts_content() until the next fts_read(); the next window regular files in
+   the same directory are opened ahead with a readahead hint, so at most
+   window + 1 files are held open.  FTS_CONTENT_MMAP maps the whole file,
+   falling back to reads where it cannot; FTS_CONTENT_READ fills one
+   reusable buffer per call.  Mode 0, the default, disables the stage. */
+#define FTS_CONTENT_MMAP 1
+#define FTS_CONTENT_READ 2
+int fts_set_content(FTS*, int, size_t);
+/* Point *data at the next part of the current file and return its length;
+   0 at end of file. */
+ssize_t fts_content(FTS*, const void**);
+
+/* Metadata stage.  With FTS_META_XATTR, extended attributes (POSIX ACLs
+   included) are collected for each entry as its directory is read, relative
+   to the directory's descriptor; FTS_META_FLAGS adds the FS_IOC_GETFLAGS
+   inode flags.  Records are kept in an arena shared by the directory's
+   entries and stay valid as long as the entry does.  Entries not collected
+   that way, roots among them, are collected by path on first use while they
+   are the current entry.  Under FTS_NOSTAT the file type comes from d_type;
+   entries of unknown type are not opened, so their flags_errno is ENOTTY.
+   0, the default, disables the stage. */
+#define FTS_META_XATTR 0x01
+#define FTS_META_FLAGS 0x02
+
+struct fts_xattr {
+    const char* name;
+    const void* value;
+    size_t size;
+};
+
+struct fts_meta {
+    const struct fts_xattr* xattrs;
+    size_t nxattrs;
+    int xattr_errno; /* nonzero when the list is incomplete */
+    unsigned int flags;
+    int flags_errno; /* nonzero when flags is not valid */
+};
+
+int fts_set_meta(FTS*, int);
+int fts_meta(FTS*, const FTSENT*, struct fts_meta*);
+
+/* Prune path and everything beneath it from the walk.  Paths are matched
+   lexically against fts_path with empty and "." components ignored; excluded
+   entries are skipped before they are allocated or stat'ed.  Must be called
+   before the first fts_read(). */
+int fts_exclude(FTS*, const char*);
+
+/* Serialize the traversal frontier (ancestor identities and the names still
+   pending at each level) into buf.  Returns the encoded size, which may
+   exceed size; nothing is usable unless it fits.  The checkpoint resumes at
+   the current entry, so it is delivered again after fts_resume(). */
+ssize_t fts_checkpoint(FTS*, void*, size_t);
+/* Continue a freshly opened stream, with the same roots and options, from a
+   checkpoint.  Ancestors are re-entered with the usual dev/ino checks; on
+   failure the stream is stopped and must be closed. */
+int fts_resume(FTS*, const void*, size_t);
+
 #ifdef __cplusplus
 }
 #endif
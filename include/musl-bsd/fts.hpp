@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/* Header-only C++20 wrapper for libfts: a move-only stream handle that is
+   also an input range over the entries fts_read() returns. */
+
+#ifndef MUSL_BSD_FTS_HPP
+#define MUSL_BSD_FTS_HPP
+
+#include <fts.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+namespace musl_bsd {
+
+class fts_stream {
+public:
+    using compare_fn = int (*)(const FTSENT**, const FTSENT**);
+
+    class iterator {
+    public:
+        using iterator_concept = std::input_iterator_tag;
+        using value_type = FTSENT;
+        using difference_type = std::ptrdiff_t;
+        using reference = FTSENT&;
+
+        iterator() noexcept = default;
+
+        reference operator*() const noexcept { return *s_->cur_; }
+        FTSENT* operator->() const noexcept { return s_->cur_; }
+
+        iterator& operator++() noexcept {
+            s_->advance();
+            return *this;
+        }
+        void operator++(int) noexcept { ++*this; }
+
+        friend bool operator==(const iterator& it, std::default_sentinel_t) noexcept { return it.done(); }
+
+    private:
+        friend class fts_stream;
+        explicit iterator(fts_stream* s) noexcept : s_(s) {}
+
+        bool done() const noexcept { return !s_ || !s_->cur_; }
+
+        fts_stream* s_ = nullptr;
+    };
+
+    fts_stream() noexcept = default;
+
+    /* The roots need not be NUL-terminated; they are copied into one
+       temporary block holding both argv and the strings, since fts_open()
+       keeps its own copies.  Throws std::system_error if the open fails. */
+    fts_stream(std::span<const std::string_view> roots, int options, compare_fn compar = nullptr) {
+        std::size_t bytes = (roots.size() + 1) * sizeof(char*);
+        for (std::string_view r : roots)
+            bytes += r.size() + 1;
+
+        std::unique_ptr<char[]> arena(new char[bytes]);
+        char** argv = reinterpret_cast<char**>(arena.get());
+        char* strings = arena.get() + (roots.size() + 1) * sizeof(char*);
+        for (std::size_t i = 0; i < roots.size(); i++) {
+            argv[i] = strings;
+            std::memcpy(strings, roots[i].data(), roots[i].size());
+            strings += roots[i].size();
+            *strings++ = '\0';
+        }
+        argv[roots.size()] = nullptr;
+
+        fts_ = fts_open(argv, options, compar);
+        if (!fts_)
+            throw std::system_error(errno, std::generic_category(), "fts_open");
+    }
+
+    fts_stream(const fts_stream&) = delete;
+    fts_stream& operator=(const fts_stream&) = delete;
+
+    fts_stream(fts_stream&& other) noexcept
+        : fts_(std::exchange(other.fts_, nullptr)),
+          cur_(std::exchange(other.cur_, nullptr)),
+          err_(std::exchange(other.err_, 0)),
+          started_(std::exchange(other.started_, false)) {}
+
+    fts_stream& operator=(fts_stream&& other) noexcept {
+        if (this != &other) {
+            reset();
+            fts_ = std::exchange(other.fts_, nullptr);
+            cur_ = std::exchange(other.cur_, nullptr);
+            err_ = std::exchange(other.err_, 0);
+            started_ = std::exchange(other.started_, false);
+        }
+        return *this;
+    }
+
+    ~fts_stream() { reset(); }
+
+    /* An input range: begin() reads the first entry once, and later calls
+       continue from wherever the stream is. */
+    iterator begin() noexcept {
+        if (!started_) {
+            started_ = true;
+            advance();
+        }
+        return iterator(this);
+    }
+    std::default_sentinel_t end() const noexcept { return {}; }
+
+    /* Wrappers for the calls that act on the current entry. */
+    bool set(FTSENT& ent, int instr) noexcept { return fts_ && fts_set(fts_, &ent, instr) == 0; }
+    FTSENT* children(int instr = 0) noexcept { return fts_ ? fts_children(fts_, instr) : nullptr; }
+
+    /* Set when iteration ended because fts_read() failed rather than
+       because the walk was complete. */
+    std::error_code error() const noexcept { return std::error_code(err_, std::generic_category()); }
+
+    FTS* get() const noexcept { return fts_; }
+    explicit operator bool() const noexcept { return fts_ != nullptr; }
+
+    /* Close now rather than on destruction, reporting fts_close() errors. */
+    std::error_code close() noexcept {
+        int rc = fts_ ? fts_close(fts_) : 0;
+        int err = rc ? errno : 0;
+        fts_ = nullptr;
+        cur_ = nullptr;
+        return std::error_code(err, std::generic_category());
+    }
+
+private:
+    void advance() noexcept {
+        if (!fts_) {
+            cur_ = nullptr;
+            return;
+        }
+        errno = 0;
+        cur_ = fts_read(fts_);
+        if (!cur_ && errno)
+            err_ = errno;
+    }
+
+    void reset() noexcept {
+        if (fts_)
+            fts_close(fts_);
+        fts_ = nullptr;
+        cur_ = nullptr;
+    }
+
+    FTS* fts_ = nullptr;
+    FTSENT* cur_ = nullptr;
+    int err_ = 0;
+    bool started_ = false;
+};
+
+} // namespace musl_bsd
+
+#endif /* MUSL_BSD_FTS_HPP */
@@ -1,9 +1,14 @@
-/* Internal/test-only syscall shim for fts; not part of the public API surface. */
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/* Pluggable backends for libfts.  A backend supplies every call fts makes
+   to the file system, so a stream can walk something other than the live
+   tree: a recorded snapshot, a fault-injecting wrapper, an archive index. */
 
 #ifndef MUSL_BSD_FTS_OPS_H
 #define MUSL_BSD_FTS_OPS_H
 
 #include <dirent.h>
+#include <fts.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -11,6 +16,52 @@
 extern "C" {
 #endif
 
+/* Each call mirrors the POSIX function it is named after and receives the
+   ctx given to fts_open_with_ops().  Descriptors and DIR handles are opaque
+   to fts: they only flow back into the same backend, so a backend may hand
+   out values that are not kernel descriptors.  Every member is required. */
+struct fts_backend {
+    int (*open_fn)(void* ctx, const char* path, int flags);
+    int (*close_fn)(void* ctx, int fd);
+    int (*fstat_fn)(void* ctx, int fd, struct stat* st);
+    int (*fstatat_fn)(void* ctx, int dfd, const char* path, struct stat* st, int flags);
+    int (*fchdir_fn)(void* ctx, int fd);
+    DIR* (*fdopendir_fn)(void* ctx, int fd);
+    struct dirent* (*readdir_fn)(void* ctx, DIR* dirp);
+    int (*closedir_fn)(void* ctx, DIR* dirp);
+    int (*dirfd_fn)(void* ctx, DIR* dirp);
+};
+
+/* fts_open() over a backend; ops must outlive the stream.  ops == NULL
+   selects the live file system.  File system type filtering reads the live
+   mount table and statfs(), which a backend has no call for, so
+   FTS_SKIPFSTYPE here and fts_skip_fstype()/fts_skip_fsmagic() on such a
+   stream fail with EINVAL. */
+FTS* fts_open_with_ops(char* const* argv,
+                       int options,
+                       int (*compar)(const FTSENT**, const FTSENT**),
+                       const struct fts_backend* ops,
+                       void* ctx);
+
+/* Tree snapshots: a file recording names, types, symlink targets and the
+   stat fields fts reports, written by walking live roots and later served
+   from a read-only mapping.  Snapshots use the host's byte order. */
+struct fts_snapshot;
+
+/* Record every entry under roots (a physical walk) into file. */
+int fts_snapshot_save(const char* file, char* const* roots);
+struct fts_snapshot* fts_snapshot_open(const char* file);
+void fts_snapshot_close(struct fts_snapshot*);
+
+/* Backend serving a snapshot; pass the snapshot as ctx.  Paths resolve
+   against the recorded tree, whose top holds the roots as they were given.
+   A snapshot keeps one working directory, so it serves one stream at a
+   time; open the file again for concurrent walks. */
+extern const struct fts_backend fts_snapshot_backend;
+
+/* Internal test-only hook predating the public backend API: replaces the
+   calls of streams opened with fts_open().  Not thread-safe and not
+   exported by libfts. */
 struct fts_ops {
     int (*open_fn)(const char*, int);
     int (*close_fn)(int);
@@ -22,8 +73,6 @@ struct fts_ops {
     int (*closedir_fn)(DIR*);
 };
 
-/* Optional override used by tests for fault injection; leave NULL for defaults.
-   This hook is internal and not thread-safe, and is not exported by libfts. */
 extern const struct fts_ops* __fts_ops_override;
 
 #ifdef __cplusplus
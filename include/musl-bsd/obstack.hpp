@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/* Header-only C++17 wrapper for libobstack: a move-only owner, a scope that
+   frees back to a mark, and a std::pmr::memory_resource so standard
+   containers can allocate from an obstack. */
+
+#ifndef MUSL_BSD_OBSTACK_HPP
+#define MUSL_BSD_OBSTACK_HPP
+
+#include <obstack.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+namespace musl_bsd {
+
+class unique_obstack {
+public:
+    using chunk_fn = void* (*)(void*, std::size_t);
+    using free_fn = void (*)(void*, void*);
+
+    /* Chunks come from the default allocator; SIZE and ALIGNMENT of 0 pick
+       the library defaults.  Throws std::bad_alloc if the first chunk cannot
+       be had. */
+    explicit unique_obstack(std::size_t size = 0, std::size_t alignment = 0) {
+        if (!_obstack_begin(&ob_, size, alignment, xmalloc, std::free))
+            throw std::bad_alloc();
+    }
+
+    unique_obstack(std::size_t size, std::size_t alignment, chunk_fn chunkfun, free_fn freefun, void* arg) {
+        if (!_obstack_begin_1(&ob_, size, alignment, chunkfun, freefun, arg))
+            throw std::bad_alloc();
+    }
+
+    unique_obstack(const unique_obstack&) = delete;
+    unique_obstack& operator=(const unique_obstack&) = delete;
+
+    /* The obstack holds no pointers into itself, so it moves by copying;
+       the source is left without chunks. */
+    unique_obstack(unique_obstack&& other) noexcept : ob_(other.ob_) { other.ob_.chunk = nullptr; }
+
+    unique_obstack& operator=(unique_obstack&& other) noexcept {
+        if (this != &other) {
+            reset();
+            ob_ = other.ob_;
+            other.ob_.chunk = nullptr;
+        }
+        return *this;
+    }
+
+    ~unique_obstack() { reset(); }
+
+    struct obstack* get() noexcept { return &ob_; }
+    struct obstack* operator->() noexcept { return &ob_; }
+    explicit operator bool() const noexcept { return ob_.chunk != nullptr; }
+
+private:
+    void reset() noexcept {
+        if (ob_.chunk)
+            obstack_free(&ob_, nullptr);
+        ob_.chunk = nullptr;
+    }
+
+    struct obstack ob_{};
+};
+
+/* Frees everything allocated on the obstack after construction, at the end
+   of the scope or earlier through rewind().  Any object still growing when
+   the scope opens is finished first. */
+class obstack_scope {
+public:
+    explicit obstack_scope(struct obstack* h) noexcept : h_(h), mark_(obstack_finish(h)) {}
+    explicit obstack_scope(unique_obstack& ob) noexcept : obstack_scope(ob.get()) {}
+
+    obstack_scope(const obstack_scope&) = delete;
+    obstack_scope& operator=(const obstack_scope&) = delete;
+
+    ~obstack_scope() { rewind(); }
+
+    /* Frees back to the mark; the scope stays open. */
+    void rewind() noexcept { obstack_free(h_, mark_); }
+
+private:
+    struct obstack* h_;
+    void* mark_;
+};
+
+/* Allocates from an obstack it does not own.  Deallocation does nothing:
+   memory comes back when the obstack, or an obstack_scope around the
+   containers using it, frees it.  Must not be used while an object is being
+   grown on the same obstack. */
+class obstack_resource : public std::pmr::memory_resource {
+public:
+    explicit obstack_resource(struct obstack* h) noexcept : h_(h) {}
+    explicit obstack_resource(unique_obstack& ob) noexcept : h_(ob.get()) {}
+
+    struct obstack* get() const noexcept { return h_; }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        /* Objects start at the obstack's own alignment; stricter requests
+           are padded within the object. */
+        if (alignment <= static_cast<std::size_t>(h_->alignment_mask) + 1)
+            return obstack_alloc(h_, bytes);
+        if (bytes > SIZE_MAX - alignment)
+            throw std::bad_alloc();
+        obstack_make_room(h_, bytes + alignment - 1);
+        std::size_t pad = -reinterpret_cast<std::uintptr_t>(h_->next_free) & (alignment - 1);
+        obstack_blank_fast(h_, pad + bytes);
+        return static_cast<char*>(obstack_finish(h_)) + pad;
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+private:
+    struct obstack* h_;
+};
+
+} // namespace musl_bsd
+
+#endif /* MUSL_BSD_OBSTACK_HPP */
@@ -9,6 +9,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #if _OBSTACK_INTERFACE_VERSION == 1
 #define _OBSTACK_SIZE_T unsigned int
@@ -79,6 +80,8 @@ struct obstack {
     char* object_base;
     char* next_free;
     char* chunk_limit;
+    /* Unused by the macros below; the library keeps the obstack's spare
+       chunks and statistics behind temp.p. */
     union {
         _OBSTACK_SIZE_T i;
         void* p;
@@ -119,6 +122,98 @@ extern int obstack_vprintf(struct obstack*, const char* __restrict, va_list);
 extern int obstack_printf(struct obstack*, const char* __restrict, ...) __attribute__((format(printf, 2, 3)));
 extern size_t obstack_calculate_object_size(struct obstack* ob);
 
+/* Returns a write-only, fully buffered stream whose output grows the current
+   object.  The object is updated by fflush() and fclose(), so flush before
+   looking at it or finishing it; fseek() moves within it, zero-filling past
+   the end.  After obstack_finish() the next write starts a new object. */
+extern FILE* open_obstack_stream(struct obstack*);
+
+struct iovec;
+
+/* Append the IOVCNT buffers as one piece: the object is relocated at most
+   once.  obstack_copyv() also finishes the object and returns it. */
+extern void obstack_growv(struct obstack*, const struct iovec*, int);
+extern void* obstack_copyv(struct obstack*, const struct iovec*, int);
+
+/* Append to the growing object without going through printf; each returns
+   the number of bytes added.  Integers are written as "%lld", "%llu" and
+   "%llx" would; obstack_grow_fixed() matches "%.*f"; obstack_grow_escaped()
+   writes N bytes as the body of a C string literal. */
+extern int obstack_grow_dec(struct obstack*, long long);
+extern int obstack_grow_udec(struct obstack*, unsigned long long);
+extern int obstack_grow_hex(struct obstack*, unsigned long long);
+extern int obstack_grow_fixed(struct obstack*, double, int);
+extern int obstack_grow_escaped(struct obstack*, const char*, size_t);
+
+/* Lets obstacks using the default malloc-based allocator share up to LIMIT
+   standard-size chunks across the process; 0 (the default) disables the pool.
+   Each thread also caches a few chunks.  Setting 0 frees the shared chunks
+   and the calling thread's cache; another thread frees its cache at its next
+   chunk allocation or release, or when it exits.  Returns the previous
+   limit. */
+extern size_t obstack_chunk_pool(size_t limit);
+
+/* Sets, for the whole process, how much larger than the object being grown a
+   new chunk is made, in percent of the object (default 50, at most 1000).
+   Returns the previous value. */
+extern unsigned obstack_set_growth(unsigned percent);
+
+/* Counters kept as the obstack allocates, in bytes unless noted.  Chunks
+   taken from the obstack's spares count as reused, not allocated; tail waste
+   is what was left unused in a chunk when the growing object moved out. */
+struct obstack_stats {
+    size_t chunks_allocated; /* chunks */
+    size_t chunks_freed;     /* chunks */
+    size_t chunks_reused;    /* chunks */
+    size_t bytes_copied;
+    size_t tail_waste;
+    size_t memory_used; /* chunks holding objects, as obstack_memory_used() */
+    size_t spare_bytes;
+    size_t peak_footprint; /* highest memory_used + spare_bytes */
+};
+
+/* Fills STATS and returns 0, or zeroes it and returns -1 if the obstack keeps
+   no statistics.  Setting OBSTACK_STATS in the environment prints process
+   totals to stderr at exit. */
+extern int obstack_get_stats(struct obstack*, struct obstack_stats*);
+
+/* Returns memory an idle obstack does not need: frees spare chunks beyond
+   KEEP_BYTES and discards the pages past the end of the current object, for
+   obstacks using malloc() or the huge-page chunk functions.  Returns the
+   number of bytes given back. */
+extern size_t obstack_trim(struct obstack*, size_t keep_bytes);
+
+/* Chunk functions for obstack_specify_allocation_with_arg() (ARG is unused)
+   that place chunks in 2 MiB-aligned mappings marked for transparent huge
+   pages.  Freed chunks are returned to the kernel with MADV_FREE and their
+   mappings reused.  Meant for long-lived obstacks holding a lot of data. */
+extern void* obstack_huge_chunk_alloc(void* arg, size_t size);
+extern void obstack_huge_chunk_free(void* arg, void* chunk);
+
+#define OBSTACK_HUGE_CHUNK ((size_t)2 << 20)
+
+/* A concurrent arena: each thread allocates from an obstack of its own, so
+   allocation takes no lock.  The chunk functions are shared by all threads
+   and must be thread-safe; null ones select the default allocator.
+   obstack_arena_local() returns the calling thread's obstack for use with the
+   usual macros.  obstack_arena_alloc(A, 0) returns a mark that
+   obstack_arena_free() frees back to, in the same thread; a null OBJ frees
+   everything the thread holds.  A thread's obstack is kept when it exits and
+   reused by the next new thread; obstack_arena_destroy() releases the chunks
+   of all of them once no thread is using the arena.  Each arena uses a
+   thread-specific data key. */
+struct obstack_arena;
+
+extern struct obstack_arena* obstack_arena_create(_OBSTACK_SIZE_T,
+                                                  _OBSTACK_SIZE_T,
+                                                  void* (*)(void*, size_t),
+                                                  void (*)(void*, void*),
+                                                  void*);
+extern struct obstack* obstack_arena_local(struct obstack_arena*);
+extern void* obstack_arena_alloc(struct obstack_arena*, _OBSTACK_SIZE_T);
+extern void obstack_arena_free(struct obstack_arena*, void*);
+extern void obstack_arena_destroy(struct obstack_arena*);
+
 extern void* xmalloc(size_t size);
 extern void xmalloc_failed(size_t size);
 
@@ -147,6 +242,10 @@ extern const char* name;
     _obstack_begin_1((h), (size), (alignment), _OBSTACK_CAST(void* (*)(void*, size_t), (chunkfun)), \
                      _OBSTACK_CAST(void (*)(void*, void*), (freefun)), (arg))
 
+#define obstack_huge_init(h)                                                                  \
+    obstack_specify_allocation_with_arg((h), OBSTACK_HUGE_CHUNK, 0, obstack_huge_chunk_alloc, \
+                                        obstack_huge_chunk_free, 0)
+
 #define obstack_chunkfun(h, newfun) ((void)((h)->chunkfun.extra = (void* (*)(void*, size_t))(newfun)))
 
 #define obstack_freefun(h, newfun) ((void)((h)->freefun.extra = (void (*)(void*, void*))(newfun)))
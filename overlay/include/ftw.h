@@ -0,0 +1,32 @@
+#ifndef MUSL_BSD_OVERLAY_FTW_H
+#include_next <ftw.h>
+
+#define MUSL_BSD_OVERLAY_FTW_H
+
+/* glibc extensions honoured by the nftw() in libmusl-bsd-core. */
+#ifndef FTW_ACTIONRETVAL
+#define FTW_ACTIONRETVAL 16
+#endif
+
+#ifndef FTW_CONTINUE
+#define FTW_CONTINUE 0
+#define FTW_STOP 1
+#define FTW_SKIP_SUBTREE 2
+#define FTW_SKIP_SIBLINGS 3
+#endif
+
+#ifndef nftw64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int nftw64(const char* path, int (*fn)(const char*, const struct stat*, int, struct FTW*), int fdlimit, int flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#endif
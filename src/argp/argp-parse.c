@@ -215,6 +215,18 @@ static error_t group_parse(struct group* group, struct argp_state* state, int ke
         return EBADKEY;
 }
 
+/* An entry in the long-option index.  Entries sort by name and then by
+   their position in the groups, so the first of equal names is the one a
+   scan would find first.  */
+struct long_entry {
+    const char* name;
+    const struct argp_option* option;
+    const struct argp_option* base; /* The option it is an alias of, or itself.  */
+    struct group* group;
+    size_t order;   /* Position in a scan of all groups' options.  */
+    size_t run_end; /* End of the run of following entries with the same BASE.  */
+};
+
 struct parser {
     const struct argp* argp;
 
@@ -281,6 +293,11 @@ struct parser {
     /* An vector containing storage for the CHILD_INPUTS field in all groups.  */
     void** child_inputs;
 
+    /* Every named option of every group, sorted by name, for looking up
+       long options.  */
+    struct long_entry* long_index;
+    size_t long_count;
+
     /* State block supplied to parsing routines.  */
     struct argp_state state;
 
@@ -307,13 +324,29 @@ static const struct argp_option* find_short_option(struct parser* parser, int ke
     return NULL;
 }
 
-enum match_result { MATCH_EXACT, MATCH_PARTIAL, MATCH_NO };
-
 /* If defined, allow complete.el-like abbreviations of long options. */
 #ifndef ARGP_COMPLETE
 #define ARGP_COMPLETE 0
 #endif
 
+static const struct argp_option* option_base(const struct argp_option* first, const struct argp_option* opt) {
+    const struct argp_option* base = opt;
+    if (!(base->flags & OPTION_ALIAS))
+        return base;
+
+    while (base > first) {
+        base--;
+        if (__option_is_end(base))
+            continue;
+        if (!(base->flags & OPTION_ALIAS))
+            return base;
+    }
+    return opt;
+}
+
+#if ARGP_COMPLETE
+enum match_result { MATCH_EXACT, MATCH_PARTIAL, MATCH_NO };
+
 /* Matches an encountern long-option argument ARG against an option NAME.
  * ARG is terminated by NUL or '='. */
 static enum match_result match_option(const char* arg, const char* name) {
@@ -337,21 +370,8 @@ static enum match_result match_option(const char* arg, const char* name) {
     }
 }
 
-static const struct argp_option* option_base(const struct argp_option* first, const struct argp_option* opt) {
-    const struct argp_option* base = opt;
-    if (!(base->flags & OPTION_ALIAS))
-        return base;
-
-    while (base > first) {
-        base--;
-        if (__option_is_end(base))
-            continue;
-        if (!(base->flags & OPTION_ALIAS))
-            return base;
-    }
-    return opt;
-}
-
+/* Abbreviations may skip to the next '-' in the name, so they are not
+   prefixes and the sorted index cannot find them; scan every option.  */
 static const struct argp_option* find_long_option(struct parser* parser, const char* arg, struct group** p, int* ambiguous) {
     struct group* group;
 
@@ -406,6 +426,93 @@ static const struct argp_option* find_long_option(struct parser* parser, const c
 
     return NULL;
 }
+#else
+/* Looks ARG, terminated by NUL or '=', up in the sorted index.  An exact
+   match wins; otherwise ARG must be a prefix of options that are all
+   aliases of one another, and the first of them in scan order is used.  */
+static const struct argp_option* find_long_option(struct parser* parser, const char* arg, struct group** p, int* ambiguous) {
+    const struct long_entry* index = parser->long_index;
+    size_t len = strcspn(arg, "=");
+    size_t lo = 0, hi = parser->long_count, end;
+
+    if (p)
+        *p = NULL;
+    if (ambiguous)
+        *ambiguous = 0;
+
+    /* The names starting with ARG form the range [LO, END).  */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(index[mid].name, arg, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    end = parser->long_count;
+    for (hi = lo; hi < end;) {
+        size_t mid = hi + (end - hi) / 2;
+        if (strncmp(index[mid].name, arg, len) == 0)
+            hi = mid + 1;
+        else
+            end = mid;
+    }
+    if (lo == end)
+        return NULL;
+
+    if (index[lo].name[len] != '\0') {
+        const struct long_entry* first = &index[lo];
+        size_t i;
+        if (index[lo].run_end < end) {
+            if (ambiguous)
+                *ambiguous = 1;
+            return NULL;
+        }
+        for (i = lo + 1; i < end; i++)
+            if (index[i].order < first->order)
+                first = &index[i];
+        lo = (size_t)(first - index);
+    }
+    if (p)
+        *p = index[lo].group;
+    return index[lo].option;
+}
+#endif
+
+static int long_entry_compare(const void* a, const void* b) {
+    const struct long_entry* x = a;
+    const struct long_entry* y = b;
+    int cmp = strcmp(x->name, y->name);
+    if (cmp)
+        return cmp;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/* Fills in and sorts PARSER's long-option index from its groups.  */
+static void parser_index(struct parser* parser) {
+    struct long_entry* index = parser->long_index;
+    struct group* group;
+    size_t n = 0, i;
+
+    for (group = parser->groups; group < parser->egroup; group++) {
+        const struct argp_option* opts;
+
+        for (opts = group->argp->options; opts && !__option_is_end(opts); opts++) {
+            if (!opts->name)
+                continue;
+            index[n].name = opts->name;
+            index[n].option = opts;
+            index[n].base = option_base(group->argp->options, opts);
+            index[n].group = group;
+            index[n].order = n;
+            n++;
+        }
+    }
+    parser->long_count = n;
+    qsort(index, n, sizeof(*index), long_entry_compare);
+
+    for (i = n; i-- > 0;)
+        index[i].run_end = i + 1 < n && index[i + 1].base == index[i].base ? index[i + 1].run_end : i + 1;
+}
 
 /* The next usable entries in the various parser tables being filled in by
    convert_options.  */
@@ -495,6 +602,7 @@ struct parser_sizes {
 
     size_t num_groups;       /* Group structures we allocate.  */
     size_t num_child_inputs; /* Child input slots.  */
+    size_t num_long;         /* Named options, for the long-option index.  */
 };
 
 /* For ARGP, increments the NUM_GROUPS field in SZS by the total
@@ -508,6 +616,10 @@ static void calc_sizes(const struct argp* argp, struct parser_sizes* szs) {
         /* This parser needs a group. */
         szs->num_groups++;
         if (opt) {
+            const struct argp_option* o;
+            for (o = opt; !__option_is_end(o); o++)
+                if (o->name)
+                    szs->num_long++;
             while (__option_is_short(opt++))
                 szs->short_len++;
         }
@@ -545,6 +657,7 @@ static error_t parser_init(struct parser* parser,
     szs.short_len = 0;
     szs.num_groups = 0;
     szs.num_child_inputs = 0;
+    szs.num_long = 0;
 
     if (argp)
         calc_sizes(argp, &szs);
@@ -556,10 +669,11 @@ static error_t parser_init(struct parser* parser,
     /* Lengths of the various bits of storage used by PARSER.  */
 #define GLEN (szs.num_groups + 1) * sizeof(struct group)
 #define CLEN (szs.num_child_inputs * sizeof(void*))
+#define LLEN (szs.num_long * sizeof(struct long_entry))
 #define SLEN (szs.short_len + 1)
 #define STORAGE(offset) ((void*)(((char*)parser->storage) + (offset)))
 
-    parser->storage = malloc(GLEN + CLEN + SLEN);
+    parser->storage = malloc(GLEN + CLEN + LLEN + SLEN);
     if (!parser->storage)
         return ENOMEM;
 
@@ -568,12 +682,15 @@ static error_t parser_init(struct parser* parser,
     parser->child_inputs = STORAGE(GLEN);
     memset(parser->child_inputs, 0, szs.num_child_inputs * sizeof(void*));
 
+    parser->long_index = STORAGE(GLEN + CLEN);
+
     if (flags & ARGP_LONG_ONLY)
-        parser->short_opts = STORAGE(GLEN + CLEN);
+        parser->short_opts = STORAGE(GLEN + CLEN + LLEN);
     else
         parser->short_opts = NULL;
 
     parser_convert(parser, argp);
+    parser_index(parser);
 
     memset(&parser->state, 0, sizeof(struct argp_state));
 
@@ -0,0 +1,285 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fts.h>
+
+#ifdef nftw64
+#undef nftw64
+#endif
+
+typedef int (*nftw_func)(const char*, const struct stat*, int, struct FTW*);
+
+/* fts_number marks directories whose FTS_DP must not be reported. */
+#define NFTW_QUIET 1
+
+/* Without FTW_PHYS glibc reports each directory once, however many symlinks
+   lead to it; fts only refuses ancestors, so the rest is tracked here in an
+   open-addressed set. */
+struct nftw_dir {
+    dev_t dev;
+    ino_t ino;
+    int used;
+};
+
+struct nftw_seen {
+    struct nftw_dir* slots;
+    size_t cap;
+    size_t count;
+};
+
+static size_t nftw_hash(dev_t dev, ino_t ino, size_t cap) {
+    uint64_t h = ((uint64_t)dev * 0x9e3779b97f4a7c15u) ^ (uint64_t)ino;
+    h ^= h >> 29;
+    return (size_t)h & (cap - 1);
+}
+
+/* Returns 1 if the directory was seen before, 0 after recording it. */
+static int nftw_seen_add(struct nftw_seen* s, dev_t dev, ino_t ino) {
+    if (s->count * 2 >= s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 64;
+        struct nftw_dir* slots = calloc(cap, sizeof(*slots));
+        if (!slots)
+            return -1;
+        for (size_t i = 0; i < s->cap; i++) {
+            if (!s->slots[i].used)
+                continue;
+            size_t j = nftw_hash(s->slots[i].dev, s->slots[i].ino, cap);
+            while (slots[j].used)
+                j = (j + 1) & (cap - 1);
+            slots[j] = s->slots[i];
+        }
+        free(s->slots);
+        s->slots = slots;
+        s->cap = cap;
+    }
+
+    size_t i = nftw_hash(dev, ino, s->cap);
+    while (s->slots[i].used) {
+        if (s->slots[i].dev == dev && s->slots[i].ino == ino)
+            return 1;
+        i = (i + 1) & (s->cap - 1);
+    }
+    s->slots[i].dev = dev;
+    s->slots[i].ino = ino;
+    s->slots[i].used = 1;
+    s->count++;
+    return 0;
+}
+
+/* FTW_CHDIR runs each callback inside the directory holding the entry.  fts
+   itself walks by path from the caller's directory, so the callback is
+   bracketed with fchdir()s; the directory's descriptor is kept while its
+   entries are reported. */
+struct nftw_cwd {
+    int home;
+    int dir;
+    const FTSENT* parent;
+    dev_t dev;
+    ino_t ino;
+};
+
+static int nftw_enter(struct nftw_cwd* cwd, const FTSENT* p, int base) {
+    const FTSENT* parent = p->fts_parent;
+    if (cwd->dir == -1 || cwd->parent != parent || cwd->dev != parent->fts_dev || cwd->ino != parent->fts_ino) {
+        char* dir = base ? strndup(p->fts_path, (size_t)base) : strdup(".");
+        if (!dir)
+            return -1;
+        int fd = openat(cwd->home, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        free(dir);
+        if (fd == -1)
+            return -1;
+        if (cwd->dir != -1)
+            close(cwd->dir);
+        cwd->dir = fd;
+        cwd->parent = parent;
+        cwd->dev = parent->fts_dev;
+        cwd->ino = parent->fts_ino;
+    }
+    return fchdir(cwd->dir);
+}
+
+/* Offset of the last component, as glibc computes it for the start path. */
+static int nftw_base(const FTSENT* p) {
+    if (p->fts_level > FTS_ROOTLEVEL)
+        return (int)(p->fts_pathlen - p->fts_namelen);
+    const char* slash = strrchr(p->fts_path, '/');
+    return slash ? (int)(slash - p->fts_path + 1) : 0;
+}
+
+int nftw(const char* path, nftw_func fn, int fdlimit, int flags) {
+    /* fts holds a fixed number of descriptors whatever the depth. */
+    (void)fdlimit;
+
+    if (!*path) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    /* The start path is reported without trailing slashes. */
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/')
+        len--;
+    char* root = strndup(path, len);
+    if (!root)
+        return -1;
+    char* roots[] = {root, NULL};
+
+    int options = FTS_NOCHDIR | ((flags & FTW_PHYS) ? FTS_PHYSICAL : FTS_LOGICAL);
+    if (flags & FTW_MOUNT)
+        options |= FTS_XDEV;
+
+    struct nftw_cwd cwd = {-1, -1, NULL, 0, 0};
+    if (flags & FTW_CHDIR) {
+        cwd.home = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (cwd.home == -1) {
+            free(root);
+            return -1;
+        }
+    }
+
+    FTS* sp = fts_open(roots, options, NULL);
+    if (!sp) {
+        int saved_errno = errno;
+        if (cwd.home != -1)
+            close(cwd.home);
+        free(root);
+        errno = saved_errno;
+        return -1;
+    }
+
+    struct nftw_seen seen = {NULL, 0, 0};
+    dev_t rootdev = 0;
+    int ret = 0;
+    int stopped = 0;
+    FTSENT* p;
+
+    while (!stopped && (p = fts_read(sp)) != NULL) {
+        int type;
+
+        if (p->fts_level == FTS_ROOTLEVEL && p->fts_info != FTS_DP)
+            rootdev = p->fts_statp->st_dev;
+        /* FTW_MOUNT leaves out other file systems entirely, mount points
+           included. */
+        if ((flags & FTW_MOUNT) && p->fts_info != FTS_NS && p->fts_statp->st_dev != rootdev) {
+            if (p->fts_info == FTS_D) {
+                fts_set(sp, p, FTS_SKIP);
+                p->fts_number = NFTW_QUIET;
+            }
+            continue;
+        }
+
+        switch (p->fts_info) {
+            case FTS_D:
+                if (!(flags & FTW_PHYS)) {
+                    int r = nftw_seen_add(&seen, p->fts_dev, p->fts_ino);
+                    if (r) {
+                        if (r == -1) {
+                            ret = -1;
+                            stopped = 1;
+                        }
+                        fts_set(sp, p, FTS_SKIP);
+                        p->fts_number = NFTW_QUIET;
+                        continue;
+                    }
+                }
+                if (flags & FTW_DEPTH)
+                    continue;
+                /* glibc reports FTW_DNR instead of FTW_D for a directory it
+                   cannot read.  Read it before the callback; fts_read() then
+                   descends into the list built here. */
+                errno = 0;
+                if (!fts_children(sp, 0) && errno) {
+                    fts_set(sp, p, FTS_SKIP);
+                    p->fts_number = NFTW_QUIET;
+                    type = FTW_DNR;
+                    break;
+                }
+                type = FTW_D;
+                break;
+            case FTS_DP:
+                if (!(flags & FTW_DEPTH) || p->fts_number == NFTW_QUIET)
+                    continue;
+                type = FTW_DP;
+                break;
+            case FTS_DNR:
+                type = FTW_DNR;
+                break;
+            case FTS_DC:
+                continue;
+            case FTS_F:
+            case FTS_DEFAULT:
+                type = FTW_F;
+                break;
+            case FTS_SL:
+                type = FTW_SL;
+                break;
+            case FTS_SLNONE:
+                type = FTW_SLN;
+                break;
+            case FTS_NS:
+                if (p->fts_level == FTS_ROOTLEVEL) {
+                    errno = p->fts_errno;
+                    ret = -1;
+                    stopped = 1;
+                    continue;
+                }
+                type = FTW_NS;
+                break;
+            case FTS_ERR:
+                errno = p->fts_errno;
+                ret = -1;
+                stopped = 1;
+                continue;
+            default:
+                continue;
+        }
+
+        struct FTW ftw = {.base = nftw_base(p), .level = p->fts_level};
+        if ((flags & FTW_CHDIR) && nftw_enter(&cwd, p, ftw.base) == -1) {
+            ret = -1;
+            break;
+        }
+        int r = fn(p->fts_path, p->fts_statp, type, &ftw);
+        if ((flags & FTW_CHDIR) && fchdir(cwd.home) == -1 && !r) {
+            ret = -1;
+            break;
+        }
+        if (!r)
+            continue;
+
+        if (!(flags & FTW_ACTIONRETVAL) || (r != FTW_SKIP_SUBTREE && r != FTW_SKIP_SIBLINGS)) {
+            ret = r;
+            break;
+        }
+        if (type == FTW_D) {
+            fts_set(sp, p, FTS_SKIP);
+            p->fts_number = NFTW_QUIET;
+        }
+        if (r == FTW_SKIP_SIBLINGS)
+            for (FTSENT* s = p->fts_link; s; s = s->fts_link)
+                fts_set(sp, s, FTS_SKIP);
+    }
+    if (!stopped && !ret && errno)
+        ret = -1;
+
+    int saved_errno = errno;
+    fts_close(sp);
+    if (cwd.dir != -1)
+        close(cwd.dir);
+    if (cwd.home != -1)
+        close(cwd.home);
+    free(seen.slots);
+    free(root);
+    errno = saved_errno;
+    return ret;
+}
+
+int nftw64(const char* path, nftw_func fn, int fdlimit, int flags) {
+    return nftw(path, fn, fdlimit, flags);
+}
@@ -9,12 +9,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <sys/xattr.h>
 #include <unistd.h>
 #include <fts.h>
 
 #include "musl-bsd/fts_ops.h"
+#include "sdt.h"
 
 static inline int ISDOT(const char* a) {
     return (a[0] == '.' && (!a[1] || (a[1] == '.' && !a[2])));
@@ -47,6 +53,10 @@ static inline __fts_length_t fts_length_cap(size_t len) {
 #warning "O_NOFOLLOW not supported – symlink race protection disabled"
 #endif
 
+#ifndef FS_IOC_GETFLAGS
+#define FS_IOC_GETFLAGS _IOR('f', 1, long)
+#endif
+
 #define BCHILD 1
 #define BNAMES 2
 #define BREAD 3
@@ -63,33 +73,333 @@ struct cycle_state {
     size_t nbuckets;
 };
 
+/* Exclusion set: a path trie whose edges are runs of one or more '/'-joined
+   components.  Runs without branches collapse into a single edge, so deep
+   excluded paths cost one node rather than one node per component. */
+struct excl_node;
+
+struct excl_edge {
+    char* label;
+    size_t len;
+    struct excl_node* child;
+};
+
+struct excl_node {
+    struct excl_edge* edges; /* sorted by first component */
+    size_t nedges;
+    size_t cap;
+    int terminal;
+};
+
+/* Position of a directory in the trie.  node == NULL means nothing beneath
+   the directory is excluded; edge != NULL means the walk stopped inside a
+   compressed edge after consuming off bytes of its label. */
+struct excl_cursor {
+    const struct excl_node* node;
+    const struct excl_edge* edge;
+    size_t off;
+};
+
+struct excl_state {
+    struct excl_node* rel;
+    struct excl_node* abs;
+};
+
+/* Breadth-first walks queue every directory still to be listed.  Entries
+   are reference counted rather than freed on ascent: a directory stays alive
+   while it is queued or being listed and while any entry below it does, so
+   fts_parent chains remain valid for cycle detection. */
+struct bfs_item {
+    FTSENT* dir;
+    FTSENT* child; /* list kept from fts_children(), if any */
+    char* path;
+    size_t len;
+    dev_t rootdev;
+};
+
+struct bfs_state {
+    struct bfs_item* items; /* ring buffer */
+    size_t head;
+    size_t count;
+    size_t cap;
+    FTSENT* dir; /* directory whose children are being returned */
+    FTSENT* rootparent;
+};
+
+/* Descriptors of directories the walk changes back into, keyed by (dev,
+   ino) and evicted least recently used first once more than budget are
+   open.  Only the fds fts_safe_changedir() opens itself are kept, so a hit
+   replaces an open(".."), two fstat()s and a close() with one fchdir(). */
+struct dircache_entry {
+    dev_t dev;
+    ino_t ino;
+    int fd;
+    struct dircache_entry* next; /* hash chain */
+    struct dircache_entry* newer;
+    struct dircache_entry* older;
+};
+
+struct dircache {
+    struct dircache_entry** buckets;
+    size_t nbuckets;
+    struct dircache_entry* newest;
+    struct dircache_entry* oldest;
+    size_t count;
+    size_t budget;
+};
+
+/* Optional content stage.  When fts_read() returns a regular file, the
+   regular files after it in the same directory list are opened ahead, up to
+   window of them, with a readahead hint, so their I/O overlaps the caller's
+   processing of the current one.  Slots are matched by entry address and
+   identity because an entry skipped with fts_set() is freed without ever
+   being returned. */
+struct content_slot {
+    const FTSENT* ent;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    int fd;
+};
+
+struct content_state {
+    int mode;
+    size_t window;
+    struct content_slot* slots; /* in walk order */
+    size_t count;
+    const FTSENT* dir; /* FTS_NOCHDIR: directory dfd refers to */
+    dev_t dirdev;
+    ino_t dirino;
+    int dfd;
+    const FTSENT* cur; /* entry the view below belongs to */
+    int fd;
+    int err;
+    int eof;
+    off_t size;
+    void* map;
+    size_t maplen;
+    char* buf;
+};
+
+/* File system types pruned under FTS_SKIPFSTYPE.  A mount can only change
+   the type where st_dev changes, so the verdict is worked out once per
+   device: by type name from an index of /proc/self/mountinfo, then by
+   statfs() magic if any magic is registered. */
+struct fstype_mount {
+    dev_t dev;
+    size_t type; /* offset into mounttypes */
+};
+
+struct fstype_verdict {
+    dev_t dev;
+    int skip;
+};
+
+struct fstype_state {
+    char** names;
+    size_t nnames;
+    unsigned long* magics;
+    size_t nmagics;
+    struct fstype_verdict* seen;
+    size_t nseen;
+    struct fstype_mount* mounts; /* sorted by dev */
+    size_t nmounts;
+    char* mounttypes;
+    int loaded;
+    int builtin; /* FTS_SKIPFSTYPE given to fts_open() */
+};
+
+/* Resolved symlinks, keyed by the containing directory's identity and the
+   link's inode number from readdir().  The same link in the same directory
+   resolves the same way, so a logical walk that reaches a directory again
+   through another path does not repeat the kernel's path walk; a dangling
+   link keeps its lstat() data and is classified FTS_SLNONE straight away. */
+struct lnk_entry {
+    dev_t dev;
+    ino_t dir;
+    ino_t ino;
+    int dangling;
+    __fts_stat_t st;
+    struct lnk_entry* next;
+};
+
+struct lnk_cache {
+    struct lnk_entry** buckets;
+    size_t nbuckets;
+    size_t count;
+};
+
+/* Extended metadata collected under fts_set_meta().  The records of one
+   directory's entries are carved from an arena they share, freed with the
+   last of them.  Scratch holds a name list and a value at the kernel's
+   XATTR_LIST_MAX and XATTR_SIZE_MAX, so no call is ever repeated for size. */
+struct meta_chunk {
+    struct meta_chunk* next;
+    size_t size;
+    size_t used;
+};
+
+struct meta_arena {
+    struct meta_chunk* chunks;
+    size_t refs;
+};
+
+struct meta_rec {
+    struct meta_arena* arena;
+    struct fts_meta meta;
+};
+
+struct meta_state {
+    int what;
+    char* scratch;
+    struct meta_arena* arena; /* directory being built */
+};
+
 struct fts_private {
     FTS sp;
-    const struct fts_ops* ops;
+    const struct fts_backend* ops;
+    void* ops_ctx;
     struct cycle_state cycles;
+    struct excl_state excl;
+    struct bfs_state bfs;
+    struct dircache dirs;
+    struct content_state content;
+    struct fstype_state fstypes;
+    struct lnk_cache links;
+    struct meta_state meta;
+};
+
+/* FTSENT layout is part of the ABI, so per-entry traversal state lives in a
+   header allocated in front of it. */
+struct fts_entry {
+    struct excl_cursor excl;
+    size_t nref;  /* breadth-first only */
+    ino_t lnkino; /* d_ino of a DT_LNK entry, for the link cache */
+    int followed; /* last stat followed a symbolic link (FTS_FOLLOW, FTS_COMFOLLOW) */
+    struct meta_rec* meta;
+    FTSENT ent;
 };
 
 #define FTS_PRIV(sp) ((struct fts_private*)(sp))
 #define CYCLE_STATE(sp) (&FTS_PRIV(sp)->cycles)
+#define EXCL_STATE(sp) (&FTS_PRIV(sp)->excl)
+#define BFS_STATE(sp) (&FTS_PRIV(sp)->bfs)
+#define DIRCACHE(sp) (&FTS_PRIV(sp)->dirs)
+#define CONTENT(sp) (&FTS_PRIV(sp)->content)
+#define FSTYPES(sp) (&FTS_PRIV(sp)->fstypes)
+#define LNKCACHE(sp) (&FTS_PRIV(sp)->links)
+#define META(sp) (&FTS_PRIV(sp)->meta)
 #define OPS(sp) (FTS_PRIV(sp)->ops)
+#define OPS_CTX(sp) (FTS_PRIV(sp)->ops_ctx)
+#define FTS_ENTRY(p) ((struct fts_entry*)((char*)(p) - offsetof(struct fts_entry, ent)))
 
 __attribute__((visibility("hidden"))) const struct fts_ops* __fts_ops_override = NULL;
 
-static int fts_default_open(const char* path, int flags) {
+static int fts_libc_open(void* ctx, const char* path, int flags) {
+    (void)ctx;
     return open(path, flags);
 }
 
-static const struct fts_ops fts_default_ops = {.open_fn = fts_default_open,
-                                               .close_fn = close,
-                                               .fstat_fn = fstat,
-                                               .fstatat_fn = fstatat,
-                                               .fchdir_fn = fchdir,
-                                               .fdopendir_fn = fdopendir,
-                                               .readdir_fn = readdir,
-                                               .closedir_fn = closedir};
+static int fts_libc_close(void* ctx, int fd) {
+    (void)ctx;
+    return close(fd);
+}
+
+static int fts_libc_fstat(void* ctx, int fd, struct stat* st) {
+    (void)ctx;
+    return fstat(fd, st);
+}
+
+static int fts_libc_fstatat(void* ctx, int dfd, const char* path, struct stat* st, int flags) {
+    (void)ctx;
+    return fstatat(dfd, path, st, flags);
+}
+
+static int fts_libc_fchdir(void* ctx, int fd) {
+    (void)ctx;
+    return fchdir(fd);
+}
+
+static DIR* fts_libc_fdopendir(void* ctx, int fd) {
+    (void)ctx;
+    return fdopendir(fd);
+}
+
+static struct dirent* fts_libc_readdir(void* ctx, DIR* dirp) {
+    (void)ctx;
+    return readdir(dirp);
+}
+
+static int fts_libc_closedir(void* ctx, DIR* dirp) {
+    (void)ctx;
+    return closedir(dirp);
+}
+
+static int fts_libc_dirfd(void* ctx, DIR* dirp) {
+    (void)ctx;
+    return dirfd(dirp);
+}
+
+static const struct fts_backend fts_libc_backend = {.open_fn = fts_libc_open,
+                                                    .close_fn = fts_libc_close,
+                                                    .fstat_fn = fts_libc_fstat,
+                                                    .fstatat_fn = fts_libc_fstatat,
+                                                    .fchdir_fn = fts_libc_fchdir,
+                                                    .fdopendir_fn = fts_libc_fdopendir,
+                                                    .readdir_fn = fts_libc_readdir,
+                                                    .closedir_fn = fts_libc_closedir,
+                                                    .dirfd_fn = fts_libc_dirfd};
+
+/* The legacy hook is served as a backend whose ctx is the hook table. */
+#define LEGACY(ctx) ((const struct fts_ops*)(ctx))
+
+static int fts_legacy_open(void* ctx, const char* path, int flags) {
+    return LEGACY(ctx)->open_fn(path, flags);
+}
+
+static int fts_legacy_close(void* ctx, int fd) {
+    return LEGACY(ctx)->close_fn(fd);
+}
+
+static int fts_legacy_fstat(void* ctx, int fd, struct stat* st) {
+    return LEGACY(ctx)->fstat_fn(fd, st);
+}
+
+static int fts_legacy_fstatat(void* ctx, int dfd, const char* path, struct stat* st, int flags) {
+    return LEGACY(ctx)->fstatat_fn(dfd, path, st, flags);
+}
+
+static int fts_legacy_fchdir(void* ctx, int fd) {
+    return LEGACY(ctx)->fchdir_fn(fd);
+}
+
+static DIR* fts_legacy_fdopendir(void* ctx, int fd) {
+    return LEGACY(ctx)->fdopendir_fn(fd);
+}
+
+static struct dirent* fts_legacy_readdir(void* ctx, DIR* dirp) {
+    return LEGACY(ctx)->readdir_fn(dirp);
+}
+
+static int fts_legacy_closedir(void* ctx, DIR* dirp) {
+    return LEGACY(ctx)->closedir_fn(dirp);
+}
 
-static inline const struct fts_ops* fts_resolve_ops(void) {
-    return __fts_ops_override ? __fts_ops_override : &fts_default_ops;
+static const struct fts_backend fts_legacy_backend = {.open_fn = fts_legacy_open,
+                                                      .close_fn = fts_legacy_close,
+                                                      .fstat_fn = fts_legacy_fstat,
+                                                      .fstatat_fn = fts_legacy_fstatat,
+                                                      .fchdir_fn = fts_legacy_fchdir,
+                                                      .fdopendir_fn = fts_legacy_fdopendir,
+                                                      .readdir_fn = fts_legacy_readdir,
+                                                      .closedir_fn = fts_legacy_closedir,
+                                                      .dirfd_fn = fts_libc_dirfd};
+
+#undef LEGACY
+
+static int fts_backend_valid(const struct fts_backend* ops) {
+    return ops->open_fn && ops->close_fn && ops->fstat_fn && ops->fstatat_fn && ops->fchdir_fn && ops->fdopendir_fn &&
+           ops->readdir_fn && ops->closedir_fn && ops->dirfd_fn;
 }
 
 static inline FTSENT* fts_return_dir(FTSENT* ent) {
@@ -100,6 +410,7 @@ static inline FTSENT* fts_return_dir(FTSENT* ent) {
 static void* safe_recallocarray(void* ptr, size_t oldnmemb, size_t newnmemb, size_t size);
 static FTSENT* fts_alloc(FTS*, const char*, size_t) __attribute__((nonnull));
 static FTSENT* fts_build(FTS*, int);
+static void fts_free(FTSENT*);
 static void fts_lfree(FTSENT*);
 static void fts_load(FTS*, FTSENT*);
 static size_t fts_maxarglen(char* const*);
@@ -116,6 +427,28 @@ static int cycle_insert(struct cycle_state*, dev_t, ino_t, FTSENT*);
 static void cycle_remove(struct cycle_state*, dev_t, ino_t);
 static int fts_cycle_push(FTS*, FTSENT*);
 static void fts_cycle_pop(FTS*, FTSENT*);
+static void excl_free(struct excl_state*);
+static int excl_step(const struct excl_cursor*, const char*, size_t, struct excl_cursor*);
+static int fts_excl_root(FTS*, FTSENT*);
+static FTSENT* fts_step(FTS*);
+static FTSENT* fts_read_bfs(FTS*);
+static void bfs_free(FTS*);
+static int dircache_get(FTS*, dev_t, ino_t);
+static void dircache_drop(FTS*, dev_t, ino_t);
+static int dircache_put(FTS*, dev_t, ino_t, int);
+static void dircache_trim(FTS*, size_t);
+static void content_step(FTS*, FTSENT*);
+static void content_release(struct content_state*);
+static void content_free(struct content_state*);
+static int fstype_skip(FTS*, FTSENT*);
+static void fstype_free(struct fstype_state*);
+static int lnk_get(FTS*, FTSENT*, __fts_stat_t*);
+static void lnk_put(FTS*, FTSENT*, const __fts_stat_t*, int);
+static void lnk_free(struct lnk_cache*);
+static mode_t meta_mode(const FTSENT*);
+static void meta_build(FTS*, FTSENT*, int, mode_t);
+static void meta_unref(struct meta_arena*);
+static void meta_free(struct meta_state*);
 
 static void* safe_recallocarray(void* ptr, size_t oldnmemb, size_t newnmemb, size_t size) {
     if (size != 0 && newnmemb > SIZE_MAX / size) {
@@ -137,6 +470,14 @@ static void* safe_recallocarray(void* ptr, size_t oldnmemb, size_t newnmemb, siz
 }
 
 FTS* fts_open(char* const* argv, int options, int (*compar)(const FTSENT**, const FTSENT**)) {
+    return fts_open_with_ops(argv, options, compar, NULL, NULL);
+}
+
+FTS* fts_open_with_ops(char* const* argv,
+                       int options,
+                       int (*compar)(const FTSENT**, const FTSENT**),
+                       const struct fts_backend* ops,
+                       void* ctx) {
     FTS* sp;
     FTSENT* p;
     FTSENT* root = NULL;
@@ -144,7 +485,7 @@ FTS* fts_open(char* const* argv, int options, int (*compar)(const FTSENT**, cons
     FTSENT* prev = NULL;
     int nitems = 0;
 
-    if ((options & ~FTS_OPTIONMASK) || argv == NULL) {
+    if ((options & ~(FTS_OPTIONMASK | FTS_BREADTHFIRST | FTS_SKIPFSTYPE)) || argv == NULL || (ops && !fts_backend_valid(ops))) {
         errno = EINVAL;
         return NULL;
     }
@@ -165,7 +506,25 @@ FTS* fts_open(char* const* argv, int options, int (*compar)(const FTSENT**, cons
     if (!priv)
         return NULL;
     sp = &priv->sp;
-    FTS_PRIV(sp)->ops = fts_resolve_ops();
+    CONTENT(sp)->dfd = CONTENT(sp)->fd = -1;
+    if (ops) {
+        FTS_PRIV(sp)->ops = ops;
+        FTS_PRIV(sp)->ops_ctx = ctx;
+    }
+    else if (__fts_ops_override) {
+        FTS_PRIV(sp)->ops = &fts_legacy_backend;
+        FTS_PRIV(sp)->ops_ctx = (void*)__fts_ops_override;
+    }
+    else {
+        FTS_PRIV(sp)->ops = &fts_libc_backend;
+    }
+    /* Mount types come from the live mount table and statfs(), which a
+       backend cannot answer for. */
+    if ((options & FTS_SKIPFSTYPE) && FTS_PRIV(sp)->ops != &fts_libc_backend) {
+        free(sp);
+        errno = EINVAL;
+        return NULL;
+    }
 
     if (cycle_init(CYCLE_STATE(sp))) {
         free(sp);
@@ -174,8 +533,11 @@ FTS* fts_open(char* const* argv, int options, int (*compar)(const FTSENT**, cons
 
     sp->fts_compar = compar;
     sp->fts_options = options;
+    FSTYPES(sp)->builtin = ISSET(FTS_SKIPFSTYPE) != 0;
 
-    if (ISSET(FTS_LOGICAL))
+    /* A level-order walk jumps between subtrees, so it addresses everything
+       by path instead of holding directory descriptors. */
+    if (ISSET(FTS_LOGICAL | FTS_BREADTHFIRST))
         SET(FTS_NOCHDIR);
 
     {
@@ -205,7 +567,7 @@ FTS* fts_open(char* const* argv, int options, int (*compar)(const FTSENT**, cons
         if (alen == 0) {
             errno = ENOENT;
             fts_lfree(root);
-            free(parent);
+            fts_free(parent);
             free(sp->fts_path);
             cycle_free(CYCLE_STATE(sp));
             free(sp);
@@ -214,7 +576,7 @@ FTS* fts_open(char* const* argv, int options, int (*compar)(const FTSENT**, cons
         p = fts_alloc(sp, *argv, alen);
         if (!p) {
             fts_lfree(root);
-            free(parent);
+            fts_free(parent);
             free(sp->fts_path);
             cycle_free(CYCLE_STATE(sp));
             free(sp);
@@ -224,6 +586,7 @@ FTS* fts_open(char* const* argv, int options, int (*compar)(const FTSENT**, cons
         p->fts_level = FTS_ROOTLEVEL;
         p->fts_parent = parent;
         p->fts_accpath = p->fts_name;
+        FTS_ENTRY(p)->nref = 1;
 
         p->fts_info = fts_stat(sp, p, ISSET(FTS_COMFOLLOW), -1);
         if (p->fts_info == FTS_DOT)
@@ -253,18 +616,20 @@ FTS* fts_open(char* const* argv, int options, int (*compar)(const FTSENT**, cons
     sp->fts_cur->fts_info = FTS_INIT;
 
     if (!ISSET(FTS_NOCHDIR)) {
-        sp->fts_rfd = OPS(sp)->open_fn(".", O_RDONLY | O_CLOEXEC);
+        sp->fts_rfd = OPS(sp)->open_fn(OPS_CTX(sp), ".", O_RDONLY | O_CLOEXEC);
         if (sp->fts_rfd == -1)
             SET(FTS_NOCHDIR);
     }
 
     if (nitems == 0)
-        free(parent);
+        fts_free(parent);
+    else if (ISSET(FTS_BREADTHFIRST))
+        BFS_STATE(sp)->rootparent = parent;
     return sp;
 
 oom_roots:
     fts_lfree(root);
-    free(parent);
+    fts_free(parent);
     free(sp->fts_path);
     cycle_free(CYCLE_STATE(sp));
     free(sp);
@@ -277,16 +642,19 @@ int fts_close(FTS* sp) {
     if (!sp)
         return 0;
 
-    if (sp->fts_cur) {
+    if (ISSET(FTS_BREADTHFIRST)) {
+        bfs_free(sp);
+    }
+    else if (sp->fts_cur) {
         FTSENT* p = sp->fts_cur;
         if (p->fts_flags & FTS_SYMFOLLOW)
-            OPS(sp)->close_fn(p->fts_symfd);
+            OPS(sp)->close_fn(OPS_CTX(sp), p->fts_symfd);
         while (p->fts_level >= FTS_ROOTLEVEL) {
             FTSENT* next = p->fts_link ? p->fts_link : p->fts_parent;
-            free(p);
+            fts_free(p);
             p = next;
         }
-        free(p);
+        fts_free(p);
     }
 
     if (sp->fts_child)
@@ -295,12 +663,19 @@ int fts_close(FTS* sp) {
     free(sp->fts_array);
     free(sp->fts_path);
     cycle_free(CYCLE_STATE(sp));
+    excl_free(EXCL_STATE(sp));
+    dircache_trim(sp, 0);
+    free(DIRCACHE(sp)->buckets);
+    content_free(CONTENT(sp));
+    fstype_free(FSTYPES(sp));
+    lnk_free(LNKCACHE(sp));
+    meta_free(META(sp));
 
     int rfd = ISSET(FTS_NOCHDIR) ? -1 : sp->fts_rfd;
     if (rfd != -1) {
-        if (OPS(sp)->fchdir_fn(rfd) == -1)
+        if (OPS(sp)->fchdir_fn(OPS_CTX(sp), rfd) == -1)
             saved_errno = errno;
-        OPS(sp)->close_fn(rfd);
+        OPS(sp)->close_fn(OPS_CTX(sp), rfd);
     }
 
     free(sp);
@@ -314,19 +689,35 @@ int fts_close(FTS* sp) {
 }
 
 FTSENT* fts_read(FTS* sp) {
+    if (!sp) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!CONTENT(sp)->mode)
+        return fts_step(sp);
+
+    /* The view of the previous file goes before its entry can be freed. */
+    content_release(CONTENT(sp));
+    FTSENT* p = fts_step(sp);
+    if (p) {
+        int saved_errno = errno;
+        content_step(sp, p);
+        errno = saved_errno;
+    }
+    return p;
+}
+
+static FTSENT* fts_step(FTS* sp) {
     FTSENT* p;
     FTSENT* tmp;
     int instr;
     char* t;
     int saved_errno;
 
-    if (!sp) {
-        errno = EINVAL;
-        return NULL;
-    }
-
     if (!sp->fts_cur || ISSET(FTS_STOP))
         return NULL;
+    if (ISSET(FTS_BREADTHFIRST))
+        return fts_read_bfs(sp);
 
     p = sp->fts_cur;
     instr = p->fts_instr;
@@ -340,7 +731,7 @@ FTSENT* fts_read(FTS* sp) {
     if (instr == FTS_FOLLOW && (p->fts_info == FTS_SL || p->fts_info == FTS_SLNONE)) {
         p->fts_info = fts_stat(sp, p, 1, -1);
         if (p->fts_info == FTS_D && !ISSET(FTS_NOCHDIR)) {
-            p->fts_symfd = OPS(sp)->open_fn(".", O_RDONLY | O_CLOEXEC);
+            p->fts_symfd = OPS(sp)->open_fn(OPS_CTX(sp), ".", O_RDONLY | O_CLOEXEC);
             if (p->fts_symfd == -1) {
                 p->fts_errno = errno;
                 p->fts_info = FTS_ERR;
@@ -353,9 +744,9 @@ FTSENT* fts_read(FTS* sp) {
     }
 
     if (p->fts_info == FTS_D) {
-        if (instr == FTS_SKIP || (ISSET(FTS_XDEV) && p->fts_dev != sp->fts_dev)) {
+        if (instr == FTS_SKIP || (ISSET(FTS_XDEV) && p->fts_dev != sp->fts_dev) || fstype_skip(sp, p)) {
             if (p->fts_flags & FTS_SYMFOLLOW)
-                OPS(sp)->close_fn(p->fts_symfd);
+                OPS(sp)->close_fn(OPS_CTX(sp), p->fts_symfd);
             if (sp->fts_child) {
                 fts_lfree(sp->fts_child);
                 sp->fts_child = NULL;
@@ -405,15 +796,17 @@ next:
     if (p) {
         fts_cycle_pop(sp, tmp);
         sp->fts_cur = NULL;
-        free(tmp);
+        fts_free(tmp);
 
         if (p->fts_level == FTS_ROOTLEVEL) {
-            if (!ISSET(FTS_NOCHDIR) && OPS(sp)->fchdir_fn(sp->fts_rfd)) {
+            if (!ISSET(FTS_NOCHDIR) && OPS(sp)->fchdir_fn(OPS_CTX(sp), sp->fts_rfd)) {
                 SET(FTS_STOP);
                 sp->fts_cur = p;
                 return NULL;
             }
             fts_load(sp, p);
+            if (fts_excl_root(sp, p))
+                goto next;
             sp->fts_cur = p;
             return fts_return_dir(p);
         }
@@ -423,7 +816,7 @@ next:
         if (p->fts_instr == FTS_FOLLOW) {
             p->fts_info = fts_stat(sp, p, 1, -1);
             if (p->fts_info == FTS_D && !ISSET(FTS_NOCHDIR)) {
-                p->fts_symfd = OPS(sp)->open_fn(".", O_RDONLY | O_CLOEXEC);
+                p->fts_symfd = OPS(sp)->open_fn(OPS_CTX(sp), ".", O_RDONLY | O_CLOEXEC);
                 if (p->fts_symfd == -1) {
                     p->fts_errno = errno;
                     p->fts_info = FTS_ERR;
@@ -449,7 +842,7 @@ next:
         FTSENT* up = tmp->fts_parent;
         fts_cycle_pop(sp, tmp);
         sp->fts_cur = NULL;
-        free(tmp);
+        fts_free(tmp);
         p = up;
     }
 
@@ -461,29 +854,32 @@ next:
     sp->fts_path[p->fts_pathlen] = '\0';
 
     if (p->fts_level == FTS_ROOTPARENTLEVEL) {
-        free(p);
+        fts_free(p);
         errno = 0;
         sp->fts_cur = NULL;
         return NULL;
     }
 
+    /* Nothing changes back into p once it is left. */
+    dircache_drop(sp, p->fts_dev, p->fts_ino);
+
     if (p->fts_level == FTS_ROOTLEVEL) {
-        if (!ISSET(FTS_NOCHDIR) && OPS(sp)->fchdir_fn(sp->fts_rfd)) {
+        if (!ISSET(FTS_NOCHDIR) && OPS(sp)->fchdir_fn(OPS_CTX(sp), sp->fts_rfd)) {
             SET(FTS_STOP);
             sp->fts_cur = p;
             return NULL;
         }
     }
     else if (p->fts_flags & FTS_SYMFOLLOW) {
-        if (!ISSET(FTS_NOCHDIR) && OPS(sp)->fchdir_fn(p->fts_symfd)) {
+        if (!ISSET(FTS_NOCHDIR) && OPS(sp)->fchdir_fn(OPS_CTX(sp), p->fts_symfd)) {
             saved_errno = errno;
-            OPS(sp)->close_fn(p->fts_symfd);
+            OPS(sp)->close_fn(OPS_CTX(sp), p->fts_symfd);
             errno = saved_errno;
             SET(FTS_STOP);
             sp->fts_cur = p;
             return NULL;
         }
-        OPS(sp)->close_fn(p->fts_symfd);
+        OPS(sp)->close_fn(OPS_CTX(sp), p->fts_symfd);
     }
     else if (!(p->fts_flags & FTS_DONTCHDIR) && fts_safe_changedir(sp, p->fts_parent, -1, "..")) {
         SET(FTS_STOP);
@@ -496,12 +892,238 @@ next:
     return fts_return_dir(p);
 }
 
+static void bfs_release(FTSENT* p) {
+    while (p && p->fts_level >= FTS_ROOTLEVEL && --FTS_ENTRY(p)->nref == 0) {
+        FTSENT* up = p->fts_parent;
+        fts_free(p);
+        p = up;
+    }
+}
+
+static int bfs_push(FTS* sp, FTSENT* p, FTSENT* child) {
+    struct bfs_state* bs = BFS_STATE(sp);
+
+    if (bs->count == bs->cap) {
+        size_t ncap = bs->cap ? bs->cap * 2 : 64;
+        struct bfs_item* items = safe_recallocarray(NULL, 0, ncap, sizeof(*items));
+        if (!items)
+            return -1;
+        for (size_t i = 0; i < bs->count; i++)
+            items[i] = bs->items[(bs->head + i) % bs->cap];
+        free(bs->items);
+        bs->items = items;
+        bs->head = 0;
+        bs->cap = ncap;
+    }
+
+    char* path = malloc((size_t)p->fts_pathlen + 1);
+    if (!path)
+        return -1;
+    memcpy(path, sp->fts_path, p->fts_pathlen);
+    path[p->fts_pathlen] = '\0';
+
+    struct bfs_item* it = &bs->items[(bs->head + bs->count) % bs->cap];
+    it->dir = p;
+    it->child = child;
+    it->path = path;
+    it->len = p->fts_pathlen;
+    it->rootdev = sp->fts_dev;
+    bs->count++;
+    return 0;
+}
+
+static int bfs_pop(struct bfs_state* bs, struct bfs_item* out) {
+    if (!bs->count)
+        return 0;
+    *out = bs->items[bs->head];
+    bs->head = (bs->head + 1) % bs->cap;
+    bs->count--;
+    return 1;
+}
+
+static void bfs_free(FTS* sp) {
+    struct bfs_state* bs = BFS_STATE(sp);
+    struct bfs_item it;
+    FTSENT* p = sp->fts_cur;
+
+    if (p && p->fts_info == FTS_INIT) {
+        FTSENT* next = p->fts_link;
+        fts_free(p);
+        p = next;
+    }
+    while (p) {
+        FTSENT* next = p->fts_link;
+        bfs_release(p);
+        p = next;
+    }
+    bfs_release(bs->dir);
+    while (bfs_pop(bs, &it)) {
+        fts_lfree(it.child);
+        free(it.path);
+        bfs_release(it.dir);
+    }
+    free(bs->items);
+    fts_free(bs->rootparent);
+}
+
+/* Level-order fts_read().  Each directory is returned once, as FTS_D, when
+   its parent is listed; it is queued when the caller moves past it and its
+   children follow once every directory queued before it has been listed.
+   Directories are not returned again in post-order. */
+static FTSENT* fts_read_bfs(FTS* sp) {
+    struct bfs_state* bs = BFS_STATE(sp);
+    FTSENT* p = sp->fts_cur;
+    FTSENT* next;
+    int instr = p->fts_instr;
+    char* t;
+
+    p->fts_instr = FTS_NOINSTR;
+
+    if (instr == FTS_AGAIN) {
+        p->fts_info = fts_stat(sp, p, 0, -1);
+        return fts_return_dir(p);
+    }
+    if (instr == FTS_FOLLOW && (p->fts_info == FTS_SL || p->fts_info == FTS_SLNONE)) {
+        p->fts_info = fts_stat(sp, p, 1, -1);
+        return fts_return_dir(p);
+    }
+
+    /* A list built by fts_children() is kept for when the directory's turn
+       comes, unless it was built without stat information. */
+    FTSENT* child = sp->fts_child;
+    sp->fts_child = NULL;
+    if (ISSET(FTS_NAMEONLY)) {
+        CLR(FTS_NAMEONLY);
+        fts_lfree(child);
+        child = NULL;
+    }
+
+    next = p->fts_link;
+    if (p->fts_info == FTS_INIT) {
+        fts_free(p);
+    }
+    else if (p->fts_info == FTS_D && instr != FTS_SKIP && !(ISSET(FTS_XDEV) && p->fts_dev != sp->fts_dev) &&
+             !fstype_skip(sp, p)) {
+        if (bfs_push(sp, p, child)) {
+            fts_lfree(child);
+            SET(FTS_STOP);
+            p->fts_errno = errno ? errno : ENOMEM;
+            p->fts_info = FTS_ERR;
+            return fts_return_dir(p);
+        }
+        p->fts_link = NULL;
+    }
+    else {
+        fts_lfree(child);
+        p->fts_link = NULL;
+        bfs_release(p);
+    }
+    sp->fts_cur = NULL;
+
+    for (;;) {
+        while ((p = next) != NULL) {
+            next = p->fts_link;
+
+            if (p->fts_level == FTS_ROOTLEVEL) {
+                fts_load(sp, p);
+                if (fts_excl_root(sp, p)) {
+                    bfs_release(p);
+                    continue;
+                }
+                sp->fts_cur = p;
+                return fts_return_dir(p);
+            }
+
+            if (p->fts_instr == FTS_SKIP) {
+                bfs_release(p);
+                continue;
+            }
+            t = sp->fts_path + ((p->fts_parent->fts_path[p->fts_parent->fts_pathlen - 1] == '/')
+                                    ? p->fts_parent->fts_pathlen - 1
+                                    : p->fts_parent->fts_pathlen);
+            *t++ = '/';
+            memmove(t, p->fts_name, p->fts_namelen + 1);
+
+            /* The access path is the path buffer, so it is built first. */
+            if (p->fts_instr == FTS_FOLLOW) {
+                p->fts_info = fts_stat(sp, p, 1, -1);
+                p->fts_instr = FTS_NOINSTR;
+            }
+            sp->fts_cur = p;
+            return fts_return_dir(p);
+        }
+
+        /* This level's list is exhausted; list the next queued directory. */
+        bfs_release(bs->dir);
+        bs->dir = NULL;
+
+        struct bfs_item it;
+        if (!bfs_pop(bs, &it)) {
+            fts_free(bs->rootparent);
+            bs->rootparent = NULL;
+            errno = 0;
+            return NULL;
+        }
+
+        FTSENT* d = it.dir;
+        sp->fts_cur = d;
+        if (it.len >= sp->fts_pathlen) {
+            if (fts_palloc(sp, it.len + 1)) {
+                fts_lfree(it.child);
+                free(it.path);
+                d->fts_errno = errno;
+                d->fts_info = FTS_ERR;
+                SET(FTS_STOP);
+                return NULL;
+            }
+            fts_padjust(sp, d);
+        }
+        memcpy(sp->fts_path, it.path, it.len + 1);
+        free(it.path);
+        d->fts_path = d->fts_accpath = sp->fts_path;
+        sp->fts_dev = it.rootdev;
+
+        FTSENT* head = it.child;
+        if (head) {
+            for (FTSENT* c = head; c; c = c->fts_link)
+                c->fts_path = c->fts_accpath = sp->fts_path;
+        }
+        else {
+            head = fts_build(sp, BREAD);
+        }
+        if (!head) {
+            if (ISSET(FTS_STOP))
+                return NULL;
+            /* An empty directory has nothing to add; one that cannot be
+               read is returned again with the error, as in a depth-first
+               walk. */
+            if (d->fts_info == FTS_DP) {
+                sp->fts_cur = NULL;
+                bfs_release(d);
+                continue;
+            }
+            return fts_return_dir(d);
+        }
+
+        for (FTSENT* c = head; c; c = c->fts_link) {
+            FTS_ENTRY(c)->nref = 1;
+            FTS_ENTRY(d)->nref++;
+        }
+        bs->dir = d;
+        sp->fts_cur = NULL;
+        next = head;
+    }
+}
+
 int fts_set(FTS* sp, FTSENT* p, int instr) {
     (void)sp;
     if (instr && instr != FTS_AGAIN && instr != FTS_FOLLOW && instr != FTS_SKIP && instr != FTS_NOINSTR) {
         errno = EINVAL;
         return 1;
     }
+    /* FTS_AGAIN asks for fresh stat information. */
+    if (instr == FTS_AGAIN)
+        FTS_ENTRY(p)->lnkino = 0;
     p->fts_instr = instr;
     return 0;
 }
@@ -534,21 +1156,21 @@ FTSENT* fts_children(FTS* sp, int instr) {
     if (instr == FTS_NAMEONLY)
         SET(FTS_NAMEONLY);
 
-    if (fts_cycle_push(sp, cur)) {
+    if (!ISSET(FTS_BREADTHFIRST) && fts_cycle_push(sp, cur)) {
         errno = ENOMEM;
         return NULL;
     }
 
     if (cur->fts_level == FTS_ROOTLEVEL && cur->fts_accpath[0] != '/' && !ISSET(FTS_NOCHDIR)) {
-        int cwd = OPS(sp)->open_fn(".", O_RDONLY | O_CLOEXEC);
+        int cwd = OPS(sp)->open_fn(OPS_CTX(sp), ".", O_RDONLY | O_CLOEXEC);
         if (cwd == -1)
             return NULL;
         sp->fts_child = fts_build(sp, instr == FTS_NAMEONLY ? BNAMES : BCHILD);
-        if (OPS(sp)->fchdir_fn(cwd) == -1) {
-            OPS(sp)->close_fn(cwd);
+        if (OPS(sp)->fchdir_fn(OPS_CTX(sp), cwd) == -1) {
+            OPS(sp)->close_fn(OPS_CTX(sp), cwd);
             return NULL;
         }
-        OPS(sp)->close_fn(cwd);
+        OPS(sp)->close_fn(OPS_CTX(sp), cwd);
     }
     else {
         sp->fts_child = fts_build(sp, instr == FTS_NAMEONLY ? BNAMES : BCHILD);
@@ -558,7 +1180,7 @@ FTSENT* fts_children(FTS* sp, int instr) {
     return sp->fts_child;
 }
 
-static FTSENT* fts_build(FTS* sp, int type) {
+static FTSENT* fts_build_list(FTS* sp, int type, int* countp) {
     FTSENT* head = NULL;
     FTSENT* tail = NULL;
     FTSENT* cur = sp->fts_cur;
@@ -574,6 +1196,7 @@ static FTSENT* fts_build(FTS* sp, int type) {
     int saved_errno;
     struct stat sb;
     char* cp;
+    const struct excl_cursor dexcl = FTS_ENTRY(cur)->excl;
 
     if (cur->fts_level >= SHRT_MAX) {
         errno = ENAMETOOLONG;
@@ -584,10 +1207,10 @@ static FTSENT* fts_build(FTS* sp, int type) {
 
     int open_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
 #if HAS_O_NOFOLLOW
-    if (ISSET(FTS_PHYSICAL))
+    if (ISSET(FTS_PHYSICAL) && !FTS_ENTRY(cur)->followed)
         open_flags |= O_NOFOLLOW;
 #endif
-    int fd = OPS(sp)->open_fn(cur->fts_accpath, open_flags);
+    int fd = OPS(sp)->open_fn(OPS_CTX(sp), cur->fts_accpath, open_flags);
     if (fd == -1) {
         cur->fts_info = (type == BREAD) ? FTS_DNR : FTS_ERR;
         cur->fts_errno = errno;
@@ -595,26 +1218,26 @@ static FTSENT* fts_build(FTS* sp, int type) {
     }
 
     /* Verify the opened directory matches the expected dev/ino (stat-to-open race protection) */
-    if (OPS(sp)->fstat_fn(fd, &sb) == -1) {
+    if (OPS(sp)->fstat_fn(OPS_CTX(sp), fd, &sb) == -1) {
         saved_errno = errno;
-        OPS(sp)->close_fn(fd);
+        OPS(sp)->close_fn(OPS_CTX(sp), fd);
         cur->fts_info = FTS_ERR;
         cur->fts_errno = saved_errno;
         errno = saved_errno;
         return NULL;
     }
     if (sb.st_dev != cur->fts_dev || sb.st_ino != cur->fts_ino) {
-        OPS(sp)->close_fn(fd);
+        OPS(sp)->close_fn(OPS_CTX(sp), fd);
         errno = ENOENT;
         cur->fts_info = FTS_ERR;
         cur->fts_errno = errno;
         return NULL;
     }
 
-    dirp = OPS(sp)->fdopendir_fn(fd);
+    dirp = OPS(sp)->fdopendir_fn(OPS_CTX(sp), fd);
     if (!dirp) {
         saved_errno = errno;
-        OPS(sp)->close_fn(fd);
+        OPS(sp)->close_fn(OPS_CTX(sp), fd);
         cur->fts_info = FTS_ERR;
         cur->fts_errno = saved_errno;
         errno = saved_errno;
@@ -641,7 +1264,7 @@ static FTSENT* fts_build(FTS* sp, int type) {
 #endif
 
     if ((nlinks != 0) || (type == BREAD)) {
-        if (fts_safe_changedir(sp, cur, dirfd(dirp), NULL)) {
+        if (fts_safe_changedir(sp, cur, OPS(sp)->dirfd_fn(OPS_CTX(sp), dirp), NULL)) {
             cderrno = errno;
             cur->fts_flags |= FTS_DONTCHDIR;
         }
@@ -662,20 +1285,30 @@ static FTSENT* fts_build(FTS* sp, int type) {
     level = (cur->fts_level < SHRT_MAX) ? cur->fts_level + 1 : SHRT_MAX;
 
     errno = 0;
-    while ((dp = OPS(sp)->readdir_fn(dirp)) != NULL) {
+    while ((dp = OPS(sp)->readdir_fn(OPS_CTX(sp), dirp)) != NULL) {
         if (!ISSET(FTS_SEEDOT) && ISDOT(dp->d_name))
             continue;
 
         size_t dnamlen = strlen(dp->d_name);
 
+        /* Excluded names are dropped before any allocation or stat. */
+        struct excl_cursor excl = {NULL, NULL, 0};
+        if (dexcl.node && !ISDOT(dp->d_name) && excl_step(&dexcl, dp->d_name, dnamlen, &excl))
+            continue;
+
         p = fts_alloc(sp, dp->d_name, dnamlen);
         if (!p)
             goto mem_fail;
+        FTS_ENTRY(p)->excl = excl;
+#ifdef DT_LNK
+        if (dp->d_type == DT_LNK)
+            FTS_ENTRY(p)->lnkino = dp->d_ino;
+#endif
 
         if (dnamlen >= maxlen) {
             char* oldaddr = sp->fts_path;
             if (fts_palloc(sp, dnamlen + len + 1)) {
-                free(p);
+                fts_free(p);
                 goto mem_fail;
             }
             if (oldaddr != sp->fts_path) {
@@ -691,7 +1324,7 @@ static FTSENT* fts_build(FTS* sp, int type) {
         p->fts_parent = cur;
         size_t pathlen = len + dnamlen;
         if (pathlen < len || pathlen > fts_length_max()) {
-            free(p);
+            fts_free(p);
             errno = ENAMETOOLONG;
             goto mem_fail;
         }
@@ -714,12 +1347,20 @@ static FTSENT* fts_build(FTS* sp, int type) {
         ) {
             p->fts_info = FTS_NSOK;
             p->fts_accpath = ISSET(FTS_NOCHDIR) ? p->fts_path : p->fts_name;
+            if (META(sp)->what && type != BNAMES) {
+#ifdef DT_DIR
+                mode_t mode = dp->d_type == DT_UNKNOWN ? 0 : DTTOIF(dp->d_type);
+#else
+                mode_t mode = 0;
+#endif
+                meta_build(sp, p, OPS(sp)->dirfd_fn(OPS_CTX(sp), dirp), mode);
+            }
         }
         else {
             if (ISSET(FTS_NOCHDIR)) {
                 p->fts_accpath = p->fts_path;
                 memcpy(cp, p->fts_name, p->fts_namelen + 1);
-                p->fts_info = fts_stat(sp, p, 0, dirfd(dirp));
+                p->fts_info = fts_stat(sp, p, 0, OPS(sp)->dirfd_fn(OPS_CTX(sp), dirp));
             }
             else {
                 p->fts_accpath = p->fts_name;
@@ -727,6 +1368,8 @@ static FTSENT* fts_build(FTS* sp, int type) {
             }
             if (nlinks > 0 && (p->fts_info == FTS_D || p->fts_info == FTS_DC || p->fts_info == FTS_DOT))
                 --nlinks;
+            if (META(sp)->what && p->fts_info != FTS_NS)
+                meta_build(sp, p, OPS(sp)->dirfd_fn(OPS_CTX(sp), dirp), meta_mode(p));
         }
 
         p->fts_link = NULL;
@@ -742,7 +1385,7 @@ static FTSENT* fts_build(FTS* sp, int type) {
     mem_fail:
         saved_errno = errno;
         fts_lfree(head);
-        OPS(sp)->closedir_fn(dirp);
+        OPS(sp)->closedir_fn(OPS_CTX(sp), dirp);
         cur->fts_info = FTS_ERR;
         SET(FTS_STOP);
         errno = saved_errno;
@@ -752,48 +1395,73 @@ static FTSENT* fts_build(FTS* sp, int type) {
     if (errno != 0) {
         saved_errno = errno;
         fts_lfree(head);
-        OPS(sp)->closedir_fn(dirp);
+        OPS(sp)->closedir_fn(OPS_CTX(sp), dirp);
         cur->fts_info = FTS_ERR;
         SET(FTS_STOP);
         errno = saved_errno;
         return NULL;
     }
 
-    OPS(sp)->closedir_fn(dirp);
-
-    if (nitems == 0) {
-        if (type == BREAD)
-            cur->fts_info = FTS_DP;
-        return NULL;
-    }
-
-    if (sp->fts_compar && nitems > 1)
-        head = fts_sort(sp, head, nitems);
+    OPS(sp)->closedir_fn(OPS_CTX(sp), dirp);
+    *countp = nitems;
 
+    /* An empty directory is returned as FTS_DP straight away, so leave it
+       again now; fts_read() will not ascend out of it. */
     if (descend && (type == BCHILD || nitems == 0)) {
         if (cur->fts_level == FTS_ROOTLEVEL) {
-            if (OPS(sp)->fchdir_fn(sp->fts_rfd) == -1) {
+            if (!ISSET(FTS_NOCHDIR) && OPS(sp)->fchdir_fn(OPS_CTX(sp), sp->fts_rfd) == -1) {
+                fts_lfree(head);
                 cur->fts_info = FTS_ERR;
                 SET(FTS_STOP);
                 return NULL;
             }
         }
         else if (fts_safe_changedir(sp, cur->fts_parent, -1, "..")) {
+            fts_lfree(head);
             cur->fts_info = FTS_ERR;
             SET(FTS_STOP);
             return NULL;
         }
     }
 
+    /* Names were built in place after cur's path; end it again, so that it
+       still reads right after fts_children(). */
+    if (ISSET(FTS_NOCHDIR))
+        sp->fts_path[cur->fts_pathlen] = '\0';
+
+    if (nitems == 0) {
+        if (type == BREAD)
+            cur->fts_info = FTS_DP;
+        return NULL;
+    }
+
+    if (sp->fts_compar && nitems > 1)
+        head = fts_sort(sp, head, nitems);
+
     return head;
 }
 
-static unsigned short fts_stat(FTS* sp, FTSENT* p, int follow, int dfd) {
+static FTSENT* fts_build(FTS* sp, int type) {
+    FTSENT* cur = sp->fts_cur;
+    int nitems = 0;
+
+    STAP_PROBE2(fts, build_entry, cur->fts_path, cur->fts_level);
+    FTSENT* head = fts_build_list(sp, type, &nitems);
+    if (META(sp)->arena) {
+        meta_unref(META(sp)->arena);
+        META(sp)->arena = NULL;
+    }
+    STAP_PROBE3(fts, build_return, cur->fts_level, nitems, cur->fts_info);
+    return head;
+}
+
+static unsigned short fts_stat_entry(FTS* sp, FTSENT* p, int follow, int dfd) {
     __fts_stat_t sb;
     __fts_stat_t* sbp;
     const char* path;
     int saved_errno;
 
+    FTS_ENTRY(p)->followed = follow;
     if (p->fts_level >= SHRT_MAX) {
         errno = ERANGE;
         p->fts_errno = ERANGE;
@@ -821,18 +1489,26 @@ static unsigned short fts_stat(FTS* sp, FTSENT* p, int follow, int dfd) {
 #endif
 
     if (ISSET(FTS_LOGICAL) || follow) {
-        if (OPS(sp)->fstatat_fn(dfd, path, sbp, 0) == -1) {
+        int cached = lnk_get(sp, p, sbp);
+        if (cached == FTS_SLNONE) {
+            errno = 0;
+            return FTS_SLNONE;
+        }
+        if (cached == -1 && OPS(sp)->fstatat_fn(OPS_CTX(sp), dfd, path, sbp, 0) == -1) {
             saved_errno = errno;
-            if (OPS(sp)->fstatat_fn(dfd, path, sbp, AT_SYMLINK_NOFOLLOW) == 0) {
+            if (OPS(sp)->fstatat_fn(OPS_CTX(sp), dfd, path, sbp, AT_SYMLINK_NOFOLLOW) == 0) {
+                lnk_put(sp, p, sbp, 1);
                 errno = 0;
                 return FTS_SLNONE;
             }
             p->fts_errno = saved_errno;
             goto err;
         }
+        if (cached == -1)
+            lnk_put(sp, p, sbp, 0);
     }
     else {
-        if (OPS(sp)->fstatat_fn(dfd, path, sbp, AT_SYMLINK_NOFOLLOW) == -1) {
+        if (OPS(sp)->fstatat_fn(OPS_CTX(sp), dfd, path, sbp, AT_SYMLINK_NOFOLLOW) == -1) {
             p->fts_errno = errno;
             goto err;
         }
@@ -849,12 +1525,14 @@ static unsigned short fts_stat(FTS* sp, FTSENT* p, int follow, int dfd) {
         for (FTSENT* t = p->fts_parent; t->fts_level >= FTS_ROOTLEVEL; t = t->fts_parent) {
             if (p->fts_ino == t->fts_ino && p->fts_dev == t->fts_dev) {
                 p->fts_cycle = t;
+                STAP_PROBE2(fts, cycle, p->fts_accpath, t->fts_level);
                 return FTS_DC;
             }
         }
         FTSENT* cyc = cycle_lookup(CYCLE_STATE(sp), p->fts_dev, p->fts_ino);
         if (cyc) {
             p->fts_cycle = cyc;
+            STAP_PROBE2(fts, cycle, p->fts_accpath, cyc->fts_level);
             return FTS_DC;
         }
         return FTS_D;
@@ -871,6 +1549,12 @@ err:
     return FTS_NS;
 }
 
+static unsigned short fts_stat(FTS* sp, FTSENT* p, int follow, int dfd) {
+    unsigned short info = fts_stat_entry(sp, p, follow, dfd);
+    STAP_PROBE3(fts, stat, p->fts_accpath, info, p->fts_errno);
+    return info;
+}
+
 static FTSENT* fts_sort(FTS* sp, FTSENT* head, int nitems) {
     if ((unsigned int)nitems > sp->fts_nitems) {
         FTSENT** a = safe_recallocarray(sp->fts_array, sp->fts_nitems, nitems + 40, sizeof(FTSENT*));
@@ -899,13 +1583,14 @@ static FTSENT* fts_sort(FTS* sp, FTSENT* head, int nitems) {
 }
 
 static FTSENT* fts_alloc(FTS* sp, const char* name, size_t namelen) {
-    size_t len = sizeof(FTSENT) + namelen + 1;
+    size_t len = offsetof(struct fts_entry, ent) + sizeof(FTSENT) + namelen + 1;
     if (!ISSET(FTS_NOSTAT))
         len += sizeof(__fts_stat_t) + ALIGNBYTES;
 
-    FTSENT* p = calloc(1, len);
-    if (!p)
+    struct fts_entry* e = calloc(1, len);
+    if (!e)
         return NULL;
+    FTSENT* p = &e->ent;
 
     p->fts_path = sp->fts_path;
     p->fts_namelen = fts_length_cap(namelen);
@@ -923,10 +1608,18 @@ static FTSENT* fts_alloc(FTS* sp, const char* name, size_t namelen) {
     return p;
 }
 
+static void fts_free(FTSENT* p) {
+    if (!p)
+        return;
+    if (FTS_ENTRY(p)->meta)
+        meta_unref(FTS_ENTRY(p)->meta->arena);
+    free(FTS_ENTRY(p));
+}
+
 static void fts_lfree(FTSENT* head) {
     while (head) {
         FTSENT* next = head->fts_link;
-        free(head);
+        fts_free(head);
         head = next;
     }
 }
@@ -961,6 +1654,7 @@ static int fts_palloc(FTS* sp, size_t need) {
     if (!newbuf)
         return 1;
 
+    STAP_PROBE2(fts, palloc, sp->fts_pathlen, need);
     sp->fts_path = newbuf;
     sp->fts_pathlen = fts_length_cap(need);
     return 0;
@@ -997,9 +1691,15 @@ static size_t fts_maxarglen(char* const* argv) {
     return max + 1;
 }
 
-static int fts_safe_changedir(FTS* sp, FTSENT* p, int fd, const char* path) {
-    if (ISSET(FTS_NOCHDIR))
-        return 0;
+static int fts_changedir(FTS* sp, FTSENT* p, int fd, const char* path) {
+    if (fd == -1) {
+        int cached = dircache_get(sp, p->fts_dev, p->fts_ino);
+        if (cached != -1) {
+            if (OPS(sp)->fchdir_fn(OPS_CTX(sp), cached) == 0)
+                return 0;
+            dircache_drop(sp, p->fts_dev, p->fts_ino);
+        }
+    }
 
     int newfd = fd;
     if (fd == -1) {
@@ -1008,48 +1708,57 @@ static int fts_safe_changedir(FTS* sp, FTSENT* p, int fd, const char* path) {
                      | O_NOFOLLOW
 #endif
             ;
-        newfd = OPS(sp)->open_fn(path ? path : p->fts_accpath, oflags);
+        newfd = OPS(sp)->open_fn(OPS_CTX(sp), path ? path : p->fts_accpath, oflags);
         if (newfd == -1)
             return -1;
     }
 
     struct stat before;
-    if (OPS(sp)->fstat_fn(newfd, &before) == -1) {
+    if (OPS(sp)->fstat_fn(OPS_CTX(sp), newfd, &before) == -1) {
         int e = errno;
         if (fd == -1)
-            OPS(sp)->close_fn(newfd);
+            OPS(sp)->close_fn(OPS_CTX(sp), newfd);
         errno = e;
         return -1;
     }
 
     if (p->fts_dev != before.st_dev || p->fts_ino != before.st_ino) {
         if (fd == -1)
-            OPS(sp)->close_fn(newfd);
+            OPS(sp)->close_fn(OPS_CTX(sp), newfd);
         errno = ENOENT;
         return -1;
     }
 
-    if (OPS(sp)->fchdir_fn(newfd) == -1) {
+    if (OPS(sp)->fchdir_fn(OPS_CTX(sp), newfd) == -1) {
         int e = errno;
         if (fd == -1)
-            OPS(sp)->close_fn(newfd);
+            OPS(sp)->close_fn(OPS_CTX(sp), newfd);
         errno = e;
         return -1;
     }
 
     struct stat after;
-    if (OPS(sp)->fstat_fn(newfd, &after) == -1 || before.st_dev != after.st_dev || before.st_ino != after.st_ino) {
+    if (OPS(sp)->fstat_fn(OPS_CTX(sp), newfd, &after) == -1 || before.st_dev != after.st_dev || before.st_ino != after.st_ino) {
         if (fd == -1)
-            OPS(sp)->close_fn(newfd);
+            OPS(sp)->close_fn(OPS_CTX(sp), newfd);
         errno = ENOENT;
         return -1;
     }
 
-    if (fd == -1)
-        OPS(sp)->close_fn(newfd);
+    if (fd == -1 && dircache_put(sp, p->fts_dev, p->fts_ino, newfd))
+        OPS(sp)->close_fn(OPS_CTX(sp), newfd);
     return 0;
 }
 
+static int fts_safe_changedir(FTS* sp, FTSENT* p, int fd, const char* path) {
+    if (ISSET(FTS_NOCHDIR))
+        return 0;
+
+    int ret = fts_changedir(sp, p, fd, path);
+    STAP_PROBE3(fts, changedir, path ? path : p->fts_accpath, fd, ret);
+    return ret;
+}
+
 static size_t cycle_hash(dev_t dev, ino_t ino, size_t nbuckets) {
     size_t h = ((size_t)dev << 5) ^ (size_t)ino;
     return nbuckets ? (h & (nbuckets - 1)) : 0;
@@ -1161,12 +1870,745 @@ static void fts_cycle_pop(FTS* sp, FTSENT* p) {
     }
 }
 
-static void fts_load(FTS* sp, FTSENT* p) {
-    size_t len = p->fts_namelen;
-    p->fts_pathlen = p->fts_namelen;
-    memmove(sp->fts_path, p->fts_name, len + 1);
+static void dircache_unlink(struct dircache* dc, struct dircache_entry* e) {
+    if (e->newer)
+        e->newer->older = e->older;
+    else
+        dc->newest = e->older;
+    if (e->older)
+        e->older->newer = e->newer;
+    else
+        dc->oldest = e->newer;
+    e->newer = e->older = NULL;
+}
 
-    char* slash = strrchr(p->fts_name, '/');
+static void dircache_link(struct dircache* dc, struct dircache_entry* e) {
+    e->older = dc->newest;
+    e->newer = NULL;
+    if (dc->newest)
+        dc->newest->newer = e;
+    else
+        dc->oldest = e;
+    dc->newest = e;
+}
+
+static struct dircache_entry** dircache_slot(struct dircache* dc, dev_t dev, ino_t ino) {
+    struct dircache_entry** ep = &dc->buckets[cycle_hash(dev, ino, dc->nbuckets)];
+    while (*ep && ((*ep)->dev != dev || (*ep)->ino != ino))
+        ep = &(*ep)->next;
+    return ep;
+}
+
+static void dircache_remove(FTS* sp, struct dircache_entry** ep) {
+    struct dircache* dc = DIRCACHE(sp);
+    struct dircache_entry* e = *ep;
+    *ep = e->next;
+    dircache_unlink(dc, e);
+    OPS(sp)->close_fn(OPS_CTX(sp), e->fd);
+    free(e);
+    dc->count--;
+}
+
+static int dircache_get(FTS* sp, dev_t dev, ino_t ino) {
+    struct dircache* dc = DIRCACHE(sp);
+    if (!dc->count)
+        return -1;
+    struct dircache_entry* e = *dircache_slot(dc, dev, ino);
+    if (!e)
+        return -1;
+    dircache_unlink(dc, e);
+    dircache_link(dc, e);
+    return e->fd;
+}
+
+static void dircache_drop(FTS* sp, dev_t dev, ino_t ino) {
+    struct dircache* dc = DIRCACHE(sp);
+    if (!dc->count)
+        return;
+    struct dircache_entry** ep = dircache_slot(dc, dev, ino);
+    if (*ep)
+        dircache_remove(sp, ep);
+}
+
+/* Takes ownership of fd on success. */
+static int dircache_put(FTS* sp, dev_t dev, ino_t ino, int fd) {
+    struct dircache* dc = DIRCACHE(sp);
+    if (!dc->budget)
+        return -1;
+    if (!dc->buckets) {
+        dc->buckets = calloc(64, sizeof(*dc->buckets));
+        if (!dc->buckets)
+            return -1;
+        dc->nbuckets = 64;
+    }
+
+    struct dircache_entry** ep = dircache_slot(dc, dev, ino);
+    if (*ep)
+        dircache_remove(sp, ep);
+    struct dircache_entry* e = calloc(1, sizeof(*e));
+    if (!e)
+        return -1;
+    e->dev = dev;
+    e->ino = ino;
+    e->fd = fd;
+    ep = &dc->buckets[cycle_hash(dev, ino, dc->nbuckets)];
+    e->next = *ep;
+    *ep = e;
+    dircache_link(dc, e);
+    dc->count++;
+
+    dircache_trim(sp, dc->budget);
+    return 0;
+}
+
+static void dircache_trim(FTS* sp, size_t keep) {
+    struct dircache* dc = DIRCACHE(sp);
+    while (dc->count > keep) {
+        struct dircache_entry* e = dc->oldest;
+        dircache_remove(sp, dircache_slot(dc, e->dev, e->ino));
+    }
+}
+
+/* Beyond this many links the cache is emptied and refilled. */
+#define LNKCACHE_MAX (1u << 16)
+
+static size_t lnk_hash(dev_t dev, ino_t dir, ino_t ino, size_t nbuckets) {
+    return cycle_hash(dev, dir ^ ((size_t)ino * 2654435761u), nbuckets);
+}
+
+static struct lnk_entry* lnk_find(const struct lnk_cache* lc, dev_t dev, ino_t dir, ino_t ino) {
+    if (!lc->count)
+        return NULL;
+    for (struct lnk_entry* e = lc->buckets[lnk_hash(dev, dir, ino, lc->nbuckets)]; e; e = e->next)
+        if (e->ino == ino && e->dir == dir && e->dev == dev)
+            return e;
+    return NULL;
+}
+
+/* Fill sb from the cache.  Returns FTS_SLNONE for a dangling link, 0 for a
+   resolved one and -1 when p is not a known link or not cached yet. */
+static int lnk_get(FTS* sp, FTSENT* p, __fts_stat_t* sb) {
+    ino_t ino = FTS_ENTRY(p)->lnkino;
+    if (!ino || p->fts_level <= FTS_ROOTLEVEL)
+        return -1;
+    const FTSENT* dir = p->fts_parent;
+    const struct lnk_entry* e = lnk_find(LNKCACHE(sp), dir->fts_dev, dir->fts_ino, ino);
+    if (!e)
+        return -1;
+    *sb = e->st;
+    return e->dangling ? FTS_SLNONE : 0;
+}
+
+static void lnk_clear(struct lnk_cache* lc) {
+    for (size_t i = 0; i < lc->nbuckets; i++) {
+        struct lnk_entry* e = lc->buckets[i];
+        while (e) {
+            struct lnk_entry* next = e->next;
+            free(e);
+            e = next;
+        }
+        lc->buckets[i] = NULL;
+    }
+    lc->count = 0;
+}
+
+static int lnk_grow(struct lnk_cache* lc) {
+    size_t n = lc->nbuckets ? lc->nbuckets * 2 : 256;
+    struct lnk_entry** b = calloc(n, sizeof(*b));
+    if (!b)
+        return -1;
+    for (size_t i = 0; i < lc->nbuckets; i++) {
+        struct lnk_entry* e = lc->buckets[i];
+        while (e) {
+            struct lnk_entry* next = e->next;
+            size_t h = lnk_hash(e->dev, e->dir, e->ino, n);
+            e->next = b[h];
+            b[h] = e;
+            e = next;
+        }
+    }
+    free(lc->buckets);
+    lc->buckets = b;
+    lc->nbuckets = n;
+    return 0;
+}
+
+/* Best effort: a failed insert only costs a later lookup. */
+static void lnk_put(FTS* sp, FTSENT* p, const __fts_stat_t* sb, int dangling) {
+    struct lnk_cache* lc = LNKCACHE(sp);
+    ino_t ino = FTS_ENTRY(p)->lnkino;
+    if (!ino || p->fts_level <= FTS_ROOTLEVEL)
+        return;
+    /* A dangling result is the link's own lstat(); anything but a symlink
+       means the name was replaced since readdir(). */
+    if (dangling && !S_ISLNK(sb->st_mode))
+        return;
+
+    if (lc->count >= LNKCACHE_MAX)
+        lnk_clear(lc);
+    if (lc->count >= lc->nbuckets && lc->nbuckets < LNKCACHE_MAX && lnk_grow(lc))
+        return;
+
+    const FTSENT* dir = p->fts_parent;
+    struct lnk_entry* e = malloc(sizeof(*e));
+    if (!e)
+        return;
+    e->dev = dir->fts_dev;
+    e->dir = dir->fts_ino;
+    e->ino = ino;
+    e->dangling = dangling;
+    e->st = *sb;
+    size_t h = lnk_hash(e->dev, e->dir, e->ino, lc->nbuckets);
+    e->next = lc->buckets[h];
+    lc->buckets[h] = e;
+    lc->count++;
+}
+
+static void lnk_free(struct lnk_cache* lc) {
+    lnk_clear(lc);
+    free(lc->buckets);
+    lc->buckets = NULL;
+    lc->nbuckets = 0;
+}
+
+/* Kernel pseudo file systems pruned when FTS_SKIPFSTYPE is passed to
+   fts_open(), with their statfs() magic for mounts missing from the
+   mountinfo index. */
+static const struct {
+    const char* name;
+    unsigned long magic;
+} fstype_builtin[] = {
+    {"binfmt_misc", 0x42494e4d},
+    {"bpf", 0xcafe4a11},
+    {"cgroup", 0x27e0eb},
+    {"cgroup2", 0x63677270},
+    {"configfs", 0x62656570},
+    {"debugfs", 0x64626720},
+    {"devpts", 0x1cd1},
+    {"efivarfs", 0xde5e81e4},
+    {"fusectl", 0x65735543},
+    {"mqueue", 0x19800202},
+    {"proc", 0x9fa0},
+    {"pstore", 0x6165676c},
+    {"securityfs", 0x73636673},
+    {"selinuxfs", 0xf97cff8c},
+    {"sysfs", 0x62656572},
+    {"tracefs", 0x74726163},
+};
+
+static int fstype_mount_cmp(const void* a, const void* b) {
+    dev_t x = ((const struct fstype_mount*)a)->dev;
+    dev_t y = ((const struct fstype_mount*)b)->dev;
+    return (x > y) - (x < y);
+}
+
+/* Index the mount table once per stream.  Mounts made later are not in it
+   and fall back to statfs(). */
+static void fstype_load(struct fstype_state* fs) {
+    fs->loaded = 1;
+    FILE* f = fopen("/proc/self/mountinfo", "re");
+    if (!f)
+        return;
+
+    char* line = NULL;
+    size_t linecap = 0;
+    size_t ncap = 0, tlen = 0, tcap = 0;
+    while (getline(&line, &linecap, f) != -1) {
+        unsigned int maj, min;
+        if (sscanf(line, "%*s %*s %u:%u", &maj, &min) != 2)
+            continue;
+        const char* sep = strstr(line, " - ");
+        if (!sep)
+            continue;
+        const char* type = sep + 3;
+        size_t len = strcspn(type, " \n");
+
+        if (fs->nmounts == ncap) {
+            size_t n = ncap ? ncap * 2 : 64;
+            struct fstype_mount* m = realloc(fs->mounts, n * sizeof(*m));
+            if (!m)
+                break;
+            fs->mounts = m;
+            ncap = n;
+        }
+        if (tlen + len + 1 > tcap) {
+            size_t n = tcap ? tcap * 2 : 1024;
+            while (n < tlen + len + 1)
+                n *= 2;
+            char* t = realloc(fs->mounttypes, n);
+            if (!t)
+                break;
+            fs->mounttypes = t;
+            tcap = n;
+        }
+        memcpy(fs->mounttypes + tlen, type, len);
+        fs->mounttypes[tlen + len] = '\0';
+        fs->mounts[fs->nmounts].dev = makedev(maj, min);
+        fs->mounts[fs->nmounts].type = tlen;
+        fs->nmounts++;
+        tlen += len + 1;
+    }
+    free(line);
+    fclose(f);
+
+    if (fs->nmounts > 1)
+        qsort(fs->mounts, fs->nmounts, sizeof(*fs->mounts), fstype_mount_cmp);
+}
+
+/* "fuse" also names every "fuse.<subtype>". */
+static int fstype_name_match(const char* want, const char* type) {
+    size_t n = strlen(want);
+    return strncmp(type, want, n) == 0 && (type[n] == '\0' || type[n] == '.');
+}
+
+static int fstype_by_name(const struct fstype_state* fs, const char* type) {
+    for (size_t i = 0; i < fs->nnames; i++)
+        if (fstype_name_match(fs->names[i], type))
+            return 1;
+    if (fs->builtin)
+        for (size_t i = 0; i < sizeof(fstype_builtin) / sizeof(fstype_builtin[0]); i++)
+            if (fstype_name_match(fstype_builtin[i].name, type))
+                return 1;
+    return 0;
+}
+
+static int fstype_by_magic(const struct fstype_state* fs, unsigned long magic) {
+    for (size_t i = 0; i < fs->nmagics; i++)
+        if (fs->magics[i] == magic)
+            return 1;
+    if (fs->builtin)
+        for (size_t i = 0; i < sizeof(fstype_builtin) / sizeof(fstype_builtin[0]); i++)
+            if (fstype_builtin[i].magic == magic)
+                return 1;
+    return 0;
+}
+
+/* Whether directory p is the root of a pruned mount.  Only called for
+   directories about to be entered, so nothing below p is opened. */
+static int fstype_skip(FTS* sp, FTSENT* p) {
+    struct fstype_state* fs = FSTYPES(sp);
+
+    if (!ISSET(FTS_SKIPFSTYPE))
+        return 0;
+    if (p->fts_level > FTS_ROOTLEVEL && p->fts_dev == p->fts_parent->fts_dev)
+        return 0;
+    for (size_t i = 0; i < fs->nseen; i++)
+        if (fs->seen[i].dev == p->fts_dev)
+            return fs->seen[i].skip;
+
+    if (!fs->loaded)
+        fstype_load(fs);
+    struct fstype_mount key = {.dev = p->fts_dev};
+    const struct fstype_mount* m =
+        fs->nmounts ? bsearch(&key, fs->mounts, fs->nmounts, sizeof(*fs->mounts), fstype_mount_cmp) : NULL;
+
+    int skip = m && fstype_by_name(fs, fs->mounttypes + m->type);
+    if (!skip && (fs->nmagics || (fs->builtin && !m))) {
+        struct statfs sfs;
+        int saved_errno = errno;
+        if (statfs(p->fts_accpath, &sfs) == 0)
+            skip = fstype_by_magic(fs, (unsigned long)sfs.f_type);
+        errno = saved_errno;
+    }
+
+    struct fstype_verdict* v = realloc(fs->seen, (fs->nseen + 1) * sizeof(*v));
+    if (v) {
+        fs->seen = v;
+        v[fs->nseen].dev = p->fts_dev;
+        v[fs->nseen].skip = skip;
+        fs->nseen++;
+    }
+    return skip;
+}
+
+static void fstype_free(struct fstype_state* fs) {
+    for (size_t i = 0; i < fs->nnames; i++)
+        free(fs->names[i]);
+    free(fs->names);
+    free(fs->magics);
+    free(fs->seen);
+    free(fs->mounts);
+    free(fs->mounttypes);
+}
+
+/* Bytes of each file opened ahead that are hinted for readahead, and the
+   size of the buffer FTS_CONTENT_READ returns data in. */
+#define CONTENT_AHEAD (2u << 20)
+#define CONTENT_BUFSIZE (128u << 10)
+
+/* Files are opened with raw system calls rather than through the backend,
+   which has no openat(); fts_set_content() only enables the stage on the
+   live file system.  Non-blocking so that a FIFO swapped in after the stat
+   cannot hang the open; the identity check rejects it right after. */
+static int content_open(int dfd, const char* name, dev_t dev, ino_t ino, off_t* size) {
+    struct stat sb;
+    int fd = openat(dfd, name, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &sb) == -1) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    if (!S_ISREG(sb.st_mode) || sb.st_dev != dev || sb.st_ino != ino) {
+        close(fd);
+        errno = ENOENT;
+        return -1;
+    }
+    *size = sb.st_size;
+    return fd;
+}
+
+/* Close the first n slots. */
+static void content_drop(struct content_state* cs, size_t n) {
+    if (!n)
+        return;
+    for (size_t i = 0; i < n; i++)
+        close(cs->slots[i].fd);
+    memmove(cs->slots, cs->slots + n, (cs->count - n) * sizeof(*cs->slots));
+    cs->count -= n;
+}
+
+/* Close slots from n on. */
+static void content_truncate(struct content_state* cs, size_t n) {
+    while (cs->count > n)
+        close(cs->slots[--cs->count].fd);
+}
+
+/* fts_dev and fts_ino are only filled in for directories, and under
+   FTS_NOSTAT there is no stat buffer at all; such files are not read ahead. */
+static int content_match(const struct content_slot* slot, const FTSENT* p) {
+    return slot->ent == p && p->fts_statp && slot->dev == p->fts_statp->st_dev && slot->ino == p->fts_statp->st_ino;
+}
+
+/* Directory p's name is relative to.  In chdir mode that is the working
+   directory; under FTS_NOCHDIR the parent is opened once per directory and
+   verified like fts_build() verifies it. */
+static int content_dirfd(FTS* sp, FTSENT* p) {
+    struct content_state* cs = CONTENT(sp);
+    const FTSENT* dir = p->fts_parent;
+    struct stat sb;
+
+    if (!ISSET(FTS_NOCHDIR) || p->fts_level == FTS_ROOTLEVEL)
+        return AT_FDCWD;
+    if (cs->dfd != -1 && cs->dir == dir && cs->dirdev == dir->fts_dev && cs->dirino == dir->fts_ino)
+        return cs->dfd;
+
+    if (cs->dfd != -1)
+        close(cs->dfd);
+    cs->dfd = -1;
+    cs->dir = NULL;
+
+    size_t len = p->fts_pathlen - p->fts_namelen;
+    char saved = p->fts_path[len];
+    p->fts_path[len] = '\0';
+    int fd = open(p->fts_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    p->fts_path[len] = saved;
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &sb) == -1 || sb.st_dev != dir->fts_dev || sb.st_ino != dir->fts_ino) {
+        close(fd);
+        errno = ENOENT;
+        return -1;
+    }
+    cs->dfd = fd;
+    cs->dir = dir;
+    cs->dirdev = dir->fts_dev;
+    cs->dirino = dir->fts_ino;
+    return fd;
+}
+
+/* Roots are named by their access path; everything else by its name
+   relative to the directory descriptor. */
+static const char* content_name(const FTSENT* p) {
+    return p->fts_level == FTS_ROOTLEVEL ? p->fts_accpath : p->fts_name;
+}
+
+static void content_step(FTS* sp, FTSENT* p) {
+    struct content_state* cs = CONTENT(sp);
+
+    if (p->fts_info != FTS_F)
+        return;
+    cs->cur = p;
+    cs->err = 0;
+    cs->eof = 0;
+
+    int dfd = content_dirfd(sp, p);
+    if (dfd == -1) {
+        cs->err = errno;
+        content_drop(cs, cs->count);
+        return;
+    }
+
+    /* Take p's descriptor if it was opened ahead; anything queued before it
+       was skipped. */
+    size_t k = 0;
+    while (k < cs->count && !content_match(&cs->slots[k], p))
+        k++;
+    if (k < cs->count) {
+        content_drop(cs, k);
+        cs->fd = cs->slots[0].fd;
+        cs->size = cs->slots[0].size;
+        memmove(cs->slots, cs->slots + 1, --cs->count * sizeof(*cs->slots));
+    }
+    else {
+        content_drop(cs, cs->count);
+        struct stat sb;
+        const struct stat* want = p->fts_statp;
+        if (!want) {
+            int flags = ISSET(FTS_LOGICAL) || (p->fts_level == FTS_ROOTLEVEL && ISSET(FTS_COMFOLLOW))
+                            ? 0
+                            : AT_SYMLINK_NOFOLLOW;
+            if (fstatat(dfd, content_name(p), &sb, flags) == -1) {
+                cs->err = errno;
+                return;
+            }
+            want = &sb;
+        }
+        cs->fd = content_open(dfd, content_name(p), want->st_dev, want->st_ino, &cs->size);
+        if (cs->fd == -1) {
+            cs->err = errno;
+            return;
+        }
+    }
+    posix_fadvise(cs->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    /* Keep the window filled with the next regular files in the list. */
+    size_t i = 0;
+    for (const FTSENT* s = p->fts_link; s && i < cs->window; s = s->fts_link) {
+        if (s->fts_info != FTS_F || s->fts_instr == FTS_SKIP || !s->fts_statp)
+            continue;
+        if (i < cs->count) {
+            if (content_match(&cs->slots[i], s)) {
+                i++;
+                continue;
+            }
+            content_truncate(cs, i);
+        }
+        struct content_slot* slot = &cs->slots[cs->count];
+        slot->dev = s->fts_statp->st_dev;
+        slot->ino = s->fts_statp->st_ino;
+        slot->fd = content_open(dfd, content_name(s), slot->dev, slot->ino, &slot->size);
+        if (slot->fd == -1)
+            continue;
+        slot->ent = s;
+        posix_fadvise(slot->fd, 0, slot->size < CONTENT_AHEAD ? slot->size : CONTENT_AHEAD, POSIX_FADV_WILLNEED);
+        cs->count++;
+        i++;
+    }
+}
+
+/* Drop the current file's view and descriptor. */
+static void content_release(struct content_state* cs) {
+    if (cs->map)
+        munmap(cs->map, cs->maplen);
+    cs->map = NULL;
+    if (cs->fd != -1)
+        close(cs->fd);
+    cs->fd = -1;
+    cs->cur = NULL;
+}
+
+static void content_free(struct content_state* cs) {
+    content_release(cs);
+    content_drop(cs, cs->count);
+    if (cs->dfd != -1)
+        close(cs->dfd);
+    cs->dfd = -1;
+    cs->dir = NULL;
+    free(cs->slots);
+    cs->slots = NULL;
+    free(cs->buf);
+    cs->buf = NULL;
+    cs->mode = 0;
+    cs->window = 0;
+}
+
+#define META_SCRATCH (64u << 10)
+#define META_CHUNK 4096u
+
+static void* meta_alloc(struct meta_arena* a, size_t n) {
+    const size_t hdr = ALIGN(sizeof(struct meta_chunk));
+    struct meta_chunk* c = a->chunks;
+
+    n = ALIGN(n);
+    if (!c || c->size - c->used < n) {
+        size_t size = n > META_CHUNK - hdr ? n : META_CHUNK - hdr;
+        c = malloc(hdr + size);
+        if (!c)
+            return NULL;
+        c->size = size;
+        c->used = 0;
+        c->next = a->chunks;
+        a->chunks = c;
+    }
+    void* ptr = (char*)c + hdr + c->used;
+    c->used += n;
+    return ptr;
+}
+
+static void meta_unref(struct meta_arena* a) {
+    if (--a->refs)
+        return;
+    while (a->chunks) {
+        struct meta_chunk* next = a->chunks->next;
+        free(a->chunks);
+        a->chunks = next;
+    }
+    free(a);
+}
+
+static ssize_t meta_list(int fd, const char* path, int follow, char* buf, size_t size) {
+    if (fd != -1)
+        return flistxattr(fd, buf, size);
+    return follow ? listxattr(path, buf, size) : llistxattr(path, buf, size);
+}
+
+static ssize_t meta_get(int fd, const char* path, int follow, const char* name, void* buf, size_t size) {
+    if (fd != -1)
+        return fgetxattr(fd, name, buf, size);
+    return follow ? getxattr(path, name, buf, size) : lgetxattr(path, name, buf, size);
+}
+
+static void meta_xattrs(struct meta_state* ms, struct meta_arena* a, struct fts_meta* m, int fd, const char* path,
+                        int follow) {
+    char* names = ms->scratch;
+    char* value = ms->scratch + META_SCRATCH;
+    ssize_t len = meta_list(fd, path, follow, names, META_SCRATCH);
+    if (len == -1) {
+        m->xattr_errno = errno;
+        return;
+    }
+
+    size_t n = 0;
+    for (ssize_t i = 0; i < len; i += (ssize_t)strlen(names + i) + 1)
+        n++;
+    if (!n)
+        return;
+    struct fts_xattr* xs = meta_alloc(a, n * sizeof(*xs));
+    if (!xs) {
+        m->xattr_errno = ENOMEM;
+        return;
+    }
+    m->xattrs = xs;
+
+    for (ssize_t i = 0; i < len;) {
+        const char* name = names + i;
+        size_t namelen = strlen(name);
+        i += (ssize_t)namelen + 1;
+
+        ssize_t size = meta_get(fd, path, follow, name, value, META_SCRATCH);
+        if (size == -1) {
+            /* ENODATA: removed since it was listed. */
+            if (errno != ENODATA)
+                m->xattr_errno = errno;
+            continue;
+        }
+        char* copy = meta_alloc(a, namelen + 1 + (size_t)size);
+        if (!copy) {
+            m->xattr_errno = ENOMEM;
+            return;
+        }
+        memcpy(copy, name, namelen + 1);
+        memcpy(copy + namelen + 1, value, (size_t)size);
+        xs[m->nxattrs].name = copy;
+        xs[m->nxattrs].value = copy + namelen + 1;
+        xs[m->nxattrs].size = (size_t)size;
+        m->nxattrs++;
+    }
+}
+
+/* Collect metadata for name relative to directory dfd.  Regular files and
+   directories are opened, without blocking, so attributes and inode flags
+   come off one descriptor; other types are never opened, and are reached
+   through /proc/self/fd when dfd is a real descriptor. */
+static struct meta_rec* meta_collect(struct meta_state* ms, struct meta_arena* a, int dfd, const char* name,
+                                     mode_t mode, int follow) {
+    struct meta_rec* rec = meta_alloc(a, sizeof(*rec));
+    if (!rec)
+        return NULL;
+    memset(rec, 0, sizeof(*rec));
+    rec->arena = a;
+    struct fts_meta* m = &rec->meta;
+    m->xattr_errno = m->flags_errno = ENODATA;
+
+    int fd = -1;
+    int saved_errno = ENOTTY;
+    if (S_ISREG(mode) || S_ISDIR(mode)) {
+        fd = openat(dfd, name, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC | (follow ? 0 : O_NOFOLLOW));
+        if (fd == -1)
+            saved_errno = errno;
+    }
+    if (ms->what & FTS_META_FLAGS) {
+        int flags;
+        m->flags_errno = saved_errno;
+        if (fd != -1)
+            m->flags_errno = ioctl(fd, FS_IOC_GETFLAGS, &flags) == 0 ? 0 : errno;
+        if (!m->flags_errno)
+            m->flags = (unsigned int)flags;
+    }
+    if (ms->what & FTS_META_XATTR) {
+        char path[sizeof("/proc/self/fd//") + 3 * sizeof(int) + NAME_MAX];
+        const char* at = name;
+        if (fd == -1 && dfd != AT_FDCWD) {
+            snprintf(path, sizeof(path), "/proc/self/fd/%d/%s", dfd, name);
+            at = path;
+        }
+        m->xattr_errno = 0;
+        meta_xattrs(ms, a, m, fd, at, follow && !S_ISLNK(mode));
+    }
+    if (fd != -1)
+        close(fd);
+
+    a->refs++;
+    return rec;
+}
+
+/* File type of a stat'ed entry.  Under FTS_NOSTAT there is no stat buffer
+   and the type is taken from fts_info; 0 stands for a type meta_collect()
+   must not open. */
+static mode_t meta_mode(const FTSENT* p) {
+    if (p->fts_statp)
+        return p->fts_statp->st_mode;
+    switch (p->fts_info) {
+        case FTS_D:
+        case FTS_DC:
+        case FTS_DOT:
+            return S_IFDIR;
+        case FTS_F:
+            return S_IFREG;
+        case FTS_SL:
+        case FTS_SLNONE:
+            return S_IFLNK;
+        default:
+            return 0;
+    }
+}
+
+static void meta_build(FTS* sp, FTSENT* p, int dfd, mode_t mode) {
+    struct meta_state* ms = META(sp);
+    if (!ms->arena) {
+        ms->arena = calloc(1, sizeof(*ms->arena));
+        if (!ms->arena)
+            return;
+        ms->arena->refs = 1;
+    }
+    FTS_ENTRY(p)->meta = meta_collect(ms, ms->arena, dfd, p->fts_name, mode, ISSET(FTS_LOGICAL));
+}
+
+static void meta_free(struct meta_state* ms) {
+    free(ms->scratch);
+    ms->scratch = NULL;
+    ms->what = 0;
+}
+
+static void fts_load(FTS* sp, FTSENT* p) {
+    size_t len = p->fts_namelen;
+    p->fts_pathlen = p->fts_namelen;
+    memmove(sp->fts_path, p->fts_name, len + 1);
+
+    char* slash = strrchr(p->fts_name, '/');
     if (slash && (slash != p->fts_name || slash[1])) {
         size_t leaf_len = strlen(++slash);
         memmove(p->fts_name, slash, leaf_len + 1);
@@ -1178,3 +2620,882 @@ static void fts_load(FTS* sp, FTSENT* p) {
     p->fts_pathlen = fts_length_cap(strlen(sp->fts_path));
     sp->fts_dev = p->fts_dev;
 }
+
+/* Compare component a with the first component of the label b. */
+static int excl_compcmp(const char* a, size_t alen, const char* b, size_t blen) {
+    const char* slash = memchr(b, '/', blen);
+    if (slash)
+        blen = (size_t)(slash - b);
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c)
+        return c;
+    return alen < blen ? -1 : alen > blen;
+}
+
+static struct excl_edge* excl_find(const struct excl_node* n, const char* name, size_t len, size_t* pos) {
+    size_t lo = 0;
+    size_t hi = n->nedges;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = excl_compcmp(name, len, n->edges[mid].label, n->edges[mid].len);
+        if (c == 0) {
+            if (pos)
+                *pos = mid;
+            return &n->edges[mid];
+        }
+        if (c < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    if (pos)
+        *pos = lo;
+    return NULL;
+}
+
+static void excl_node_free(struct excl_node* n) {
+    if (!n)
+        return;
+    for (size_t i = 0; i < n->nedges; i++) {
+        free(n->edges[i].label);
+        excl_node_free(n->edges[i].child);
+    }
+    free(n->edges);
+    free(n);
+}
+
+static void excl_free(struct excl_state* xs) {
+    excl_node_free(xs->rel);
+    excl_node_free(xs->abs);
+    xs->rel = xs->abs = NULL;
+}
+
+static int excl_add_edge(struct excl_node* n, size_t pos, const char* label, size_t len, struct excl_node* child) {
+    if (n->nedges == n->cap) {
+        size_t cap = n->cap ? n->cap * 2 : 4;
+        struct excl_edge* edges = safe_recallocarray(n->edges, n->cap, cap, sizeof(*edges));
+        if (!edges)
+            return -1;
+        n->edges = edges;
+        n->cap = cap;
+    }
+    char* copy = malloc(len + 1);
+    if (!copy)
+        return -1;
+    memcpy(copy, label, len);
+    copy[len] = '\0';
+    memmove(&n->edges[pos + 1], &n->edges[pos], (n->nedges - pos) * sizeof(*n->edges));
+    n->edges[pos].label = copy;
+    n->edges[pos].len = len;
+    n->edges[pos].child = child;
+    n->nedges++;
+    return 0;
+}
+
+/* Insert the normalized path rest[0..len) (components joined by single
+   slashes) below n.  A terminal node prunes its whole subtree, so paths
+   beneath an existing exclusion are absorbed and a new exclusion above
+   existing ones discards them. */
+static int excl_insert(struct excl_node* n, const char* rest, size_t len) {
+    while (!n->terminal) {
+        if (len == 0) {
+            for (size_t i = 0; i < n->nedges; i++) {
+                free(n->edges[i].label);
+                excl_node_free(n->edges[i].child);
+            }
+            free(n->edges);
+            n->edges = NULL;
+            n->nedges = n->cap = 0;
+            n->terminal = 1;
+            return 0;
+        }
+
+        const char* slash = memchr(rest, '/', len);
+        size_t clen = slash ? (size_t)(slash - rest) : len;
+        size_t pos;
+        struct excl_edge* e = excl_find(n, rest, clen, &pos);
+        if (!e) {
+            struct excl_node* leaf = calloc(1, sizeof(*leaf));
+            if (!leaf)
+                return -1;
+            leaf->terminal = 1;
+            if (excl_add_edge(n, pos, rest, len, leaf)) {
+                free(leaf);
+                return -1;
+            }
+            return 0;
+        }
+
+        /* Longest common run of whole components. */
+        size_t common = 0;
+        size_t i = 0;
+        while (i < e->len && i < len && e->label[i] == rest[i]) {
+            i++;
+            if ((i == e->len || e->label[i] == '/') && (i == len || rest[i] == '/'))
+                common = i;
+        }
+
+        if (common < e->len) {
+            struct excl_node* mid = calloc(1, sizeof(*mid));
+            if (!mid)
+                return -1;
+            if (excl_add_edge(mid, 0, e->label + common + 1, e->len - common - 1, e->child)) {
+                free(mid);
+                return -1;
+            }
+            e->label[common] = '\0';
+            e->len = common;
+            e->child = mid;
+        }
+
+        n = e->child;
+        rest += common;
+        len -= common;
+        if (len) {
+            rest++;
+            len--;
+        }
+    }
+    return 0;
+}
+
+/* Advance cur by one path component.  Returns 1 when the component is
+   excluded; otherwise stores the child's position in out, with out->node
+   left NULL once the component falls outside the trie. */
+static int excl_step(const struct excl_cursor* cur, const char* name, size_t len, struct excl_cursor* out) {
+    const struct excl_edge* e = cur->edge;
+    size_t off = cur->off;
+
+    out->node = NULL;
+    out->edge = NULL;
+    out->off = 0;
+
+    if (!e) {
+        e = excl_find(cur->node, name, len, NULL);
+        if (!e)
+            return 0;
+        off = 0;
+    }
+    else if (e->len - off < len || memcmp(e->label + off, name, len) != 0 ||
+             (off + len < e->len && e->label[off + len] != '/')) {
+        return 0;
+    }
+
+    off += len;
+    if (off == e->len) {
+        if (e->child->terminal)
+            return 1;
+        out->node = e->child;
+        return 0;
+    }
+    out->node = cur->node;
+    out->edge = e;
+    out->off = off + 1;
+    return 0;
+}
+
+/* Position a freshly loaded root in the trie.  Returns 1 when the root lies
+   at or below an excluded path and must be skipped. */
+static int fts_excl_root(FTS* sp, FTSENT* p) {
+    struct excl_state* xs = EXCL_STATE(sp);
+    struct excl_cursor* pos = &FTS_ENTRY(p)->excl;
+    const char* path = p->fts_path;
+    const char* end = path + p->fts_pathlen;
+
+    pos->node = (path[0] == '/') ? xs->abs : xs->rel;
+    pos->edge = NULL;
+    pos->off = 0;
+    if (pos->node && pos->node->terminal)
+        return 1;
+
+    while (pos->node && path < end) {
+        while (path < end && *path == '/')
+            path++;
+        const char* c = path;
+        while (path < end && *path != '/')
+            path++;
+        size_t clen = (size_t)(path - c);
+        if (clen == 0 || (clen == 1 && c[0] == '.'))
+            continue;
+        struct excl_cursor next;
+        if (excl_step(pos, c, clen, &next))
+            return 1;
+        *pos = next;
+    }
+    return 0;
+}
+
+int fts_set_dircache(FTS* sp, size_t nfds) {
+    if (!sp) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct dircache* dc = DIRCACHE(sp);
+    dc->budget = nfds;
+    dircache_trim(sp, nfds);
+    return 0;
+}
+
+int fts_set_content(FTS* sp, int mode, size_t window) {
+    if (!sp || (mode != 0 && mode != FTS_CONTENT_MMAP && mode != FTS_CONTENT_READ)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (mode && OPS(sp) != &fts_libc_backend) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    struct content_state* cs = CONTENT(sp);
+    struct content_slot* slots = NULL;
+    if (mode && window) {
+        slots = calloc(window, sizeof(*slots));
+        if (!slots)
+            return -1;
+    }
+    content_free(cs);
+    cs->slots = slots;
+    cs->mode = mode;
+    cs->window = window;
+    return 0;
+}
+
+ssize_t fts_content(FTS* sp, const void** data) {
+    if (!sp || !data) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct content_state* cs = CONTENT(sp);
+    if (!cs->mode || !cs->cur || cs->cur != sp->fts_cur) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (cs->fd == -1) {
+        errno = cs->err;
+        return -1;
+    }
+    if (cs->eof || cs->size == 0) {
+        cs->eof = 1;
+        *data = NULL;
+        return 0;
+    }
+
+    /* A file that cannot be mapped is read instead. */
+    if (cs->mode == FTS_CONTENT_MMAP && !cs->map && (uintmax_t)cs->size <= SSIZE_MAX) {
+        void* map = mmap(NULL, (size_t)cs->size, PROT_READ, MAP_PRIVATE, cs->fd, 0);
+        if (map != MAP_FAILED) {
+            posix_madvise(map, (size_t)cs->size, POSIX_MADV_SEQUENTIAL);
+            cs->map = map;
+            cs->maplen = (size_t)cs->size;
+            cs->eof = 1;
+            *data = map;
+            return (ssize_t)cs->maplen;
+        }
+    }
+
+    if (!cs->buf) {
+        cs->buf = malloc(CONTENT_BUFSIZE);
+        if (!cs->buf)
+            return -1;
+    }
+    ssize_t n;
+    do
+        n = read(cs->fd, cs->buf, CONTENT_BUFSIZE);
+    while (n == -1 && errno == EINTR);
+    if (n == -1)
+        return -1;
+    if (n == 0)
+        cs->eof = 1;
+    *data = n ? cs->buf : NULL;
+    return n;
+}
+
+int fts_set_meta(FTS* sp, int what) {
+    if (!sp || (what & ~(FTS_META_XATTR | FTS_META_FLAGS))) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (what && OPS(sp) != &fts_libc_backend) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    struct meta_state* ms = META(sp);
+    if (what && !ms->scratch) {
+        ms->scratch = malloc(2 * META_SCRATCH);
+        if (!ms->scratch)
+            return -1;
+    }
+    ms->what = what;
+    return 0;
+}
+
+int fts_meta(FTS* sp, const FTSENT* p, struct fts_meta* meta) {
+    if (!sp || !p || !meta || !META(sp)->what) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct fts_entry* e = FTS_ENTRY((FTSENT*)p);
+    if (!e->meta) {
+        /* Roots, and entries whose directory was read before the stage was
+           enabled, are collected by path while they are current. */
+        if (p != sp->fts_cur || p->fts_info == FTS_NS || p->fts_info == FTS_ERR) {
+            errno = ENODATA;
+            return -1;
+        }
+        int follow = ISSET(FTS_LOGICAL) || (p->fts_level == FTS_ROOTLEVEL && ISSET(FTS_COMFOLLOW));
+        __fts_stat_t sb;
+        mode_t mode;
+        if (p->fts_statp && p->fts_info != FTS_NSOK)
+            mode = p->fts_statp->st_mode;
+        else if (fstatat(AT_FDCWD, p->fts_accpath, &sb, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0)
+            mode = sb.st_mode;
+        else
+            return -1;
+
+        struct meta_arena* a = calloc(1, sizeof(*a));
+        if (!a)
+            return -1;
+        e->meta = meta_collect(META(sp), a, AT_FDCWD, p->fts_accpath, mode, follow);
+        if (!e->meta) {
+            free(a);
+            return -1;
+        }
+    }
+    *meta = e->meta->meta;
+    return 0;
+}
+
+int fts_skip_fstype(FTS* sp, const char* name) {
+    if (!sp || !name || !*name || OPS(sp) != &fts_libc_backend) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct fstype_state* fs = FSTYPES(sp);
+    char** names = realloc(fs->names, (fs->nnames + 1) * sizeof(*names));
+    if (!names)
+        return -1;
+    fs->names = names;
+    if (!(names[fs->nnames] = strdup(name)))
+        return -1;
+    fs->nnames++;
+    fs->nseen = 0;
+    SET(FTS_SKIPFSTYPE);
+    return 0;
+}
+
+int fts_skip_fsmagic(FTS* sp, unsigned long magic) {
+    if (!sp || OPS(sp) != &fts_libc_backend) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct fstype_state* fs = FSTYPES(sp);
+    unsigned long* magics = realloc(fs->magics, (fs->nmagics + 1) * sizeof(*magics));
+    if (!magics)
+        return -1;
+    fs->magics = magics;
+    magics[fs->nmagics++] = magic;
+    fs->nseen = 0;
+    SET(FTS_SKIPFSTYPE);
+    return 0;
+}
+
+int fts_exclude(FTS* sp, const char* path) {
+    if (!sp || !path || !*path) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* Built entries hold cursors into the trie, so it is frozen once the
+       first root has been returned. */
+    if (!sp->fts_cur || sp->fts_cur->fts_info != FTS_INIT) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    struct excl_state* xs = EXCL_STATE(sp);
+    struct excl_node** rootp = (path[0] == '/') ? &xs->abs : &xs->rel;
+    if (!*rootp) {
+        *rootp = calloc(1, sizeof(**rootp));
+        if (!*rootp)
+            return -1;
+    }
+
+    /* Normalize to components joined by single slashes, dropping empty and
+       "." components the same way the traversal never produces them. */
+    size_t plen = strlen(path);
+    char* norm = malloc(plen + 1);
+    if (!norm)
+        return -1;
+    size_t n = 0;
+    const char* s = path;
+    while (*s) {
+        while (*s == '/')
+            s++;
+        const char* c = s;
+        while (*s && *s != '/')
+            s++;
+        size_t clen = (size_t)(s - c);
+        if (clen == 0 || (clen == 1 && c[0] == '.'))
+            continue;
+        if (n)
+            norm[n++] = '/';
+        memcpy(norm + n, c, clen);
+        n += clen;
+    }
+
+    int rc = excl_insert(*rootp, norm, n);
+    free(norm);
+    return rc;
+}
+
+/* Checkpoint format: magic, options, depth, then per ancestor (root first)
+   its dev, ino and name, then per level 0..depth the names still pending
+   at that level.  Integers are LEB128 varints and names are length-prefixed;
+   root names are the full paths given to fts_open(). */
+static const unsigned char fts_ckpt_magic[8] = {'F', 'T', 'S', 'C', 'K', 'P', 'T', '1'};
+
+struct ckpt_writer {
+    unsigned char* buf;
+    size_t size;
+    size_t len;
+};
+
+static void ckpt_put(struct ckpt_writer* w, const void* data, size_t n) {
+    if (w->len <= w->size && n <= w->size - w->len)
+        memcpy(w->buf + w->len, data, n);
+    w->len += n;
+}
+
+static void ckpt_put_uint(struct ckpt_writer* w, uint64_t v) {
+    unsigned char b[10];
+    size_t n = 0;
+    do {
+        b[n] = (unsigned char)(v & 0x7f);
+        v >>= 7;
+        if (v)
+            b[n] |= 0x80;
+        n++;
+    } while (v);
+    ckpt_put(w, b, n);
+}
+
+static void ckpt_put_name(struct ckpt_writer* w, const char* name, size_t len) {
+    ckpt_put_uint(w, len);
+    ckpt_put(w, name, len);
+}
+
+/* Whether q is written to a checkpoint.  A loaded root given with a trailing
+   slash has an empty leaf name but is still listed. */
+static int ckpt_listed(FTS* sp, const FTSENT* q) {
+    if (q->fts_instr == FTS_SKIP)
+        return 0;
+    return q->fts_namelen || (q->fts_level == FTS_ROOTLEVEL && q == sp->fts_cur);
+}
+
+/* Pending names after (and, when self is set, including) p at its level.
+   Loaded roots have had fts_name trimmed to the leaf, so their full path is
+   taken from the path buffer instead. */
+static void ckpt_put_pending(FTS* sp, struct ckpt_writer* w, FTSENT* p, int self) {
+    uint64_t n = 0;
+    for (FTSENT* q = self ? p : p->fts_link; q; q = q->fts_link)
+        if (ckpt_listed(sp, q))
+            n++;
+    ckpt_put_uint(w, n);
+    for (FTSENT* q = self ? p : p->fts_link; q; q = q->fts_link) {
+        if (!ckpt_listed(sp, q))
+            continue;
+        if (q->fts_level == FTS_ROOTLEVEL && q == sp->fts_cur)
+            ckpt_put_name(w, sp->fts_path, q->fts_pathlen);
+        else
+            ckpt_put_name(w, q->fts_name, q->fts_namelen);
+    }
+}
+
+ssize_t fts_checkpoint(FTS* sp, void* buf, size_t size) {
+    if (!sp || (!buf && size)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* The frontier of a level-order walk is its queue, which the format does
+       not describe. */
+    if (ISSET(FTS_BREADTHFIRST)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    struct ckpt_writer w = {buf, size, 0};
+    FTSENT* cur = sp->fts_cur;
+    FTSENT* deepest = NULL;
+    size_t depth = 0;
+
+    /* A post-order directory is re-delivered by ascending out of it, so it
+       joins the ancestor chain; anything else is the first pending entry. */
+    if (cur && cur->fts_info != FTS_INIT) {
+        deepest = (cur->fts_info == FTS_DP) ? cur : cur->fts_parent;
+        for (FTSENT* a = deepest; a && a->fts_level >= FTS_ROOTLEVEL; a = a->fts_parent)
+            depth++;
+    }
+
+    ckpt_put(&w, fts_ckpt_magic, sizeof(fts_ckpt_magic));
+    ckpt_put_uint(&w, (uint64_t)(sp->fts_options & FTS_OPTIONMASK));
+    ckpt_put_uint(&w, depth);
+
+    FTSENT** chain = NULL;
+    if (depth) {
+        chain = calloc(depth, sizeof(*chain));
+        if (!chain)
+            return -1;
+        size_t i = depth;
+        for (FTSENT* a = deepest; i; a = a->fts_parent)
+            chain[--i] = a;
+        for (i = 0; i < depth; i++) {
+            ckpt_put_uint(&w, (uint64_t)chain[i]->fts_dev);
+            ckpt_put_uint(&w, (uint64_t)chain[i]->fts_ino);
+            if (i == 0)
+                ckpt_put_name(&w, sp->fts_path, chain[0]->fts_pathlen);
+            else
+                ckpt_put_name(&w, chain[i]->fts_name, chain[i]->fts_namelen);
+        }
+        for (i = 0; i < depth; i++)
+            ckpt_put_pending(sp, &w, chain[i], 0);
+        free(chain);
+    }
+
+    if (!cur)
+        ckpt_put_uint(&w, 0);
+    else if (cur->fts_info == FTS_INIT)
+        ckpt_put_pending(sp, &w, cur, 0);
+    else if (cur->fts_info == FTS_DP)
+        ckpt_put_uint(&w, 0);
+    else
+        ckpt_put_pending(sp, &w, cur, 1);
+
+    if (w.len > SSIZE_MAX) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    return (ssize_t)w.len;
+}
+
+struct ckpt_name {
+    const char* name;
+    size_t len;
+};
+
+struct ckpt_frame {
+    dev_t dev;
+    ino_t ino;
+    struct ckpt_name self;
+    struct ckpt_name* pending;
+    size_t npending;
+};
+
+struct ckpt_reader {
+    const unsigned char* p;
+    const unsigned char* end;
+};
+
+static int ckpt_get_uint(struct ckpt_reader* r, uint64_t* v) {
+    *v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (r->p == r->end)
+            return -1;
+        unsigned char b = *r->p++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+static int ckpt_get_name(struct ckpt_reader* r, struct ckpt_name* n) {
+    uint64_t len;
+    if (ckpt_get_uint(r, &len) || len == 0 || len > (uint64_t)(r->end - r->p) || len > fts_length_max())
+        return -1;
+    if (memchr(r->p, '\0', (size_t)len))
+        return -1;
+    n->name = (const char*)r->p;
+    n->len = (size_t)len;
+    r->p += len;
+    return 0;
+}
+
+/* Decode into frames[0..depth]; frames[depth] holds only pending names.
+   Called first with names == NULL to validate and count. */
+static int ckpt_parse(const void* buf,
+                      size_t size,
+                      int* options,
+                      size_t* depthp,
+                      struct ckpt_frame* frames,
+                      struct ckpt_name* names,
+                      size_t* nnames) {
+    struct ckpt_reader r = {buf, (const unsigned char*)buf + size};
+    uint64_t v, depth;
+    size_t total = 0;
+
+    if (size < sizeof(fts_ckpt_magic) || memcmp(buf, fts_ckpt_magic, sizeof(fts_ckpt_magic)) != 0)
+        return -1;
+    r.p += sizeof(fts_ckpt_magic);
+    if (ckpt_get_uint(&r, &v) || v > FTS_OPTIONMASK)
+        return -1;
+    *options = (int)v;
+    if (ckpt_get_uint(&r, &depth) || depth > SHRT_MAX)
+        return -1;
+    *depthp = (size_t)depth;
+
+    for (size_t i = 0; i < depth; i++) {
+        uint64_t dev, ino;
+        struct ckpt_name self;
+        if (ckpt_get_uint(&r, &dev) || ckpt_get_uint(&r, &ino) || ckpt_get_name(&r, &self))
+            return -1;
+        if (frames) {
+            frames[i].dev = (dev_t)dev;
+            frames[i].ino = (ino_t)ino;
+            frames[i].self = self;
+        }
+    }
+    for (size_t i = 0; i <= depth; i++) {
+        uint64_t n;
+        if (ckpt_get_uint(&r, &n) || n > (uint64_t)(r.end - r.p))
+            return -1;
+        if (frames) {
+            frames[i].pending = names + total;
+            frames[i].npending = (size_t)n;
+        }
+        for (uint64_t j = 0; j < n; j++) {
+            struct ckpt_name name;
+            if (ckpt_get_name(&r, &name))
+                return -1;
+            if (names)
+                names[total] = name;
+            total++;
+        }
+    }
+    if (r.p != r.end)
+        return -1;
+    *nnames = total;
+    return 0;
+}
+
+/* Allocate and stat a resumed child of parent, building its path in the
+   (already large enough) path buffer.  Excluded names yield NULL with
+   errno == 0. */
+static FTSENT* fts_resume_child(FTS* sp, FTSENT* parent, const struct ckpt_name* n) {
+    const struct excl_cursor* pexcl = &FTS_ENTRY(parent)->excl;
+    struct excl_cursor excl = {NULL, NULL, 0};
+    if (pexcl->node && excl_step(pexcl, n->name, n->len, &excl)) {
+        errno = 0;
+        return NULL;
+    }
+
+    FTSENT* p = fts_alloc(sp, n->name, n->len);
+    if (!p)
+        return NULL;
+    FTS_ENTRY(p)->excl = excl;
+
+    size_t len = (parent->fts_path[parent->fts_pathlen - 1] == '/') ? parent->fts_pathlen - 1 : parent->fts_pathlen;
+    sp->fts_path[len++] = '/';
+    memcpy(sp->fts_path + len, p->fts_name, p->fts_namelen + 1);
+
+    p->fts_level = parent->fts_level + 1;
+    p->fts_parent = parent;
+    p->fts_path = sp->fts_path;
+    p->fts_pathlen = fts_length_cap(len + n->len);
+    p->fts_accpath = ISSET(FTS_NOCHDIR) ? p->fts_path : p->fts_name;
+    p->fts_info = fts_stat(sp, p, 0, -1);
+    return p;
+}
+
+static FTSENT* fts_resume_list(FTS* sp, FTSENT* parent, const struct ckpt_frame* f) {
+    FTSENT* head = NULL;
+    FTSENT** tail = &head;
+    for (size_t i = 0; i < f->npending; i++) {
+        FTSENT* p = fts_resume_child(sp, parent, &f->pending[i]);
+        if (!p) {
+            if (errno == 0)
+                continue;
+            int saved_errno = errno;
+            fts_lfree(head);
+            errno = saved_errno;
+            return NULL;
+        }
+        *tail = p;
+        tail = &p->fts_link;
+    }
+    errno = 0;
+    return head;
+}
+
+static FTSENT* fts_take_root(FTSENT** list, const struct ckpt_name* n) {
+    for (FTSENT** pp = list; *pp; pp = &(*pp)->fts_link) {
+        FTSENT* p = *pp;
+        if (p->fts_namelen == n->len && memcmp(p->fts_name, n->name, n->len) == 0) {
+            *pp = p->fts_link;
+            p->fts_link = NULL;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+int fts_resume(FTS* sp, const void* buf, size_t size) {
+    int options;
+    size_t depth, nnames;
+
+    if (!sp || !buf) {
+        errno = EINVAL;
+        return -1;
+    }
+    FTSENT* init = sp->fts_cur;
+    if (!init || init->fts_info != FTS_INIT) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (ISSET(FTS_BREADTHFIRST)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (ckpt_parse(buf, size, &options, &depth, NULL, NULL, &nnames) ||
+        options != (sp->fts_options & FTS_OPTIONMASK)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct ckpt_frame* frames = calloc(depth + 1, sizeof(*frames));
+    struct ckpt_name* names = calloc(nnames ? nnames : 1, sizeof(*names));
+    if (!frames || !names) {
+        free(frames);
+        free(names);
+        return -1;
+    }
+    ckpt_parse(buf, size, &options, &depth, frames, names, &nnames);
+
+    /* Reserve the deepest path the frontier can produce so entries built
+       below never see the buffer move. */
+    size_t need = 0;
+    size_t longest = 0;
+    for (size_t i = 0; i < depth; i++)
+        need += frames[i].self.len + 1;
+    for (size_t i = 0; i < nnames; i++)
+        if (names[i].len > longest)
+            longest = names[i].len;
+    need += longest + 1;
+    if (need >= sp->fts_pathlen) {
+        char* oldaddr = sp->fts_path;
+        if (fts_palloc(sp, need)) {
+            free(frames);
+            free(names);
+            return -1;
+        }
+        if (oldaddr != sp->fts_path && init->fts_link)
+            fts_padjust(sp, init->fts_link);
+    }
+
+    /* Keep only the checkpointed roots, in checkpoint order. */
+    FTSENT* rootparent = init->fts_link ? init->fts_link->fts_parent : NULL;
+    FTSENT* spare = init->fts_link;
+    FTSENT* anchor = NULL;
+    FTSENT* roots = NULL;
+    FTSENT** tail = &roots;
+    int failed = 0;
+    if (depth) {
+        anchor = fts_take_root(&spare, &frames[0].self);
+        failed = !anchor;
+    }
+    for (size_t i = 0; !failed && i < frames[0].npending; i++) {
+        FTSENT* r = fts_take_root(&spare, &frames[0].pending[i]);
+        failed = !r;
+        if (r) {
+            *tail = r;
+            tail = &r->fts_link;
+        }
+    }
+    init->fts_parent = rootparent;
+    if (failed) {
+        *tail = spare;
+        if (anchor) {
+            anchor->fts_link = roots;
+            roots = anchor;
+        }
+        init->fts_link = roots;
+        errno = ENOENT;
+        goto fail;
+    }
+    fts_lfree(spare);
+    init->fts_link = roots;
+    if (!depth)
+        goto done;
+
+    /* Re-enter each ancestor the way fts_read() would, checking that it is
+       still the directory recorded in the checkpoint.  The placeholder entry
+       always sits below the deepest ancestor entered so far, with the
+       pending list of that level on its link, so fts_close() can unwind a
+       partial resume. */
+    FTSENT* parent = anchor;
+    anchor->fts_link = roots;
+    init->fts_link = NULL;
+    init->fts_parent = rootparent;
+    fts_load(sp, anchor);
+    if (fts_excl_root(sp, anchor))
+        FTS_ENTRY(anchor)->excl.node = NULL;
+
+    for (size_t i = 0;; i++) {
+        /* Until the placeholder moves below it, parent is only reachable
+           through the placeholder's link. */
+        if (parent->fts_info != FTS_D || parent->fts_dev != frames[i].dev || parent->fts_ino != frames[i].ino) {
+            init->fts_link = parent;
+            errno = ENOENT;
+            goto fail;
+        }
+        if (fts_cycle_push(sp, parent)) {
+            init->fts_link = parent;
+            goto fail;
+        }
+        init->fts_level = parent->fts_level + 1;
+        init->fts_parent = parent;
+        init->fts_info = FTS_NSOK;
+        if (fts_safe_changedir(sp, parent, -1, parent->fts_accpath)) {
+            parent->fts_flags |= FTS_DONTCHDIR;
+            goto fail;
+        }
+        if (i + 1 == depth)
+            break;
+
+        /* Siblings first: the ancestor's own name must be the last one
+           written to the path buffer. */
+        FTSENT* siblings = fts_resume_list(sp, parent, &frames[i + 1]);
+        if (!siblings && errno)
+            goto fail;
+        FTSENT* next = fts_resume_child(sp, parent, &frames[i + 1].self);
+        if (!next) {
+            fts_lfree(siblings);
+            if (errno == 0)
+                errno = ENOENT;
+            goto fail;
+        }
+        next->fts_link = siblings;
+        parent = next;
+    }
+
+    init->fts_link = fts_resume_list(sp, parent, &frames[depth]);
+    if (!init->fts_link && errno)
+        goto fail;
+    sp->fts_path[parent->fts_pathlen] = '\0';
+
+done:
+    free(frames);
+    free(names);
+    return 0;
+
+fail:
+    {
+        int saved_errno = errno;
+        SET(FTS_STOP);
+        free(frames);
+        free(names);
+        errno = saved_errno;
+        return -1;
+    }
+}
@@ -0,0 +1,767 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fts.h>
+
+#include "musl-bsd/fts_ops.h"
+
+/* File layout: header, node array, string table.  Node 0 is "/" and node 1
+   the directory relative roots were recorded from.  The children of every
+   directory occupy a contiguous run of nodes sorted by name, so lookups are
+   a binary search and readdir is a linear scan. */
+#define SNAP_MAGIC "FTSSNAP1"
+#define SNAP_TOP 0u
+#define SNAP_CWD 1u
+#define SNAP_MAXLINKS 40
+#define SNAP_FD_BASE (1 << 20)
+
+struct snap_header {
+    char magic[8];
+    uint32_t nnodes;
+    uint32_t reserved;
+    uint64_t strsize;
+};
+
+struct snap_node {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t blocks;
+    int64_t mtime;
+    int64_t ctime;
+    uint32_t mtime_nsec;
+    uint32_t ctime_nsec;
+    uint32_t mode; /* 0: stat failed with err */
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t parent;
+    uint32_t child;
+    uint32_t nchild;
+    uint32_t name;
+    uint32_t namelen;
+    uint32_t target; /* symlink target */
+    uint32_t targetlen;
+    int32_t err; /* directories: set when the listing could not be read */
+};
+
+struct fts_snapshot {
+    void* map;
+    size_t size;
+    const struct snap_node* nodes;
+    uint32_t nnodes;
+    const char* strings;
+    uint32_t cwd;
+};
+
+struct snap_dir {
+    uint32_t node;
+    uint32_t pos;
+    struct dirent ent;
+};
+
+/* Recording */
+
+struct rec_node {
+    struct snap_node n;
+    char* name;
+    char* target;
+    uint32_t* kids;
+    size_t nkids;
+    size_t kcap;
+};
+
+struct recorder {
+    struct rec_node* v;
+    size_t n;
+    size_t cap;
+};
+
+static int rec_new(struct recorder* r, uint32_t parent, const char* name, size_t len, uint32_t* out) {
+    if (r->n == r->cap) {
+        size_t ncap = r->cap ? r->cap * 2 : 256;
+        struct rec_node* v = realloc(r->v, ncap * sizeof(*v));
+        if (!v)
+            return -1;
+        r->v = v;
+        r->cap = ncap;
+    }
+    if (r->n >= UINT32_MAX || len > NAME_MAX) {
+        errno = len > NAME_MAX ? ENAMETOOLONG : EOVERFLOW;
+        return -1;
+    }
+
+    struct rec_node* e = &r->v[r->n];
+    memset(e, 0, sizeof(*e));
+    e->name = strndup(name, len);
+    if (!e->name)
+        return -1;
+    e->n.parent = parent;
+    e->n.mode = S_IFDIR | 0755;
+    e->n.nlink = 2;
+
+    if (r->n) {
+        struct rec_node* p = &r->v[parent];
+        if (p->nkids == p->kcap) {
+            size_t kcap = p->kcap ? p->kcap * 2 : 8;
+            uint32_t* kids = realloc(p->kids, kcap * sizeof(*kids));
+            if (!kids) {
+                free(e->name);
+                return -1;
+            }
+            p->kids = kids;
+            p->kcap = kcap;
+        }
+        p->kids[p->nkids++] = (uint32_t)r->n;
+    }
+    *out = (uint32_t)r->n++;
+    return 0;
+}
+
+static void rec_stat(struct rec_node* e, const struct stat* st) {
+    e->n.dev = (uint64_t)st->st_dev;
+    e->n.ino = (uint64_t)st->st_ino;
+    e->n.size = (int64_t)st->st_size;
+    e->n.blocks = (int64_t)st->st_blocks;
+    e->n.mtime = (int64_t)st->st_mtim.tv_sec;
+    e->n.mtime_nsec = (uint32_t)st->st_mtim.tv_nsec;
+    e->n.ctime = (int64_t)st->st_ctim.tv_sec;
+    e->n.ctime_nsec = (uint32_t)st->st_ctim.tv_nsec;
+    e->n.mode = (uint32_t)st->st_mode;
+    e->n.nlink = (uint32_t)st->st_nlink;
+    e->n.uid = (uint32_t)st->st_uid;
+    e->n.gid = (uint32_t)st->st_gid;
+}
+
+/* Find or create the nodes naming a root path; returns the last one. */
+static int rec_root(struct recorder* r, const char* path, uint32_t* out) {
+    uint32_t cur = (path[0] == '/') ? SNAP_TOP : SNAP_CWD;
+    const char* c = path;
+
+    while (*c) {
+        while (*c == '/')
+            c++;
+        const char* end = c;
+        while (*end && *end != '/')
+            end++;
+        size_t len = (size_t)(end - c);
+        if (len == 0 || (len == 1 && c[0] == '.')) {
+            c = end;
+            continue;
+        }
+        if (len == 2 && c[0] == '.' && c[1] == '.') {
+            cur = r->v[cur].n.parent;
+            c = end;
+            continue;
+        }
+
+        uint32_t next = UINT32_MAX;
+        for (size_t i = 0; i < r->v[cur].nkids; i++) {
+            struct rec_node* k = &r->v[r->v[cur].kids[i]];
+            if (strlen(k->name) == len && memcmp(k->name, c, len) == 0) {
+                next = r->v[cur].kids[i];
+                break;
+            }
+        }
+        if (next == UINT32_MAX) {
+            if (rec_new(r, cur, c, len, &next))
+                return -1;
+            /* Intermediate directories carry their live attributes. */
+            struct stat st;
+            char* prefix = strndup(path, (size_t)(end - path));
+            if (!prefix)
+                return -1;
+            if (lstat(prefix, &st) == 0)
+                rec_stat(&r->v[next], &st);
+            free(prefix);
+        }
+        cur = next;
+        c = end;
+    }
+    *out = cur;
+    return 0;
+}
+
+static int rec_entry(struct recorder* r, FTSENT* e) {
+    uint32_t idx;
+
+    if (e->fts_level == FTS_ROOTLEVEL) {
+        if (e->fts_number)
+            idx = (uint32_t)(e->fts_number - 1);
+        else if (rec_root(r, e->fts_path, &idx))
+            return -1;
+    }
+    else if (e->fts_number) {
+        idx = (uint32_t)(e->fts_number - 1);
+    }
+    else {
+        uint32_t parent = (uint32_t)(e->fts_parent->fts_number - 1);
+        if (rec_new(r, parent, e->fts_name, e->fts_namelen, &idx))
+            return -1;
+    }
+    e->fts_number = idx + 1;
+
+    struct rec_node* n = &r->v[idx];
+    switch (e->fts_info) {
+        case FTS_NS:
+            n->n.mode = 0;
+            n->n.err = e->fts_errno;
+            return 0;
+        case FTS_DNR:
+        case FTS_ERR:
+            n->n.err = e->fts_errno ? e->fts_errno : EIO;
+            break;
+        default:
+            break;
+    }
+    rec_stat(n, e->fts_statp);
+
+    if (S_ISLNK(e->fts_statp->st_mode) && !n->target) {
+        size_t cap = (size_t)e->fts_statp->st_size + 1;
+        if (cap < 64)
+            cap = 64;
+        for (;;) {
+            char* buf = malloc(cap);
+            if (!buf)
+                return -1;
+            ssize_t len = readlink(e->fts_accpath, buf, cap);
+            if (len < 0) {
+                free(buf);
+                break;
+            }
+            if ((size_t)len < cap) {
+                buf[len] = '\0';
+                n->target = buf;
+                break;
+            }
+            free(buf);
+            cap *= 2;
+        }
+    }
+    return 0;
+}
+
+struct rec_key {
+    const char* name;
+    uint32_t idx;
+};
+
+static int rec_cmp(const void* a, const void* b) {
+    return strcmp(((const struct rec_key*)a)->name, ((const struct rec_key*)b)->name);
+}
+
+static int rec_sort_kids(struct recorder* r, struct rec_node* e) {
+    if (e->nkids < 2)
+        return 0;
+    struct rec_key* keys = malloc(e->nkids * sizeof(*keys));
+    if (!keys)
+        return -1;
+    for (size_t i = 0; i < e->nkids; i++) {
+        keys[i].name = r->v[e->kids[i]].name;
+        keys[i].idx = e->kids[i];
+    }
+    qsort(keys, e->nkids, sizeof(*keys), rec_cmp);
+    for (size_t i = 0; i < e->nkids; i++)
+        e->kids[i] = keys[i].idx;
+    free(keys);
+    return 0;
+}
+
+static int rec_write(struct recorder* r, const char* file) {
+    uint32_t* order = malloc(r->n * sizeof(*order));
+    uint32_t* where = malloc(r->n * sizeof(*where));
+    struct snap_node* out = calloc(r->n, sizeof(*out));
+    char* strings = NULL;
+    size_t strsize = 0;
+    int rc = -1;
+    FILE* fp = NULL;
+
+    if (!order || !where || !out)
+        goto done;
+
+    /* Lay out breadth-first so each directory's children are contiguous. */
+    size_t head = 0, tail = 0;
+    order[tail++] = SNAP_TOP;
+    order[tail++] = SNAP_CWD;
+    while (head < tail) {
+        struct rec_node* e = &r->v[order[head++]];
+        if (rec_sort_kids(r, e))
+            goto done;
+        for (size_t i = 0; i < e->nkids; i++)
+            order[tail++] = e->kids[i];
+    }
+    for (size_t i = 0; i < r->n; i++)
+        where[order[i]] = (uint32_t)i;
+
+    for (size_t i = 0; i < r->n; i++) {
+        const struct rec_node* e = &r->v[order[i]];
+        strsize += strlen(e->name) + 1 + (e->target ? strlen(e->target) + 1 : 0);
+    }
+    if (strsize > UINT32_MAX) {
+        errno = EOVERFLOW;
+        goto done;
+    }
+    strings = malloc(strsize ? strsize : 1);
+    if (!strings)
+        goto done;
+
+    size_t off = 0;
+    for (size_t i = 0; i < r->n; i++) {
+        const struct rec_node* e = &r->v[order[i]];
+        struct snap_node* n = &out[i];
+        *n = e->n;
+        n->parent = where[e->n.parent];
+        n->child = e->nkids ? where[e->kids[0]] : 0;
+        n->nchild = (uint32_t)e->nkids;
+        n->name = (uint32_t)off;
+        n->namelen = (uint32_t)strlen(e->name);
+        memcpy(strings + off, e->name, n->namelen + 1);
+        off += n->namelen + 1;
+        if (e->target) {
+            n->target = (uint32_t)off;
+            n->targetlen = (uint32_t)strlen(e->target);
+            memcpy(strings + off, e->target, n->targetlen + 1);
+            off += n->targetlen + 1;
+        }
+    }
+
+    struct snap_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+    h.nnodes = (uint32_t)r->n;
+    h.strsize = strsize;
+
+    fp = fopen(file, "wbe");
+    if (!fp)
+        goto done;
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 || fwrite(out, sizeof(*out), r->n, fp) != r->n ||
+        (strsize && fwrite(strings, 1, strsize, fp) != strsize))
+        goto done;
+    rc = 0;
+
+done:
+    if (fp && fclose(fp) != 0)
+        rc = -1;
+    free(order);
+    free(where);
+    free(out);
+    free(strings);
+    return rc;
+}
+
+int fts_snapshot_save(const char* file, char* const* roots) {
+    if (!file || !roots) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct recorder r = {NULL, 0, 0};
+    uint32_t top, cwd;
+    int rc = -1;
+    struct stat st;
+
+    if (rec_new(&r, SNAP_TOP, "", 0, &top) || rec_new(&r, SNAP_TOP, ".", 1, &cwd))
+        goto done;
+    /* The working directory is not a child of the top in the layout. */
+    r.v[SNAP_TOP].nkids = 0;
+    if (lstat("/", &st) == 0)
+        rec_stat(&r.v[SNAP_TOP], &st);
+    if (lstat(".", &st) == 0)
+        rec_stat(&r.v[SNAP_CWD], &st);
+
+    FTS* f = fts_open(roots, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    if (!f)
+        goto done;
+    FTSENT* e;
+    errno = 0;
+    while ((e = fts_read(f)) != NULL) {
+        if (e->fts_info == FTS_DP)
+            continue;
+        if (rec_entry(&r, e)) {
+            int saved = errno;
+            fts_close(f);
+            errno = saved;
+            goto done;
+        }
+    }
+    if (errno) {
+        int saved = errno;
+        fts_close(f);
+        errno = saved;
+        goto done;
+    }
+    fts_close(f);
+
+    rc = rec_write(&r, file);
+
+done:
+    for (size_t i = 0; i < r.n; i++) {
+        free(r.v[i].name);
+        free(r.v[i].target);
+        free(r.v[i].kids);
+    }
+    free(r.v);
+    return rc;
+}
+
+/* Serving */
+
+static int snap_check(const struct fts_snapshot* s) {
+    for (uint32_t i = 0; i < s->nnodes; i++) {
+        const struct snap_node* n = &s->nodes[i];
+        if (n->parent >= s->nnodes || n->namelen > NAME_MAX)
+            return -1;
+        if (n->nchild && (n->nchild > s->nnodes || n->child <= i || n->child > s->nnodes - n->nchild))
+            return -1;
+        for (uint32_t k = 0; k < n->nchild; k++)
+            if (s->nodes[n->child + k].parent != i)
+                return -1;
+    }
+    return 0;
+}
+
+struct fts_snapshot* fts_snapshot_open(const char* file) {
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size < sizeof(struct snap_header)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    const struct snap_header* h = map;
+    uint64_t nodes_end = sizeof(*h) + (uint64_t)h->nnodes * sizeof(struct snap_node);
+    struct fts_snapshot* s = calloc(1, sizeof(*s));
+    if (!s) {
+        munmap(map, size);
+        return NULL;
+    }
+    s->map = map;
+    s->size = size;
+    s->nodes = (const struct snap_node*)(h + 1);
+    s->nnodes = h->nnodes;
+    s->strings = (const char*)map + nodes_end;
+    s->cwd = SNAP_CWD;
+
+    int ok = memcmp(h->magic, SNAP_MAGIC, sizeof(h->magic)) == 0 && h->nnodes >= 2 &&
+             h->nnodes <= INT_MAX - SNAP_FD_BASE && nodes_end <= size && h->strsize == size - nodes_end;
+    if (ok)
+        ok = snap_check(s) == 0;
+    for (uint32_t i = 0; ok && i < s->nnodes; i++) {
+        const struct snap_node* n = &s->nodes[i];
+        ok = (uint64_t)n->name + n->namelen < h->strsize && s->strings[n->name + n->namelen] == '\0' &&
+             (!n->targetlen ||
+              ((uint64_t)n->target + n->targetlen < h->strsize && s->strings[n->target + n->targetlen] == '\0'));
+    }
+    if (!ok) {
+        fts_snapshot_close(s);
+        errno = EINVAL;
+        return NULL;
+    }
+    return s;
+}
+
+void fts_snapshot_close(struct fts_snapshot* s) {
+    if (!s)
+        return;
+    munmap(s->map, s->size);
+    free(s);
+}
+
+static int snap_node_of(const struct fts_snapshot* s, int fd, uint32_t* out) {
+    if (fd < SNAP_FD_BASE || (uint32_t)(fd - SNAP_FD_BASE) >= s->nnodes) {
+        errno = EBADF;
+        return -1;
+    }
+    *out = (uint32_t)(fd - SNAP_FD_BASE);
+    return 0;
+}
+
+static int snap_find(const struct fts_snapshot* s, uint32_t dir, const char* name, size_t len, uint32_t* out) {
+    const struct snap_node* d = &s->nodes[dir];
+    uint32_t lo = d->child, hi = d->child + d->nchild;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const struct snap_node* n = &s->nodes[mid];
+        int c = strncmp(s->strings + n->name, name, len);
+        if (c == 0 && n->namelen != len)
+            c = n->namelen < len ? -1 : 1;
+        if (c == 0) {
+            *out = mid;
+            return 0;
+        }
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+static int snap_resolve(const struct fts_snapshot* s,
+                        uint32_t start,
+                        const char* path,
+                        size_t plen,
+                        int follow,
+                        int* links,
+                        uint32_t* out) {
+    uint32_t cur = (plen && path[0] == '/') ? SNAP_TOP : start;
+    const char* c = path;
+    const char* end = path + plen;
+
+    while (c < end) {
+        while (c < end && *c == '/')
+            c++;
+        const char* e = c;
+        while (e < end && *e != '/')
+            e++;
+        size_t len = (size_t)(e - c);
+        const char* rest = e;
+        while (rest < end && *rest == '/')
+            rest++;
+        int last = rest == end;
+
+        if (len == 0 || (len == 1 && c[0] == '.')) {
+            c = e;
+            continue;
+        }
+        if (!S_ISDIR(s->nodes[cur].mode)) {
+            errno = s->nodes[cur].mode ? ENOTDIR : s->nodes[cur].err;
+            return -1;
+        }
+        if (len == 2 && c[0] == '.' && c[1] == '.') {
+            cur = s->nodes[cur].parent;
+            c = e;
+            continue;
+        }
+
+        uint32_t next;
+        if (snap_find(s, cur, c, len, &next)) {
+            errno = ENOENT;
+            return -1;
+        }
+        const struct snap_node* n = &s->nodes[next];
+        if (S_ISLNK(n->mode) && (!last || follow)) {
+            if (++*links > SNAP_MAXLINKS) {
+                errno = ELOOP;
+                return -1;
+            }
+            if (snap_resolve(s, cur, s->strings + n->target, n->targetlen, 1, links, &next))
+                return -1;
+        }
+        cur = next;
+        c = e;
+    }
+    *out = cur;
+    return 0;
+}
+
+static int snap_lookup(const struct fts_snapshot* s, int dfd, const char* path, int follow, uint32_t* out) {
+    uint32_t start = s->cwd;
+    int links = 0;
+    if (dfd != AT_FDCWD && path[0] != '/' && snap_node_of(s, dfd, &start))
+        return -1;
+    if (!*path) {
+        errno = ENOENT;
+        return -1;
+    }
+    return snap_resolve(s, start, path, strlen(path), follow, &links, out);
+}
+
+static void snap_fill(const struct snap_node* n, struct stat* st) {
+    memset(st, 0, sizeof(*st));
+    st->st_dev = (dev_t)n->dev;
+    st->st_ino = (ino_t)n->ino;
+    st->st_mode = (mode_t)n->mode;
+    st->st_nlink = (nlink_t)n->nlink;
+    st->st_uid = (uid_t)n->uid;
+    st->st_gid = (gid_t)n->gid;
+    st->st_size = (off_t)n->size;
+    st->st_blocks = (blkcnt_t)n->blocks;
+    st->st_mtim.tv_sec = (time_t)n->mtime;
+    st->st_mtim.tv_nsec = (long)n->mtime_nsec;
+    st->st_ctim.tv_sec = (time_t)n->ctime;
+    st->st_ctim.tv_nsec = (long)n->ctime_nsec;
+}
+
+static int snap_stat(const struct fts_snapshot* s, uint32_t node, struct stat* st) {
+    const struct snap_node* n = &s->nodes[node];
+    if (!n->mode) {
+        errno = n->err ? n->err : EIO;
+        return -1;
+    }
+    snap_fill(n, st);
+    return 0;
+}
+
+static int snap_open(void* ctx, const char* path, int flags) {
+    const struct fts_snapshot* s = ctx;
+    uint32_t node;
+    if (snap_lookup(s, AT_FDCWD, path, !(flags & O_NOFOLLOW), &node))
+        return -1;
+    const struct snap_node* n = &s->nodes[node];
+    if (!n->mode) {
+        errno = n->err ? n->err : EIO;
+        return -1;
+    }
+    if (S_ISLNK(n->mode)) {
+        errno = ELOOP;
+        return -1;
+    }
+    if ((flags & O_DIRECTORY) && !S_ISDIR(n->mode)) {
+        errno = ENOTDIR;
+        return -1;
+    }
+    if (S_ISDIR(n->mode) && n->err) {
+        errno = n->err;
+        return -1;
+    }
+    return SNAP_FD_BASE + (int)node;
+}
+
+static int snap_close(void* ctx, int fd) {
+    uint32_t node;
+    return snap_node_of(ctx, fd, &node);
+}
+
+static int snap_fstat(void* ctx, int fd, struct stat* st) {
+    uint32_t node;
+    if (snap_node_of(ctx, fd, &node))
+        return -1;
+    return snap_stat(ctx, node, st);
+}
+
+static int snap_fstatat(void* ctx, int dfd, const char* path, struct stat* st, int flags) {
+    uint32_t node;
+    if (snap_lookup(ctx, dfd, path, !(flags & AT_SYMLINK_NOFOLLOW), &node))
+        return -1;
+    return snap_stat(ctx, node, st);
+}
+
+static int snap_fchdir(void* ctx, int fd) {
+    struct fts_snapshot* s = ctx;
+    uint32_t node;
+    if (snap_node_of(s, fd, &node))
+        return -1;
+    if (!S_ISDIR(s->nodes[node].mode)) {
+        errno = ENOTDIR;
+        return -1;
+    }
+    s->cwd = node;
+    return 0;
+}
+
+static DIR* snap_fdopendir(void* ctx, int fd) {
+    const struct fts_snapshot* s = ctx;
+    uint32_t node;
+    if (snap_node_of(s, fd, &node))
+        return NULL;
+    if (!S_ISDIR(s->nodes[node].mode)) {
+        errno = ENOTDIR;
+        return NULL;
+    }
+    struct snap_dir* d = calloc(1, sizeof(*d));
+    if (!d)
+        return NULL;
+    d->node = node;
+    return (DIR*)d;
+}
+
+static unsigned char snap_dtype(uint32_t mode) {
+    switch (mode & S_IFMT) {
+        case S_IFDIR:
+            return DT_DIR;
+        case S_IFREG:
+            return DT_REG;
+        case S_IFLNK:
+            return DT_LNK;
+        case S_IFCHR:
+            return DT_CHR;
+        case S_IFBLK:
+            return DT_BLK;
+        case S_IFIFO:
+            return DT_FIFO;
+        case S_IFSOCK:
+            return DT_SOCK;
+        default:
+            return DT_UNKNOWN;
+    }
+}
+
+static struct dirent* snap_readdir(void* ctx, DIR* dirp) {
+    const struct fts_snapshot* s = ctx;
+    struct snap_dir* d = (struct snap_dir*)dirp;
+    const struct snap_node* dir = &s->nodes[d->node];
+    const struct snap_node* n;
+    const char* name;
+    size_t len;
+
+    /* "." and ".." come first, as from the kernel. */
+    if (d->pos < 2) {
+        n = d->pos ? &s->nodes[dir->parent] : dir;
+        name = d->pos ? ".." : ".";
+        len = d->pos + 1;
+    }
+    else if (d->pos - 2 < dir->nchild) {
+        n = &s->nodes[dir->child + d->pos - 2];
+        name = s->strings + n->name;
+        len = n->namelen;
+    }
+    else {
+        return NULL;
+    }
+
+    d->pos++;
+    d->ent.d_ino = (ino_t)n->ino;
+    d->ent.d_off = (off_t)d->pos;
+    d->ent.d_reclen = sizeof(d->ent);
+    d->ent.d_type = snap_dtype(n->mode);
+    memcpy(d->ent.d_name, name, len + 1);
+    return &d->ent;
+}
+
+static int snap_closedir(void* ctx, DIR* dirp) {
+    (void)ctx;
+    free(dirp);
+    return 0;
+}
+
+static int snap_dirfd(void* ctx, DIR* dirp) {
+    (void)ctx;
+    return SNAP_FD_BASE + (int)((struct snap_dir*)dirp)->node;
+}
+
+const struct fts_backend fts_snapshot_backend = {.open_fn = snap_open,
+                                                 .close_fn = snap_close,
+                                                 .fstat_fn = snap_fstat,
+                                                 .fstatat_fn = snap_fstatat,
+                                                 .fchdir_fn = snap_fchdir,
+                                                 .fdopendir_fn = snap_fdopendir,
+                                                 .readdir_fn = snap_readdir,
+                                                 .closedir_fn = snap_closedir,
+                                                 .dirfd_fn = snap_dirfd};
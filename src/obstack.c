@@ -2,11 +2,16 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
 #define _OBSTACK_NORETURN _Noreturn
@@ -71,6 +76,448 @@ static void call_freefun(struct obstack* h, void* chunk) {
     }
 }
 
+/* Size obstack_init() gives its chunks; only chunks of exactly this size are
+   shared through the pool. */
+#define OBSTACK_POOL_CHUNK                                                                          \
+    (4096 - ((((12 + DEFAULT_ROUNDING - 1) & ~(DEFAULT_ROUNDING - 1)) + 4 + DEFAULT_ROUNDING - 1) & \
+             ~(DEFAULT_ROUNDING - 1)))
+
+/* Chunks each thread keeps before handing half of them to the shared depot. */
+#define OBSTACK_POOL_LOCAL 16
+
+/* Chunks released by _obstack_free() that each obstack keeps for reuse. */
+#define OBSTACK_SPARE_CHUNKS 2
+
+/* The pool holds malloc()ed chunks linked through their prev field: a small
+   per-thread cache in front of a mutex-protected depot of at most
+   pool_limit chunks.  It is off until obstack_chunk_pool() sets a limit.
+   The caches are touched only by their own thread, so turning the pool off
+   frees the depot and the caller's cache at once and every other cache on
+   its thread's next chunk operation or exit. */
+struct chunk_list {
+    struct _obstack_chunk* head;
+    size_t count;
+};
+
+static size_t pool_limit;
+static struct chunk_list pool_depot;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+static __thread struct chunk_list pool_local;
+
+static void list_push(struct chunk_list* l, struct _obstack_chunk* chunk) {
+    chunk->prev = l->head;
+    l->head = chunk;
+    l->count++;
+}
+
+static struct _obstack_chunk* list_pop(struct chunk_list* l) {
+    struct _obstack_chunk* chunk = l->head;
+    if (chunk) {
+        l->head = chunk->prev;
+        l->count--;
+    }
+    return chunk;
+}
+
+static void list_free(struct chunk_list* l) {
+    struct _obstack_chunk* chunk;
+    while ((chunk = list_pop(l)) != NULL) {
+        free(chunk);
+    }
+}
+
+/* Moves up to n chunks from the thread cache to the depot, freeing those
+   that do not fit under the limit. */
+static void pool_flush(struct chunk_list* local, size_t n) {
+    pthread_mutex_lock(&pool_lock);
+    while (n-- && local->head) {
+        struct _obstack_chunk* chunk = list_pop(local);
+        if (pool_depot.count < pool_limit) {
+            list_push(&pool_depot, chunk);
+        }
+        else {
+            free(chunk);
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void pool_thread_exit(void* arg) {
+    struct chunk_list* local = (struct chunk_list*)arg;
+    pool_flush(local, local->count);
+}
+
+static void pool_init(void) {
+    pthread_key_create(&pool_key, pool_thread_exit);
+}
+
+/* Chunks from the default allocators can be resized with realloc() and mixed
+   between obstacks. */
+static int chunk_is_malloc(struct obstack* h) {
+    return !h->use_extra_arg && h->freefun.plain == free &&
+           (h->chunkfun.plain == xmalloc || h->chunkfun.plain == malloc);
+}
+
+/* Called on every chunk allocation and release.  Once the pool is off, a
+   thread frees what its cache still holds the next time it gets here. */
+static int pool_eligible(struct obstack* h, size_t size) {
+    if (__atomic_load_n(&pool_limit, __ATOMIC_RELAXED) == 0) {
+        if (pool_local.head) {
+            list_free(&pool_local);
+        }
+        return 0;
+    }
+    return size == OBSTACK_POOL_CHUNK && chunk_is_malloc(h);
+}
+
+static struct _obstack_chunk* pool_get(void) {
+    struct chunk_list* local = &pool_local;
+    if (!local->head) {
+        pthread_mutex_lock(&pool_lock);
+        for (size_t n = OBSTACK_POOL_LOCAL / 2; n && pool_depot.head; n--) {
+            list_push(local, list_pop(&pool_depot));
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+    return list_pop(local);
+}
+
+static void pool_put(struct _obstack_chunk* chunk) {
+    struct chunk_list* local = &pool_local;
+    if (!local->head) {
+        /* Registers the destructor that returns this thread's cache. */
+        pthread_once(&pool_once, pool_init);
+        pthread_setspecific(pool_key, local);
+    }
+    list_push(local, chunk);
+    if (local->count > OBSTACK_POOL_LOCAL) {
+        pool_flush(local, OBSTACK_POOL_LOCAL / 2);
+    }
+}
+
+size_t obstack_chunk_pool(size_t limit) {
+    pthread_mutex_lock(&pool_lock);
+    size_t old = pool_limit;
+    __atomic_store_n(&pool_limit, limit, __ATOMIC_RELAXED);
+    while (pool_depot.count > limit) {
+        free(list_pop(&pool_depot));
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (limit == 0) {
+        list_free(&pool_local);
+    }
+    return old;
+}
+
+/* Huge chunks are 2 MiB-aligned anonymous mappings whose length is the chunk
+   size rounded up to 2 MiB, so the chunk's own limit gives the length to
+   release.  Released mappings are handed back with MADV_FREE and kept for
+   reuse; the kernel reclaims their pages only under memory pressure. */
+#define HUGE_ALIGN ((size_t)2 << 20)
+#define HUGE_CACHE 16
+
+struct huge_region {
+    void* addr;
+    size_t len;
+};
+
+static struct huge_region huge_cache[HUGE_CACHE];
+static size_t huge_cached;
+static pthread_mutex_t huge_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int chunk_is_huge(struct obstack* h) {
+    return h->use_extra_arg && h->chunkfun.extra == obstack_huge_chunk_alloc;
+}
+
+static size_t huge_round(size_t size) {
+    return (size + HUGE_ALIGN - 1) & ~(HUGE_ALIGN - 1);
+}
+
+static void* huge_map(size_t len) {
+    if (len > SIZE_MAX - HUGE_ALIGN) {
+        return NULL;
+    }
+    char* map = mmap(NULL, len + HUGE_ALIGN, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    char* start = (char*)(((uintptr_t)map + HUGE_ALIGN - 1) & ~(uintptr_t)(HUGE_ALIGN - 1));
+    if (start > map) {
+        munmap(map, (size_t)(start - map));
+    }
+    size_t tail = HUGE_ALIGN - (size_t)(start - map);
+    if (tail) {
+        munmap(start + len, tail);
+    }
+    madvise(start, len, MADV_HUGEPAGE);
+    return start;
+}
+
+void* obstack_huge_chunk_alloc(void* arg, size_t size) {
+    (void)arg;
+    size_t len = huge_round(size ? size : 1);
+    if (len < size) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&huge_lock);
+    for (size_t i = 0; i < huge_cached; i++) {
+        if (huge_cache[i].len == len) {
+            void* addr = huge_cache[i].addr;
+            huge_cache[i] = huge_cache[--huge_cached];
+            pthread_mutex_unlock(&huge_lock);
+            return addr;
+        }
+    }
+    pthread_mutex_unlock(&huge_lock);
+    return huge_map(len);
+}
+
+void obstack_huge_chunk_free(void* arg, void* chunk) {
+    (void)arg;
+    struct _obstack_chunk* c = (struct _obstack_chunk*)chunk;
+    size_t len = huge_round((size_t)(c->limit - (char*)c));
+
+#ifdef MADV_FREE
+    if (madvise(chunk, len, MADV_FREE) != 0)
+#endif
+        madvise(chunk, len, MADV_DONTNEED);
+
+    pthread_mutex_lock(&huge_lock);
+    if (huge_cached < HUGE_CACHE) {
+        huge_cache[huge_cached].addr = chunk;
+        huge_cache[huge_cached].len = len;
+        huge_cached++;
+        chunk = NULL;
+    }
+    pthread_mutex_unlock(&huge_lock);
+    if (chunk) {
+        munmap(chunk, len);
+    }
+}
+
+/* Per-obstack state the ABI-pinned struct has no room for.  It hangs off
+   temp.p, which none of the header macros use, is allocated along with the
+   first chunk and is freed by obstack_free(h, NULL).  An obstack whose record
+   could not be allocated works without spares or statistics. */
+struct obstack_ext {
+    struct _obstack_chunk* spares; /* linked through prev */
+    size_t nspares;
+    struct _obstack_chunk* moved;  /* chunk the last relocated object went to */
+    char* resume;                  /* where that object began in the chunk below */
+    struct obstack_stats stats;
+};
+
+#define EXT(h) ((struct obstack_ext*)(h)->temp.p)
+#define CHUNK_BYTES(c) ((size_t)((c)->limit - (char*)(c)))
+
+/* Process totals, kept only when OBSTACK_STATS asks for a report at exit. */
+static struct obstack_stats stats_total;
+static int stats_report;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+
+#define STAT_ADD(h, field, n) stat_add((h), offsetof(struct obstack_stats, field), (n))
+#define STAT_SUB(h, field, n) stat_add((h), offsetof(struct obstack_stats, field), 0 - (size_t)(n))
+
+static void stat_add(struct obstack* h, size_t field, size_t n) {
+    struct obstack_ext* ext = EXT(h);
+    if (ext) {
+        *(size_t*)((char*)&ext->stats + field) += n;
+    }
+    if (stats_report) {
+        __atomic_add_fetch((size_t*)((char*)&stats_total + field), n, __ATOMIC_RELAXED);
+    }
+}
+
+/* Called whenever memory_used grows; spares count toward the footprint. */
+static void stat_peak(struct obstack* h) {
+    struct obstack_ext* ext = EXT(h);
+    if (ext && ext->stats.memory_used + ext->stats.spare_bytes > ext->stats.peak_footprint) {
+        ext->stats.peak_footprint = ext->stats.memory_used + ext->stats.spare_bytes;
+    }
+    if (stats_report) {
+        size_t now = __atomic_load_n(&stats_total.memory_used, __ATOMIC_RELAXED) +
+                     __atomic_load_n(&stats_total.spare_bytes, __ATOMIC_RELAXED);
+        size_t peak = __atomic_load_n(&stats_total.peak_footprint, __ATOMIC_RELAXED);
+        while (now > peak && !__atomic_compare_exchange_n(&stats_total.peak_footprint, &peak, now, 1,
+                                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static void stats_print(void) {
+    struct obstack_stats* t = &stats_total;
+    fprintf(stderr,
+            "obstack: %zu chunks allocated, %zu freed, %zu reused; %zu bytes copied, %zu bytes tail waste; "
+            "%zu bytes in use, peak %zu\n",
+            t->chunks_allocated, t->chunks_freed, t->chunks_reused, t->bytes_copied, t->tail_waste,
+            t->memory_used + t->spare_bytes, t->peak_footprint);
+}
+
+static void stats_init(void) {
+    const char* env = secure_getenv("OBSTACK_STATS");
+    if (env && *env && strcmp(env, "0") != 0 && atexit(stats_print) == 0) {
+        stats_report = 1;
+    }
+}
+
+int obstack_get_stats(struct obstack* h, struct obstack_stats* stats) {
+    struct obstack_ext* ext = EXT(h);
+    if (!h->chunk || !ext) {
+        memset(stats, 0, sizeof(*stats));
+        return -1;
+    }
+    *stats = ext->stats;
+    return 0;
+}
+
+/* An object too large for a regular chunk gets a block of its own, linked
+   above the chunk it started in, as does one that grows past the chunk size
+   after moving.  The first object that does not fit after it goes back to
+   that chunk: the rest of it, from where the large object began, becomes a
+   tail chunk linked above the block.  Tails are recognised by lying inside
+   the chunk two links down; they are not allocations of their own. */
+static int chunk_is_tail(const struct _obstack_chunk* c) {
+    const struct _obstack_chunk* parent = c->prev ? c->prev->prev : NULL;
+    return parent && (const char*)c > (const char*)parent && (const char*)c < parent->limit;
+}
+
+static struct _obstack_chunk* spare_take(struct obstack* h, size_t size) {
+    struct obstack_ext* ext = EXT(h);
+    if (!ext) {
+        return NULL;
+    }
+    struct _obstack_chunk** link = &ext->spares;
+    for (struct _obstack_chunk* chunk = *link; chunk; link = &chunk->prev, chunk = chunk->prev) {
+        if (CHUNK_BYTES(chunk) >= size) {
+            *link = chunk->prev;
+            ext->nspares--;
+            STAT_SUB(h, spare_bytes, CHUNK_BYTES(chunk));
+            STAT_ADD(h, memory_used, CHUNK_BYTES(chunk));
+            STAT_ADD(h, chunks_reused, 1);
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+static struct _obstack_chunk* chunk_alloc(struct obstack* h, size_t size) {
+    /* Give huge chunks the whole of their mapping. */
+    if (chunk_is_huge(h)) {
+        if (size > SIZE_MAX - HUGE_ALIGN) {
+            (*obstack_alloc_failed_handler)();
+        }
+        size = huge_round(size);
+    }
+
+    struct _obstack_chunk* chunk = spare_take(h, size);
+    if (chunk) {
+        return chunk;
+    }
+    if (pool_eligible(h, size)) {
+        chunk = pool_get();
+    }
+    if (!chunk) {
+        chunk = (struct _obstack_chunk*)call_chunkfun(h, size);
+        if (!chunk) {
+            (*obstack_alloc_failed_handler)();
+        }
+    }
+    chunk->limit = (char*)chunk + size;
+    STAT_ADD(h, chunks_allocated, 1);
+    STAT_ADD(h, memory_used, size);
+    stat_peak(h);
+    return chunk;
+}
+
+/* Percentage of the current object added on top of each new chunk. */
+#define OBSTACK_GROWTH_MAX 1000
+static unsigned growth_percent = 50;
+
+unsigned obstack_set_growth(unsigned percent) {
+    if (percent > OBSTACK_GROWTH_MAX) {
+        percent = OBSTACK_GROWTH_MAX;
+    }
+    return __atomic_exchange_n(&growth_percent, percent, __ATOMIC_RELAXED);
+}
+
+/* Resizes a chunk that holds nothing but the growing object, letting the
+   allocator move it (glibc remaps large blocks instead of copying them, and
+   huge chunks are remapped directly).  Returns NULL when the chunk cannot be
+   resized. */
+static struct _obstack_chunk* chunk_resize(struct obstack* h, struct _obstack_chunk* chunk, size_t size) {
+    struct _obstack_chunk* grown;
+    if (chunk_is_huge(h)) {
+        if (size > SIZE_MAX - HUGE_ALIGN) {
+            return NULL;
+        }
+        size = huge_round(size);
+        void* map = mremap(chunk, huge_round((size_t)(chunk->limit - (char*)chunk)), size, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED) {
+            return NULL;
+        }
+        madvise(map, size, MADV_HUGEPAGE);
+        grown = (struct _obstack_chunk*)map;
+        grown->limit = (char*)grown + size;
+        return grown;
+    }
+    if (!chunk_is_malloc(h)) {
+        return NULL;
+    }
+    grown = (struct _obstack_chunk*)realloc(chunk, size);
+    if (grown) {
+        grown->limit = (char*)grown + size;
+    }
+    return grown;
+}
+
+static struct _obstack_chunk* chunk_extend(struct obstack* h, struct _obstack_chunk* chunk, size_t size) {
+    if (chunk_is_tail(chunk)) {
+        return NULL;
+    }
+    size_t old = CHUNK_BYTES(chunk);
+    struct _obstack_chunk* grown = chunk_resize(h, chunk, size);
+    if (grown) {
+        STAT_ADD(h, memory_used, CHUNK_BYTES(grown) - old);
+        stat_peak(h);
+    }
+    return grown;
+}
+
+static void chunk_discard(struct obstack* h, struct _obstack_chunk* chunk) {
+    STAT_ADD(h, chunks_freed, 1);
+    if (pool_eligible(h, CHUNK_BYTES(chunk))) {
+        pool_put(chunk);
+    }
+    else {
+        call_freefun(h, chunk);
+    }
+}
+
+/* Takes a chunk off the chain, keeping it as a spare if KEEP allows. */
+static void chunk_release(struct obstack* h, struct _obstack_chunk* chunk, int keep) {
+    struct obstack_ext* ext = EXT(h);
+    if (chunk_is_tail(chunk)) {
+        return;
+    }
+    if (ext && ext->moved == chunk) {
+        ext->moved = NULL;
+    }
+    size_t bytes = CHUNK_BYTES(chunk);
+    STAT_SUB(h, memory_used, bytes);
+    /* Huge chunks have their own cache, which also returns their pages. */
+    if (keep && ext && ext->nspares < OBSTACK_SPARE_CHUNKS && !chunk_is_huge(h)) {
+        chunk->prev = ext->spares;
+        ext->spares = chunk;
+        ext->nspares++;
+        STAT_ADD(h, spare_bytes, bytes);
+        return;
+    }
+    chunk_discard(h, chunk);
+}
+
 static int _obstack_begin_worker(struct obstack* h, _OBSTACK_SIZE_T size, _OBSTACK_SIZE_T alignment) {
     if (alignment == 0) {
         alignment = DEFAULT_ALIGNMENT;
@@ -84,14 +531,18 @@ static int _obstack_begin_worker(struct obstack* h, _OBSTACK_SIZE_T size, _OBSTA
 
     h->chunk_size = size;
     h->alignment_mask = alignment - 1;
+    h->temp.p = NULL;
+    pthread_once(&stats_once, stats_init);
 
-    struct _obstack_chunk* chunk = (struct _obstack_chunk*)call_chunkfun(h, h->chunk_size);
-    if (!chunk) {
-        (*obstack_alloc_failed_handler)();
-    }
-
+    struct _obstack_chunk* chunk = chunk_alloc(h, h->chunk_size);
     chunk->prev = NULL;
-    chunk->limit = (char*)chunk + h->chunk_size;
+
+    struct obstack_ext* ext = (struct obstack_ext*)calloc(1, sizeof(*ext));
+    if (ext) {
+        ext->stats.chunks_allocated = 1;
+        ext->stats.memory_used = ext->stats.peak_footprint = CHUNK_BYTES(chunk);
+        h->temp.p = ext;
+    }
 
     h->chunk = chunk;
     h->chunk_limit = chunk->limit;
@@ -129,6 +580,41 @@ int _obstack_begin_1(struct obstack* h,
     return _obstack_begin_worker(h, size, alignment);
 }
 
+/* Continues in the chunk below a large block, from where the large object
+   began, if the current object and LENGTH more fit there. */
+static int tail_resume(struct obstack* h, size_t obj_size, size_t length) {
+    struct obstack_ext* ext = EXT(h);
+    struct _obstack_chunk* block = ext->moved;
+    struct _obstack_chunk* parent = block->prev;
+    char* start = __PTR_ALIGN((char*)block, block->contents, h->alignment_mask);
+    if ((size_t)(h->object_base - start) <= h->chunk_size) {
+        return 0;
+    }
+    size_t header_mask = __alignof__(struct _obstack_chunk) - 1;
+    struct _obstack_chunk* tail = (struct _obstack_chunk*)(((uintptr_t)ext->resume + header_mask) & ~header_mask);
+    if ((char*)tail + sizeof(*tail) >= parent->limit) {
+        return 0;
+    }
+    char* base = __PTR_ALIGN((char*)tail, tail->contents, h->alignment_mask);
+    if (base > parent->limit || (size_t)(parent->limit - base) < obj_size + length) {
+        return 0;
+    }
+
+    tail->limit = parent->limit;
+    tail->prev = block;
+    memcpy(base, h->object_base, obj_size);
+    STAT_ADD(h, bytes_copied, obj_size);
+    ext->moved = NULL;
+
+    h->chunk = tail;
+    h->chunk_limit = tail->limit;
+    h->object_base = base;
+    h->next_free = base + obj_size;
+    h->maybe_empty_object = 0;
+    h->alloc_failed = 0;
+    return 1;
+}
+
 void _obstack_newchunk(struct obstack* h, _OBSTACK_SIZE_T length) {
     struct _obstack_chunk* old_chunk = h->chunk;
     size_t obj_size = (size_t)(h->next_free - h->object_base);
@@ -143,7 +629,13 @@ void _obstack_newchunk(struct obstack* h, _OBSTACK_SIZE_T length) {
     }
     new_size += h->alignment_mask + 100;
 
-    size_t growth = obj_size >> 3;
+    /* Growing in proportion to the object keeps the copying done for an
+       object built a piece at a time linear in its final size. */
+    unsigned percent = __atomic_load_n(&growth_percent, __ATOMIC_RELAXED);
+    if (percent && obj_size / 100 > SIZE_MAX / percent) {
+        (*obstack_alloc_failed_handler)();
+    }
+    size_t growth = obj_size / 100 * percent + obj_size % 100 * percent / 100;
     if (SIZE_MAX - new_size < growth) {
         (*obstack_alloc_failed_handler)();
     }
@@ -153,25 +645,64 @@ void _obstack_newchunk(struct obstack* h, _OBSTACK_SIZE_T length) {
         new_size = h->chunk_size;
     }
 
-    struct _obstack_chunk* new_chunk = (struct _obstack_chunk*)call_chunkfun(h, new_size);
-    if (!new_chunk) {
-        (*obstack_alloc_failed_handler)();
+    char* old_base = h->object_base;
+    int sole = 0;
+    if (old_chunk && !h->maybe_empty_object) {
+        sole = old_base == __PTR_ALIGN((char*)old_chunk, old_chunk->contents, h->alignment_mask);
+    }
+
+    struct obstack_ext* ext = EXT(h);
+    if (ext && ext->moved && ext->moved == old_chunk && !sole && tail_resume(h, obj_size, length)) {
+        return;
+    }
+
+    /* An object that fills its chunk from the start is grown where it is. */
+    if (sole) {
+        struct _obstack_chunk* grown = chunk_extend(h, old_chunk, new_size);
+        if (grown) {
+            if (ext && ext->moved == old_chunk) {
+                ext->moved = grown;
+            }
+            char* base = __PTR_ALIGN((char*)grown, grown->contents, h->alignment_mask);
+            h->chunk = grown;
+            h->chunk_limit = grown->limit;
+            h->object_base = base;
+            h->next_free = base + obj_size;
+            h->alloc_failed = 0;
+            return;
+        }
+    }
+
+    /* A large object that does not fill its chunk moves to a block sized for
+       it, leaving the rest of the chunk for the objects after it. */
+    if (ext && old_chunk && !sole && obj_size + length > h->chunk_size) {
+        new_size = obj_size + length + h->alignment_mask + offsetof(struct _obstack_chunk, contents);
     }
+
+    struct _obstack_chunk* new_chunk = chunk_alloc(h, new_size);
     new_chunk->prev = old_chunk;
-    new_chunk->limit = (char*)new_chunk + new_size;
+    if (old_chunk && !sole) {
+        STAT_ADD(h, tail_waste, (size_t)(h->chunk_limit - old_base));
+        if (ext) {
+            ext->moved = new_chunk;
+            ext->resume = old_base;
+        }
+    }
     h->chunk_limit = new_chunk->limit;
 
-    char* old_base = h->object_base;
     char* new_base = __PTR_ALIGN((char*)new_chunk, new_chunk->contents, h->alignment_mask);
     memcpy(new_base, old_base, obj_size);
+    STAT_ADD(h, bytes_copied, obj_size);
     h->object_base = new_base;
     h->next_free = new_base + obj_size;
 
-    if (!h->maybe_empty_object) {
-        char* old_aligned = __PTR_ALIGN((char*)old_chunk, old_chunk->contents, h->alignment_mask);
-        if (old_base == old_aligned) {
-            new_chunk->prev = old_chunk->prev;
-            call_freefun(h, old_chunk);
+    if (sole) {
+        new_chunk->prev = old_chunk->prev;
+        /* The object outgrew it; a spare this size would not be reused. */
+        int was_moved = ext && ext->moved == old_chunk;
+        chunk_release(h, old_chunk, 0);
+        if (was_moved) {
+            ext->moved = new_chunk;
         }
     }
 
@@ -187,11 +718,20 @@ void _obstack_free(struct obstack* h, void* obj) {
     }
 
     if (obj == NULL) {
+        struct obstack_ext* ext = EXT(h);
+        while (ext && ext->spares) {
+            struct _obstack_chunk* spare = ext->spares;
+            ext->spares = spare->prev;
+            STAT_SUB(h, spare_bytes, CHUNK_BYTES(spare));
+            chunk_discard(h, spare);
+        }
         while (chunk) {
             struct _obstack_chunk* prev = chunk->prev;
-            call_freefun(h, chunk);
+            chunk_release(h, chunk, 0);
             chunk = prev;
         }
+        free(ext);
+        h->temp.p = NULL;
         h->chunk = NULL;
         h->chunk_limit = NULL;
         h->object_base = h->next_free = NULL;
@@ -200,9 +740,11 @@ void _obstack_free(struct obstack* h, void* obj) {
         return;
     }
 
+    /* Freeing back to a mark near a chunk edge would otherwise hand the same
+       chunk to the allocator and back on every cycle. */
     while (chunk && ((void*)chunk >= obj || (void*)chunk->limit < obj)) {
         struct _obstack_chunk* prev = chunk->prev;
-        call_freefun(h, chunk);
+        chunk_release(h, chunk, 1);
         chunk = prev;
         h->maybe_empty_object = 1;
     }
@@ -219,45 +761,107 @@ void _obstack_free(struct obstack* h, void* obj) {
 }
 
 _OBSTACK_SIZE_T _obstack_memory_used(struct obstack* h) {
+    if (h->chunk && EXT(h)) {
+        return (_OBSTACK_SIZE_T)EXT(h)->stats.memory_used;
+    }
     _OBSTACK_SIZE_T total = 0;
     for (struct _obstack_chunk* chunk = h->chunk; chunk; chunk = chunk->prev) {
-        total += (_OBSTACK_SIZE_T)((char*)chunk->limit - (char*)chunk);
+        if (!chunk_is_tail(chunk)) {
+            total += (_OBSTACK_SIZE_T)((char*)chunk->limit - (char*)chunk);
+        }
     }
     return total;
 }
 
+size_t obstack_trim(struct obstack* h, size_t keep_bytes) {
+    if (!h->chunk) {
+        return 0;
+    }
+    size_t released = 0;
+
+    /* Spares over the budget go straight back to the allocator, not to the
+       shared pool, whose chunks would stay resident. */
+    struct obstack_ext* ext = EXT(h);
+    size_t spare_bytes = 0;
+    for (struct _obstack_chunk* chunk = ext ? ext->spares : NULL; chunk; chunk = chunk->prev) {
+        spare_bytes += CHUNK_BYTES(chunk);
+    }
+    while (ext && ext->spares && spare_bytes > keep_bytes) {
+        struct _obstack_chunk* spare = ext->spares;
+        size_t bytes = CHUNK_BYTES(spare);
+        ext->spares = spare->prev;
+        ext->nspares--;
+        spare_bytes -= bytes;
+        STAT_SUB(h, spare_bytes, bytes);
+        STAT_ADD(h, chunks_freed, 1);
+        call_freefun(h, spare);
+        released += bytes;
+    }
+
+    /* The pages wholly past the end of the current object are handed back
+       and come back zeroed when the obstack reaches them.  The chunk stays
+       where it is: shrinking it with realloc() could move the objects in it.
+       Only memory from malloc() or the huge-page functions is known to be
+       safe to discard. */
+    if (chunk_is_malloc(h) || chunk_is_huge(h)) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        uintptr_t from = ((uintptr_t)h->next_free + page - 1) & ~(uintptr_t)(page - 1);
+        uintptr_t to = (uintptr_t)h->chunk_limit & ~(uintptr_t)(page - 1);
+        if (from < to && madvise((void*)from, to - from, MADV_DONTNEED) == 0) {
+            released += to - from;
+        }
+    }
+    return released;
+}
+
 size_t obstack_calculate_object_size(struct obstack* ob) {
     return (size_t)(ob->next_free - ob->object_base);
 }
 
-RESULT_TYPE OBSTACK_VPRINTF(struct obstack* obstack, const char* __restrict fmt, va_list ap) {
-    va_list measure;
-    va_copy(measure, ap);
-    int needed = vsnprintf(NULL, 0, fmt, measure);
-    va_end(measure);
-    if (needed < 0) {
-        return needed;
+void obstack_growv(struct obstack* h, const struct iovec* iov, int iovcnt) {
+    /* Size the whole record first so it moves at most once. */
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (SIZE_MAX - total < iov[i].iov_len) {
+            (*obstack_alloc_failed_handler)();
+        }
+        total += iov[i].iov_len;
+    }
+    if (obstack_room(h) < total) {
+        _obstack_newchunk(h, total);
     }
 
-    size_t total = (size_t)needed + 1;
-    if (obstack_room(obstack) < total) {
-        _obstack_newchunk(obstack, total);
+    char* dest = h->next_free;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len) {
+            memcpy(dest, iov[i].iov_base, iov[i].iov_len);
+            dest += iov[i].iov_len;
+        }
     }
+    h->next_free = dest;
+}
 
+void* obstack_copyv(struct obstack* h, const struct iovec* iov, int iovcnt) {
+    obstack_growv(h, iov, iovcnt);
+    return obstack_finish(h);
+}
+
+RESULT_TYPE OBSTACK_VPRINTF(struct obstack* obstack, const char* __restrict fmt, va_list ap) {
+    /* Format straight into the room left in the chunk; only output that does
+       not fit is formatted a second time, into a chunk sized for it. */
+    size_t room = obstack_room(obstack);
     char* dest = obstack->next_free;
     va_list copy;
     va_copy(copy, ap);
-    int written = vsnprintf(dest, total, fmt, copy);
+    int written = vsnprintf(dest, room, fmt, copy);
     va_end(copy);
     if (written < 0) {
         return written;
     }
 
-    if ((size_t)written >= total) {
+    if ((size_t)written >= room) {
         size_t required = (size_t)written + 1;
-        if (obstack_room(obstack) < required) {
-            _obstack_newchunk(obstack, required);
-        }
+        _obstack_newchunk(obstack, required);
         dest = obstack->next_free;
         va_copy(copy, ap);
         written = vsnprintf(dest, required, fmt, copy);
@@ -278,3 +882,337 @@ RESULT_TYPE OBSTACK_PRINTF(struct obstack* obstack, const char* __restrict fmt,
     va_end(ap);
     return res;
 }
+
+/* Typed appends for generated text: each formats into a small buffer and
+   grows the object once, without going through stdio. */
+
+static int grow_digits(struct obstack* h, unsigned long long v, unsigned base, int negative) {
+    static const char digits[] = "0123456789abcdef";
+    char buf[3 * sizeof(v) + 2];
+    char* p = buf + sizeof(buf);
+    do {
+        *--p = digits[v % base];
+        v /= base;
+    } while (v);
+    if (negative) {
+        *--p = '-';
+    }
+    int len = (int)(buf + sizeof(buf) - p);
+    obstack_grow(h, p, (size_t)len);
+    return len;
+}
+
+int obstack_grow_dec(struct obstack* h, long long v) {
+    unsigned long long mag = v < 0 ? 0 - (unsigned long long)v : (unsigned long long)v;
+    return grow_digits(h, mag, 10, v < 0);
+}
+
+int obstack_grow_udec(struct obstack* h, unsigned long long v) {
+    return grow_digits(h, v, 10, 0);
+}
+
+int obstack_grow_hex(struct obstack* h, unsigned long long v) {
+    return grow_digits(h, v, 16, 0);
+}
+
+int obstack_grow_fixed(struct obstack* h, double v, int prec) {
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+    /* Below 2^40 the scaled value is off by at most 2^-13, so rounding it
+       agrees with the exactly rounded "%.*f" unless it sits near a tie;
+       those, huge values and non-finite ones go to the formatter. */
+    int negative = signbit(v) != 0;
+    double scaled = (negative ? -v : v) * (prec >= 0 && prec < 10 ? pow10[prec] : 0.0);
+    if (prec < 0 || prec >= 10 || !(scaled < 0x1p40)) {
+        return obstack_printf(h, "%.*f", prec, v);
+    }
+    unsigned long long units = (unsigned long long)scaled;
+    double frac = scaled - (double)units;
+    if (frac > 0.5 - 0x1p-12 && frac < 0.5 + 0x1p-12) {
+        return obstack_printf(h, "%.*f", prec, v);
+    }
+    if (frac > 0.5) {
+        units++;
+    }
+
+    unsigned long long scale = (unsigned long long)pow10[prec];
+    int len = grow_digits(h, units / scale, 10, negative);
+    if (prec > 0) {
+        char buf[10];
+        unsigned long long rest = units % scale;
+        for (int i = prec; i > 0; i--) {
+            buf[i - 1] = (char)('0' + rest % 10);
+            rest /= 10;
+        }
+        obstack_1grow(h, '.');
+        obstack_grow(h, buf, (size_t)prec);
+        len += 1 + prec;
+    }
+    return len;
+}
+
+int obstack_grow_escaped(struct obstack* h, const char* s, size_t n) {
+    int len = 0;
+    size_t run = 0;
+
+    /* Printable runs are copied whole; everything else is escaped C-style. */
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)s[i];
+        char esc[4];
+        size_t esc_len = 2;
+        esc[0] = '\\';
+        switch (c) {
+            case '\n':
+                esc[1] = 'n';
+                break;
+            case '\t':
+                esc[1] = 't';
+                break;
+            case '\r':
+                esc[1] = 'r';
+                break;
+            case '"':
+            case '\\':
+                esc[1] = (char)c;
+                break;
+            default:
+                if (c >= 0x20 && c < 0x7f) {
+                    run++;
+                    continue;
+                }
+                /* Octal, so a following digit cannot extend the escape. */
+                esc[1] = (char)('0' + (c >> 6));
+                esc[2] = (char)('0' + ((c >> 3) & 7));
+                esc[3] = (char)('0' + (c & 7));
+                esc_len = 4;
+                break;
+        }
+        obstack_grow(h, s + i - run, run);
+        obstack_grow(h, esc, esc_len);
+        len += (int)(run + esc_len);
+        run = 0;
+    }
+    obstack_grow(h, s + n - run, run);
+    return len + (int)run;
+}
+
+/* Streams write into the growing object: the position is relative to the
+   object's start, writes past the end extend it and seeks beyond the end
+   zero-fill.  Once the object is finished, or grown by someone else, the
+   next write appends to whatever object is current.  The stream keeps
+   stdio's buffer, so output reaches the object a buffer at a time. */
+struct obstack_cookie {
+    struct obstack* h;
+    char* base;
+    size_t size;
+    size_t pos;
+};
+
+static void cookie_sync(struct obstack_cookie* c) {
+    size_t size = obstack_object_size(c->h);
+    if (c->h->object_base != c->base || size != c->size) {
+        c->base = c->h->object_base;
+        c->size = size;
+        c->pos = size;
+    }
+}
+
+/* Zero-fills the object up to END. */
+static void cookie_extend(struct obstack_cookie* c, size_t end) {
+    if (end > c->size) {
+        size_t more = end - c->size;
+        obstack_blank(c->h, more);
+        memset(c->h->next_free - more, 0, more);
+    }
+    c->base = c->h->object_base;
+    c->size = obstack_object_size(c->h);
+}
+
+static ssize_t cookie_write(void* cookie, const char* buf, size_t size) {
+    struct obstack_cookie* c = (struct obstack_cookie*)cookie;
+    cookie_sync(c);
+    if (size > SSIZE_MAX || c->pos > SIZE_MAX - size) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    /* Bytes before the end overwrite the object; the rest are appended. */
+    size_t inside = c->size - c->pos;
+    if (inside > size) {
+        inside = size;
+    }
+    memcpy(c->h->object_base + c->pos, buf, inside);
+    obstack_grow(c->h, buf + inside, size - inside);
+    c->base = c->h->object_base;
+    c->size = obstack_object_size(c->h);
+    c->pos += size;
+    return (ssize_t)size;
+}
+
+static int cookie_seek(void* cookie, off64_t* offset, int whence) {
+    struct obstack_cookie* c = (struct obstack_cookie*)cookie;
+    cookie_sync(c);
+    off64_t from = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (off64_t)c->pos : (off64_t)c->size;
+    if ((whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END) || *offset < -from ||
+        (*offset > 0 && (uint64_t)*offset > SIZE_MAX - (uint64_t)from)) {
+        errno = EINVAL;
+        return -1;
+    }
+    c->pos = (size_t)(from + *offset);
+    cookie_extend(c, c->pos);
+    *offset = (off64_t)c->pos;
+    return 0;
+}
+
+static int cookie_close(void* cookie) {
+    free(cookie);
+    return 0;
+}
+
+FILE* open_obstack_stream(struct obstack* obstack) {
+    struct obstack_cookie* c = (struct obstack_cookie*)malloc(sizeof(*c));
+    if (!c) {
+        return NULL;
+    }
+    c->h = obstack;
+    c->base = obstack->object_base;
+    c->size = obstack_object_size(obstack);
+    c->pos = c->size;
+
+    cookie_io_functions_t io = {NULL, cookie_write, cookie_seek, cookie_close};
+    FILE* fp = fopencookie(c, "w", io);
+    if (!fp) {
+        free(c);
+        return NULL;
+    }
+    return fp;
+}
+
+/* An arena gives each thread an obstack of its own, found through a
+   thread-specific key, so allocating takes no lock.  A thread's obstack
+   outlives the thread: it is parked when the thread exits and handed to the
+   next thread that comes along, and every chunk is released with the arena. */
+struct arena_cursor {
+    struct obstack ob;
+    struct obstack_arena* arena;
+    struct arena_cursor* next;
+    int live;
+};
+
+struct obstack_arena {
+    pthread_key_t key;
+    pthread_mutex_t lock;
+    struct arena_cursor* cursors;
+    _OBSTACK_SIZE_T size;
+    _OBSTACK_SIZE_T alignment;
+    void* (*chunkfun)(void*, size_t);
+    void (*freefun)(void*, void*);
+    void* arg;
+};
+
+static void arena_thread_exit(void* arg) {
+    struct arena_cursor* c = (struct arena_cursor*)arg;
+    pthread_mutex_lock(&c->arena->lock);
+    c->live = 0;
+    pthread_mutex_unlock(&c->arena->lock);
+}
+
+static struct arena_cursor* arena_attach(struct obstack_arena* a) {
+    pthread_mutex_lock(&a->lock);
+    struct arena_cursor* c = a->cursors;
+    while (c && c->live) {
+        c = c->next;
+    }
+    if (c) {
+        /* Whatever the last owner left growing is sealed where it is. */
+        (void)obstack_finish(&c->ob);
+    }
+    else {
+        c = (struct arena_cursor*)calloc(1, sizeof(*c));
+        int ok = 0;
+        if (c && a->chunkfun) {
+            ok = _obstack_begin_1(&c->ob, a->size, a->alignment, a->chunkfun, a->freefun, a->arg);
+        }
+        else if (c) {
+            ok = _obstack_begin(&c->ob, a->size, a->alignment, xmalloc, free);
+        }
+        if (!ok) {
+            pthread_mutex_unlock(&a->lock);
+            free(c);
+            (*obstack_alloc_failed_handler)();
+            return NULL;
+        }
+        c->arena = a;
+        c->next = a->cursors;
+        a->cursors = c;
+    }
+    c->live = 1;
+    pthread_mutex_unlock(&a->lock);
+    pthread_setspecific(a->key, c);
+    return c;
+}
+
+struct obstack_arena* obstack_arena_create(_OBSTACK_SIZE_T size,
+                                           _OBSTACK_SIZE_T alignment,
+                                           void* (*chunkfun)(void*, size_t),
+                                           void (*freefun)(void*, void*),
+                                           void* arg) {
+    struct obstack_arena* a = (struct obstack_arena*)calloc(1, sizeof(*a));
+    if (!a) {
+        return NULL;
+    }
+    int err = pthread_key_create(&a->key, arena_thread_exit);
+    if (err) {
+        free(a);
+        errno = err;
+        return NULL;
+    }
+    pthread_mutex_init(&a->lock, NULL);
+    a->size = size;
+    a->alignment = alignment;
+    a->chunkfun = chunkfun;
+    a->freefun = freefun;
+    a->arg = arg;
+    return a;
+}
+
+struct obstack* obstack_arena_local(struct obstack_arena* a) {
+    struct arena_cursor* c = (struct arena_cursor*)pthread_getspecific(a->key);
+    if (!c) {
+        c = arena_attach(a);
+    }
+    return &c->ob;
+}
+
+void* obstack_arena_alloc(struct obstack_arena* a, _OBSTACK_SIZE_T size) {
+    struct obstack* h = obstack_arena_local(a);
+    return obstack_alloc(h, size);
+}
+
+void obstack_arena_free(struct obstack_arena* a, void* obj) {
+    struct obstack* h = obstack_arena_local(a);
+    if (!obj) {
+        struct _obstack_chunk* chunk = h->chunk;
+        while (chunk->prev) {
+            chunk = chunk->prev;
+        }
+        obj = __PTR_ALIGN((char*)chunk, chunk->contents, h->alignment_mask);
+    }
+    obstack_free(h, obj);
+}
+
+void obstack_arena_destroy(struct obstack_arena* a) {
+    if (!a) {
+        return;
+    }
+    pthread_key_delete(a->key);
+    struct arena_cursor* c = a->cursors;
+    while (c) {
+        struct arena_cursor* next = c->next;
+        obstack_free(&c->ob, NULL);
+        free(c);
+        c = next;
+    }
+    pthread_mutex_destroy(&a->lock);
+    free(a);
+}
@@ -0,0 +1,75 @@
+#ifndef MUSL_BSD_SDT_H
+#define MUSL_BSD_SDT_H
+
+/* Static tracepoints in the format of SystemTap's <sys/sdt.h>, so bpftrace,
+   perf and stap can attach to them without the systemtap headers being
+   installed at build time.  Each probe site is a single nop plus an entry in
+   the non-allocated .note.stapsdt section recording the nop's address and
+   where each argument lives; tracers patch the nop only while attached.
+
+   Arguments must be scalars or pointers.  Defining MUSL_BSD_NO_SDT compiles
+   the probes out. */
+
+#if !defined(MUSL_BSD_NO_SDT) && defined(__ELF__) && defined(__GNUC__)
+
+#if defined(__LP64__) || defined(_LP64)
+#define _SDT_ASM_ADDR ".8byte"
+#else
+#define _SDT_ASM_ADDR ".4byte"
+#endif
+
+/* Argument sizes are negative for signed values, as the note format wants. */
+#define _SDT_ISPTR(x) (__builtin_classify_type(x) == 5)
+#define _SDT_SIGNED(x) (!_SDT_ISPTR(x) && (__typeof__(__builtin_choose_expr(_SDT_ISPTR(x), 0, (x))))-1 < 1)
+#define _SDT_SIZE(x) (_SDT_SIGNED(x) ? (int)sizeof(x) : -(int)sizeof(x))
+
+#define _SDT_ARG(n) "%n[_SDT_S" #n "]@%[_SDT_A" #n "]"
+#define _SDT_OP(n, x) [_SDT_S##n] "n"(_SDT_SIZE(x)), [_SDT_A##n] "nor"(x)
+
+#define _SDT_NOTE(provider, name, args)                                      \
+    "990: nop\n"                                                             \
+    ".pushsection .note.stapsdt,\"\",\"note\"\n"                             \
+    ".balign 4\n"                                                            \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                       \
+    "991: .asciz \"stapsdt\"\n"                                              \
+    "992: .balign 4\n"                                                       \
+    "993: " _SDT_ASM_ADDR " 990b\n"                                          \
+    _SDT_ASM_ADDR " _.stapsdt.base\n"                                        \
+    _SDT_ASM_ADDR " 0\n"                                                     \
+    ".asciz \"" #provider "\"\n"                                             \
+    ".asciz \"" #name "\"\n"                                                 \
+    ".asciz \"" args "\"\n"                                                  \
+    "994: .balign 4\n"                                                       \
+    ".popsection\n"                                                          \
+    ".ifndef _.stapsdt.base\n"                                               \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n"                                                 \
+    ".hidden _.stapsdt.base\n"                                               \
+    "_.stapsdt.base: .space 1\n"                                             \
+    ".size _.stapsdt.base, 1\n"                                              \
+    ".popsection\n"                                                          \
+    ".endif\n"
+
+#define STAP_PROBE(provider, name) __asm__ __volatile__(_SDT_NOTE(provider, name, ""))
+#define STAP_PROBE1(provider, name, a1) \
+    __asm__ __volatile__(_SDT_NOTE(provider, name, _SDT_ARG(1))::_SDT_OP(1, a1))
+#define STAP_PROBE2(provider, name, a1, a2) \
+    __asm__ __volatile__(_SDT_NOTE(provider, name, _SDT_ARG(1) " " _SDT_ARG(2))::_SDT_OP(1, a1), _SDT_OP(2, a2))
+#define STAP_PROBE3(provider, name, a1, a2, a3)                                                 \
+    __asm__ __volatile__(_SDT_NOTE(provider, name, _SDT_ARG(1) " " _SDT_ARG(2) " " _SDT_ARG(3)) \
+                         :                                                                      \
+                         : _SDT_OP(1, a1), _SDT_OP(2, a2), _SDT_OP(3, a3))
+
+#else
+
+/* sizeof keeps the arguments referenced without evaluating them. */
+#define STAP_PROBE(provider, name) \
+    do {                           \
+    } while (0)
+#define STAP_PROBE1(provider, name, a1) ((void)sizeof(a1))
+#define STAP_PROBE2(provider, name, a1, a2) ((void)sizeof(a1), (void)sizeof(a2))
+#define STAP_PROBE3(provider, name, a1, a2, a3) ((void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3))
+
+#endif
+
+#endif
@@ -0,0 +1,138 @@
+#include <argp.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GENERATED 2000
+
+struct seen {
+    int key;
+    int group;
+    char value[32];
+};
+
+static error_t record(int key, char* arg, struct argp_state* state, int group) {
+    struct seen* seen = state->input;
+    if (key == ARGP_KEY_INIT && state->child_inputs) {
+        state->child_inputs[0] = seen;
+        state->child_inputs[1] = seen;
+        return 0;
+    }
+    if (key == ARGP_KEY_ARG || key >= ARGP_KEY_END)
+        return ARGP_ERR_UNKNOWN;
+    seen->key = key;
+    seen->group = group;
+    snprintf(seen->value, sizeof(seen->value), "%s", arg ? arg : "");
+    return 0;
+}
+
+static error_t parse_root(int key, char* arg, struct argp_state* state) {
+    return record(key, arg, state, 0);
+}
+
+static error_t parse_child(int key, char* arg, struct argp_state* state) {
+    return record(key, arg, state, 1);
+}
+
+static const struct argp_option child_options[] = {
+    {"zeta", 'z', 0, 0, "in both children", 0},
+    {"gen-0042", 'k', 0, 0, "shadowed by the root", 0},
+    {0},
+};
+
+static const struct argp child = {child_options, parse_child, NULL, NULL, NULL, NULL, NULL};
+
+static const struct argp_child children[] = {
+    {&child, 0, NULL, 0},
+    {&child, 0, NULL, 0},
+    {NULL, 0, NULL, 0},
+};
+
+static struct argp_option* root_options;
+static struct argp root;
+
+static void build(void) {
+    static const struct argp_option fixed[] = {
+        {"color", 'c', "WHEN", 0, "colourise", 0},
+        {"colour", 0, 0, OPTION_ALIAS, NULL, 0},
+        {"count", 'n', "N", 0, "how many", 0},
+        {"verbose", 'v', 0, 0, "more output", 0},
+        {"verb", 'V', 0, 0, "a prefix of verbose", 0},
+    };
+    size_t nfixed = sizeof(fixed) / sizeof(fixed[0]);
+    root_options = calloc(nfixed + GENERATED + 1, sizeof(*root_options));
+    assert(root_options != NULL);
+    memcpy(root_options, fixed, sizeof(fixed));
+    for (int i = 0; i < GENERATED; i++) {
+        char* name = malloc(16);
+        assert(name != NULL);
+        snprintf(name, 16, "gen-%04d", i);
+        root_options[nfixed + i].name = name;
+        root_options[nfixed + i].key = 1000 + i;
+        root_options[nfixed + i].arg = i % 2 ? "X" : NULL;
+    }
+    root.options = root_options;
+    root.parser = parse_root;
+    root.children = children;
+}
+
+static error_t parse(const char* opt, struct seen* seen) {
+    char prog[] = "prog";
+    char arg[64];
+    snprintf(arg, sizeof(arg), "%s", opt);
+    char* argv[] = {prog, arg, NULL};
+    memset(seen, 0, sizeof(*seen));
+    seen->key = -1;
+    return argp_parse(&root, 2, argv, ARGP_NO_EXIT | ARGP_NO_ERRS, NULL, seen);
+}
+
+static void expect(const char* opt, int key, int group, const char* value) {
+    struct seen seen;
+    error_t err = parse(opt, &seen);
+    if (err || seen.key != key || seen.group != group || strcmp(seen.value, value) != 0) {
+        fprintf(stderr, "%s: err %d key %d group %d value \"%s\"\n", opt, err, seen.key, seen.group, seen.value);
+        abort();
+    }
+}
+
+static void expect_error(const char* opt) {
+    struct seen seen;
+    assert(parse(opt, &seen) == EINVAL && seen.key == -1);
+}
+
+int main(void) {
+    build();
+
+    /* Exact names win over longer names they prefix, and over later groups. */
+    expect("--verb", 'V', 0, "");
+    expect("--verbose", 'v', 0, "");
+    expect("--color=auto", 'c', 0, "auto");
+    expect("--gen-0000", 1000, 0, "");
+    expect("--gen-0042", 1042, 0, "");
+    expect("--gen-1999=x", 2999, 0, "x");
+
+    /* A unique prefix, or one naming only aliases of one option. */
+    expect("--verbo", 'v', 0, "");
+    expect("--cou=3", 'n', 0, "3");
+    expect("--colo=never", 'c', 0, "never");
+    expect("--gen-0124", 1124, 0, "");
+
+    /* The same child twice is one option; the first group gets it. */
+    expect("--zeta", 'z', 1, "");
+    expect("--ze", 'z', 1, "");
+
+    /* Ambiguous and unknown names. */
+    expect_error("--co");
+    expect_error("--gen-12");
+    expect_error("--ver");
+    expect_error("--gen-2000");
+    expect_error("--zz");
+    expect_error("--=x");
+
+    for (int i = 0; i < GENERATED; i++)
+        free((char*)root_options[5 + i].name);
+    free(root_options);
+    return 0;
+}
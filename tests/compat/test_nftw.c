@@ -0,0 +1,217 @@
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHECK(condition)                                                \
+    do {                                                                \
+        if (!(condition)) {                                             \
+            fprintf(stderr, "nftw test failed at line %d\n", __LINE__); \
+            return 1;                                                   \
+        }                                                               \
+    } while (0)
+
+#define MAX_EVENTS 64
+
+struct event {
+    char path[256];
+    int type;
+    int base;
+    int level;
+};
+
+static struct event events[MAX_EVENTS];
+static int nevents;
+static char cwd_ok;
+static int (*action)(const char* path, int type);
+
+static int record(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    struct stat here;
+
+    (void)st;
+    if (nevents < MAX_EVENTS) {
+        snprintf(events[nevents].path, sizeof(events[nevents].path), "%s", path);
+        events[nevents].type = type;
+        events[nevents].base = ftw->base;
+        events[nevents].level = ftw->level;
+        nevents++;
+    }
+    /* Under FTW_CHDIR the entry's own name resolves from the working directory. */
+    if (cwd_ok && fstatat(AT_FDCWD, path + ftw->base, &here, AT_SYMLINK_NOFOLLOW) != 0)
+        cwd_ok = 0;
+    return action ? action(path, type) : 0;
+}
+
+static int walk(const char* root, int flags) {
+    nevents = 0;
+    cwd_ok = 1;
+    return nftw(root, record, 8, flags);
+}
+
+static const struct event* find(const char* suffix) {
+    size_t n = strlen(suffix);
+
+    for (int i = 0; i < nevents; i++) {
+        size_t len = strlen(events[i].path);
+        if (len >= n && strcmp(events[i].path + len - n, suffix) == 0)
+            return &events[i];
+    }
+    return NULL;
+}
+
+static int count(const char* infix) {
+    int n = 0;
+
+    for (int i = 0; i < nevents; i++)
+        if (strstr(events[i].path, infix))
+            n++;
+    return n;
+}
+
+static int skip_a(const char* path, int type) {
+    return type == FTW_D && strstr(path, "/a") && !strstr(path, "/a/") ? FTW_SKIP_SUBTREE : FTW_CONTINUE;
+}
+
+static int skip_b_siblings(const char* path, int type) {
+    (void)type;
+    return strstr(path, "/b/z") ? FTW_SKIP_SIBLINGS : FTW_CONTINUE;
+}
+
+static int stop_at_c(const char* path, int type) {
+    (void)type;
+    return strstr(path, "/c") ? FTW_STOP : FTW_CONTINUE;
+}
+
+static int plain_stop(const char* path, int type) {
+    (void)type;
+    return strstr(path, "/c") ? 42 : 0;
+}
+
+static int verify_core_provider(const char* name, const void* function) {
+    Dl_info info;
+
+    memset(&info, 0, sizeof(info));
+    CHECK(dladdr(function, &info) != 0);
+    CHECK(info.dli_fname != NULL);
+    CHECK(strstr(info.dli_fname, "libmusl-bsd-core") != NULL);
+    CHECK(dlsym(RTLD_DEFAULT, name) == function);
+    return 0;
+}
+
+static int make_tree(char* root) {
+    static const char* const dirs[] = {"a", "b", "a/x"};
+    static const char* const files[] = {"a/y", "b/z0", "b/z1", "b/z2", "c"};
+    char path[512];
+
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+        CHECK(mkdir(path, 0755) == 0);
+    }
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+        int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        CHECK(fd >= 0);
+        CHECK(close(fd) == 0);
+    }
+    snprintf(path, sizeof(path), "%s/lnk", root);
+    CHECK(symlink("a", path) == 0);
+    snprintf(path, sizeof(path), "%s/dangling", root);
+    CHECK(symlink("missing", path) == 0);
+    return 0;
+}
+
+static int check_walks(const char* root) {
+    char slashed[512];
+    const struct event* e;
+    char home[512], after[512];
+
+    /* Logical walk: each directory once, dangling links as FTW_SLN. */
+    action = NULL;
+    CHECK(walk(root, 0) == 0);
+    CHECK(nevents == 10);
+    CHECK(events[0].type == FTW_D && strcmp(events[0].path, root) == 0 && events[0].level == 0);
+    CHECK(count("/x") == 1 && count("/y") == 1);
+    CHECK((e = find("/dangling")) != NULL && e->type == FTW_SLN);
+    CHECK((e = find("/b/z1")) != NULL && e->type == FTW_F && e->level == 2);
+    CHECK(e->base == (int)strlen(e->path) - 2);
+
+    /* Physical walk: links are reported as links. */
+    CHECK(walk(root, FTW_PHYS) == 0);
+    CHECK(nevents == 11);
+    CHECK((e = find("/lnk")) != NULL && e->type == FTW_SL);
+    CHECK((e = find("/dangling")) != NULL && e->type == FTW_SL);
+
+    /* Post-order: no FTW_D, directories after their contents. */
+    CHECK(walk(root, FTW_PHYS | FTW_DEPTH) == 0);
+    CHECK(nevents == 11);
+    CHECK(events[nevents - 1].type == FTW_DP && strcmp(events[nevents - 1].path, root) == 0);
+    for (int i = 0; i < nevents; i++)
+        CHECK(events[i].type != FTW_D);
+    CHECK(find("/a/x") < find("/a") && find("/a/y") < find("/a"));
+
+    /* Trailing slashes are dropped from the start path. */
+    snprintf(slashed, sizeof(slashed), "%s//", root);
+    CHECK(walk(slashed, FTW_PHYS) == 0);
+    CHECK(strcmp(events[0].path, root) == 0);
+    CHECK(events[0].base == (int)(strrchr(root, '/') - root) + 1);
+
+    /* FTW_ACTIONRETVAL pruning. */
+    action = skip_a;
+    CHECK(walk(root, FTW_PHYS | FTW_ACTIONRETVAL) == 0);
+    CHECK(find("/a") != NULL && count("/a/") == 0 && nevents == 9);
+    CHECK(walk(root, FTW_PHYS | FTW_ACTIONRETVAL | FTW_DEPTH) == 0);
+    CHECK(count("/a/") == 2);
+
+    action = skip_b_siblings;
+    CHECK(walk(root, FTW_PHYS | FTW_ACTIONRETVAL | FTW_DEPTH) == 0);
+    CHECK(count("/b/") == 1 && (e = find("/b")) != NULL && e->type == FTW_DP);
+    CHECK(find("/c") != NULL && nevents == 9);
+
+    action = stop_at_c;
+    CHECK(walk(root, FTW_PHYS | FTW_ACTIONRETVAL) == FTW_STOP);
+    CHECK(strstr(events[nevents - 1].path, "/c") != NULL);
+
+    /* Without FTW_ACTIONRETVAL any nonzero value ends the walk. */
+    action = skip_a;
+    CHECK(walk(root, FTW_PHYS) == FTW_SKIP_SUBTREE);
+    CHECK(find("/a") == &events[nevents - 1]);
+    action = plain_stop;
+    CHECK(walk(root, FTW_PHYS) == 42);
+
+    /* FTW_CHDIR runs callbacks beside the entry and restores the directory. */
+    action = NULL;
+    CHECK(getcwd(home, sizeof(home)) != NULL);
+    CHECK(walk(root, FTW_PHYS | FTW_CHDIR | FTW_DEPTH) == 0);
+    CHECK(cwd_ok && nevents == 11);
+    CHECK(walk(root, FTW_CHDIR) == 0);
+    CHECK(cwd_ok && nevents == 10);
+    CHECK(getcwd(after, sizeof(after)) != NULL && strcmp(home, after) == 0);
+
+    errno = 0;
+    CHECK(nftw("/nonexistent/musl-bsd-nftw", record, 8, 0) == -1 && errno == ENOENT);
+    CHECK(nftw64(root, record, 8, FTW_PHYS) == 0);
+    return 0;
+}
+
+static int remove_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)st;
+    (void)ftw;
+    return type == FTW_DP ? rmdir(path) : unlink(path);
+}
+
+int main(void) {
+    char root[] = "/tmp/musl-bsd-nftw-XXXXXX";
+    int result;
+
+    CHECK(verify_core_provider("nftw", (const void*)nftw) == 0);
+    CHECK(verify_core_provider("nftw64", (const void*)nftw64) == 0);
+    CHECK(mkdtemp(root) != NULL);
+    result = make_tree(root) || check_walks(root);
+    CHECK(nftw(root, remove_entry, 8, FTW_PHYS | FTW_DEPTH) == 0);
+    return result;
+}
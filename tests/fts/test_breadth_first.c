@@ -0,0 +1,244 @@
+#include "test_support.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_STEPS 256
+
+static int build_deep(const char* root) {
+    char p[1024];
+    const char* dirs[] = {"deep", "deep/one", "deep/one/two", "deep/one/two/three", "deep/side", NULL};
+    for (size_t i = 0; dirs[i]; i++) {
+        snprintf(p, sizeof(p), "%s/%s", root, dirs[i]);
+        if (mkdir(p, 0755) == -1)
+            return -1;
+        snprintf(p, sizeof(p), "%s/%s/f", root, dirs[i]);
+        if (fts_write_file(p, "x\n") == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static int open_fds(void) {
+    int n = 0;
+    for (int fd = 0; fd < 256; fd++)
+        if (fcntl(fd, F_GETFD) != -1)
+            n++;
+    return n;
+}
+
+static int cmp_str(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static size_t collect(FTS* f, char** paths, size_t max) {
+    size_t n = 0;
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        if (e->fts_info == FTS_DP || n == max)
+            continue;
+        paths[n++] = strdup(e->fts_path);
+    }
+    return n;
+}
+
+static void test_level_order(const struct fts_test_tree* tree) {
+    char* roots[] = {tree->abs_root, NULL};
+    static char* dfs[MAX_STEPS];
+    static char* bfs[MAX_STEPS];
+
+    FTS* f = fts_open(roots, FTS_PHYSICAL, fts_cmp_asc);
+    if (!f)
+        return;
+    size_t ndfs = collect(f, dfs, MAX_STEPS);
+    fts_close(f);
+
+    int base = open_fds();
+    f = fts_open(roots, FTS_PHYSICAL | FTS_BREADTHFIRST, fts_cmp_asc);
+    fts_check(f != NULL, "fts_open accepts FTS_BREADTHFIRST");
+    if (!f)
+        return;
+
+    size_t nbfs = 0;
+    int level = 0;
+    bool ordered = true, no_post = true, parents = true, fds = true;
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        if (e->fts_level < level)
+            ordered = false;
+        level = e->fts_level;
+        if (e->fts_info == FTS_DP)
+            no_post = false;
+        if (e->fts_level > FTS_ROOTLEVEL) {
+            const FTSENT* up = e->fts_parent;
+            size_t plen = strlen(e->fts_path) - e->fts_namelen - 1;
+            if (up->fts_level != e->fts_level - 1 || plen < up->fts_namelen ||
+                memcmp(e->fts_path + plen - up->fts_namelen, up->fts_name, up->fts_namelen) != 0)
+                parents = false;
+        }
+        if (open_fds() > base)
+            fds = false;
+        if (nbfs < MAX_STEPS)
+            bfs[nbfs++] = strdup(e->fts_path);
+    }
+    fts_check(errno == 0, "level-order walk ends cleanly");
+    fts_check(fts_close(f) == 0, "close level-order stream");
+
+    fts_check(ordered, "entries are returned in non-decreasing level order");
+    fts_check(no_post, "directories are not returned in post-order");
+    fts_check(parents, "fts_parent stays valid for every entry");
+    fts_check(fds, "no directory descriptors are held between reads");
+
+    qsort(dfs, ndfs, sizeof(*dfs), cmp_str);
+    qsort(bfs, nbfs, sizeof(*bfs), cmp_str);
+    bool same = ndfs == nbfs && ndfs > 10;
+    for (size_t i = 0; same && i < ndfs; i++)
+        same = strcmp(dfs[i], bfs[i]) == 0;
+    fts_check(same, "breadth-first visits the same %zu entries as depth-first", ndfs);
+
+    for (size_t i = 0; i < ndfs; i++)
+        free(dfs[i]);
+    for (size_t i = 0; i < nbfs; i++)
+        free(bfs[i]);
+}
+
+static void test_instructions(const struct fts_test_tree* tree) {
+    char* roots[] = {tree->abs_root, NULL};
+    FTS* f = fts_open(roots, FTS_PHYSICAL | FTS_BREADTHFIRST, fts_cmp_asc);
+    if (!f)
+        return;
+
+    bool skipped_seen = false, kept_seen = false, listed = false;
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        if (e->fts_info == FTS_D && strcmp(e->fts_name, "deep") == 0) {
+            /* Children listed now are kept until the directory's turn. */
+            for (FTSENT* c = fts_children(f, 0); c; c = c->fts_link) {
+                listed = true;
+                if (strcmp(c->fts_name, "one") == 0)
+                    fts_set(f, c, FTS_SKIP);
+            }
+        }
+        if (e->fts_info == FTS_D && strcmp(e->fts_name, "a") == 0)
+            fts_set(f, e, FTS_SKIP);
+        if (strstr(e->fts_path, "/deep/one") || strstr(e->fts_path, "/a/"))
+            skipped_seen = true;
+        if (strstr(e->fts_path, "/deep/side/f"))
+            kept_seen = true;
+    }
+    fts_check(listed, "fts_children lists a queued directory");
+    fts_check(!skipped_seen, "FTS_SKIP prunes directories and listed children");
+    fts_check(kept_seen, "unskipped siblings are still walked");
+    fts_close(f);
+
+    /* Close with directories still queued. */
+    f = fts_open(roots, FTS_PHYSICAL | FTS_BREADTHFIRST, NULL);
+    if (f) {
+        for (int i = 0; i < 6 && fts_read(f); i++)
+            ;
+        fts_check(fts_close(f) == 0, "close a partially read level-order stream");
+    }
+}
+
+static void test_follow(const struct fts_test_tree* tree) {
+    char bt[1024], p[1100];
+    snprintf(bt, sizeof(bt), "%s/bt", tree->abs_root);
+    snprintf(p, sizeof(p), "%s/d/sub/f", bt);
+    char d[1100], sub[1100], l[1100], m[1100];
+    snprintf(d, sizeof(d), "%s/d", bt);
+    snprintf(sub, sizeof(sub), "%s/d/sub", bt);
+    snprintf(l, sizeof(l), "%s/d/l", bt);
+    snprintf(m, sizeof(m), "%s/d/m", bt);
+    if (mkdir(bt, 0755) == -1 || mkdir(d, 0755) == -1 || mkdir(sub, 0755) == -1 || fts_write_file(p, "x\n") == -1 ||
+        symlink("sub", l) == -1 || symlink("missing", m) == -1) {
+        fts_check(0, "build follow tree");
+        return;
+    }
+
+    char* roots[] = {bt, NULL};
+    FTS* f = fts_open(roots, FTS_PHYSICAL | FTS_BREADTHFIRST, fts_cmp_asc);
+    if (!f)
+        return;
+    int l_info = -1, m_info = -1;
+    bool entered = false;
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        if (e->fts_info == FTS_D && strcmp(e->fts_name, "d") == 0)
+            for (FTSENT* c = fts_children(f, 0); c; c = c->fts_link)
+                if (strcmp(c->fts_name, "l") == 0 || strcmp(c->fts_name, "m") == 0)
+                    fts_set(f, c, FTS_FOLLOW);
+        if (strcmp(e->fts_path, l) == 0)
+            l_info = e->fts_info;
+        if (strcmp(e->fts_path, m) == 0)
+            m_info = e->fts_info;
+        if (strstr(e->fts_path, "/d/l/f"))
+            entered = true;
+    }
+    fts_check(l_info == FTS_D, "FTS_FOLLOW on a listed link stats its target (info %d)", l_info);
+    fts_check(m_info == FTS_SLNONE, "FTS_FOLLOW on a listed dangling link yields FTS_SLNONE (info %d)", m_info);
+    fts_check(entered, "a followed directory link is walked breadth-first");
+    fts_close(f);
+}
+
+static void test_cycles(const struct fts_test_tree* tree) {
+    char* roots[] = {tree->abs_root, NULL};
+    FTS* f = fts_open(roots, FTS_LOGICAL | FTS_BREADTHFIRST, fts_cmp_asc);
+    if (!f)
+        return;
+
+    bool saw_cycle = false, ancestor = true;
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        if (e->fts_info == FTS_DC) {
+            saw_cycle = true;
+            if (!e->fts_cycle || e->fts_cycle->fts_level >= e->fts_level)
+                ancestor = false;
+        }
+    }
+    fts_check(saw_cycle, "symlink loop is detected breadth-first");
+    fts_check(ancestor, "fts_cycle points to a live ancestor");
+    fts_close(f);
+}
+
+static void test_rejections(const struct fts_test_tree* tree) {
+    char* roots[] = {tree->abs_root, NULL};
+    unsigned char buf[256];
+
+    errno = 0;
+    fts_check(fts_open(roots, FTS_PHYSICAL | 0x0800, NULL) == NULL && errno == EINVAL, "unknown option bits rejected");
+
+    FTS* f = fts_open(roots, FTS_PHYSICAL | FTS_BREADTHFIRST, NULL);
+    if (!f)
+        return;
+    fts_read(f);
+    errno = 0;
+    fts_check(fts_checkpoint(f, buf, sizeof(buf)) == -1 && errno == ENOTSUP, "level-order streams cannot checkpoint");
+    fts_close(f);
+}
+
+int main(void) {
+    fts_set_strict_from_env();
+
+    struct fts_test_tree tree;
+    if (fts_test_tree_init(&tree) == -1)
+        return 1;
+    if (build_deep(tree.abs_root) == -1 || fts_build_symlink_loop(tree.abs_root) == -1) {
+        fts_test_tree_cleanup(&tree);
+        return 1;
+    }
+
+    test_level_order(&tree);
+    test_instructions(&tree);
+    test_follow(&tree);
+    test_cycles(&tree);
+    test_rejections(&tree);
+
+    fts_test_tree_cleanup(&tree);
+    return fts_exit_code();
+}
@@ -0,0 +1,196 @@
+#include "test_support.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_STEPS 256
+
+struct step {
+    char path[512];
+    int info;
+};
+
+static size_t record(FTS* f, struct step* out, size_t max) {
+    size_t n = 0;
+    FTSENT* e;
+    while (n < max && (e = fts_read(f)) != NULL) {
+        snprintf(out[n].path, sizeof(out[n].path), "%s", e->fts_path);
+        out[n].info = e->fts_info;
+        n++;
+    }
+    return n;
+}
+
+static int build_deep(const char* root) {
+    char p[1024];
+    const char* dirs[] = {"deep", "deep/one", "deep/one/two", "deep/one/two/three", "deep/side", NULL};
+    for (size_t i = 0; dirs[i]; i++) {
+        snprintf(p, sizeof(p), "%s/%s", root, dirs[i]);
+        if (mkdir(p, 0755) == -1)
+            return -1;
+        snprintf(p, sizeof(p), "%s/%s/f", root, dirs[i]);
+        if (fts_write_file(p, "x\n") == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static void check_every_cut(const char* label, char* const* roots, int opts) {
+    static struct step ref[MAX_STEPS];
+    static struct step rest[MAX_STEPS];
+
+    FTS* f = fts_open(roots, opts, fts_cmp_asc);
+    if (!f) {
+        fts_check(0, "%s: reference walk opens", label);
+        return;
+    }
+    size_t nref = record(f, ref, MAX_STEPS);
+    fts_close(f);
+
+    int bad = 0;
+    for (size_t k = 0; k <= nref && !bad; k++) {
+        f = fts_open(roots, opts, fts_cmp_asc);
+        if (!f) {
+            bad = 1;
+            break;
+        }
+        FTSENT* e = NULL;
+        for (size_t i = 0; i < k; i++)
+            e = fts_read(f);
+        (void)e;
+
+        ssize_t need = fts_checkpoint(f, NULL, 0);
+        unsigned char* buf = need > 0 ? malloc((size_t)need) : NULL;
+        if (!buf || fts_checkpoint(f, buf, (size_t)need) != need) {
+            free(buf);
+            fts_close(f);
+            bad = 1;
+            break;
+        }
+        fts_close(f);
+
+        f = fts_open(roots, opts, fts_cmp_asc);
+        if (!f || fts_resume(f, buf, (size_t)need) != 0) {
+            fts_check(0, "%s: resume after %zu entries (errno %d)", label, k, errno);
+            free(buf);
+            if (f)
+                fts_close(f);
+            bad = 1;
+            break;
+        }
+        free(buf);
+
+        size_t nrest = record(f, rest, MAX_STEPS);
+        if (fts_close(f) != 0) {
+            fts_check(0, "%s: close resumed stream after cut %zu", label, k);
+            bad = 1;
+            break;
+        }
+
+        /* The entry current at checkpoint time is delivered again. */
+        size_t from = k ? k - 1 : 0;
+        if (nrest != nref - from) {
+            fts_check(0, "%s: cut %zu resumed %zu entries, want %zu", label, k, nrest, nref - from);
+            bad = 1;
+            break;
+        }
+        for (size_t i = 0; i < nrest; i++) {
+            if (strcmp(rest[i].path, ref[from + i].path) != 0 || rest[i].info != ref[from + i].info) {
+                fts_check(0, "%s: cut %zu step %zu got %s/%d want %s/%d", label, k, i, rest[i].path, rest[i].info,
+                          ref[from + i].path, ref[from + i].info);
+                bad = 1;
+                break;
+            }
+        }
+    }
+    fts_check(!bad && nref > 10, "%s: every cut of %zu entries resumes in order", label, nref);
+}
+
+static void check_rejections(const struct fts_test_tree* tree) {
+    char* roots[] = {tree->abs_root, NULL};
+    unsigned char buf[4096];
+
+    FTS* f = fts_open(roots, FTS_PHYSICAL, fts_cmp_asc);
+    if (!f)
+        return;
+    errno = 0;
+    fts_check(fts_resume(f, "garbage", 7) == -1 && errno == EINVAL, "malformed checkpoint is rejected");
+
+    /* Stop inside deep/one/two, then swap that directory for a new one. */
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL)
+        if (e->fts_info == FTS_F && strstr(e->fts_path, "deep/one/two/f"))
+            break;
+    ssize_t n = fts_checkpoint(f, buf, sizeof(buf));
+    fts_check(n > 0 && (size_t)n <= sizeof(buf), "checkpoint fits a small buffer (%zd bytes)", n);
+    errno = 0;
+    fts_check(fts_resume(f, buf, (size_t)n) == -1 && errno == EBUSY, "resume needs a fresh stream");
+    fts_close(f);
+
+    f = fts_open(roots, FTS_PHYSICAL | FTS_NOCHDIR, fts_cmp_asc);
+    errno = 0;
+    fts_check(f && fts_resume(f, buf, (size_t)n) == -1 && errno == EINVAL, "option mismatch is rejected");
+    if (f)
+        fts_close(f);
+
+    char old[1024], moved[1024];
+    snprintf(old, sizeof(old), "%s/deep/one", tree->abs_root);
+    snprintf(moved, sizeof(moved), "%s/deep/one.old", tree->abs_root);
+    int swapped = rename(old, moved) == 0 && mkdir(old, 0755) == 0;
+    fts_check(swapped, "replaced an ancestor directory");
+
+    f = fts_open(roots, FTS_PHYSICAL, fts_cmp_asc);
+    errno = 0;
+    fts_check(f && fts_resume(f, buf, (size_t)n) == -1 && errno == ENOENT, "changed ancestor identity fails resume");
+    fts_check(f && fts_read(f) == NULL, "failed resume leaves the stream stopped");
+    if (f)
+        fts_check(fts_close(f) == 0, "failed resume can still be closed");
+
+    if (swapped) {
+        rmdir(old);
+        rename(moved, old);
+    }
+}
+
+int main(void) {
+    fts_set_strict_from_env();
+
+    struct fts_test_tree tree;
+    if (fts_test_tree_init(&tree) == -1)
+        return 1;
+    if (build_deep(tree.abs_root) == -1) {
+        fts_test_tree_cleanup(&tree);
+        return 1;
+    }
+
+    char* roots[] = {tree.abs_root, NULL};
+    check_every_cut("PHYSICAL", roots, FTS_PHYSICAL);
+    check_every_cut("PHYSICAL NOCHDIR", roots, FTS_PHYSICAL | FTS_NOCHDIR);
+    check_every_cut("LOGICAL", roots, FTS_LOGICAL);
+
+    char** two = fts_make_roots(tree.rel_b, tree.rel_a);
+    if (two) {
+        check_every_cut("two roots", two, FTS_PHYSICAL);
+        free(two);
+    }
+
+    /* Loaded roots given with a trailing slash have an empty leaf name. */
+    char slashed[1024], one[1024], side[1024];
+    snprintf(slashed, sizeof(slashed), "%s/", tree.abs_root);
+    snprintf(one, sizeof(one), "%s/deep/one/", tree.abs_root);
+    snprintf(side, sizeof(side), "%s/deep/side/", tree.abs_root);
+    char* slash_root[] = {slashed, NULL};
+    check_every_cut("slash-terminated root", slash_root, FTS_PHYSICAL);
+    check_every_cut("slash-terminated root NOCHDIR", slash_root, FTS_PHYSICAL | FTS_NOCHDIR);
+    char* slash_roots[] = {side, one, slashed, NULL};
+    check_every_cut("slash-terminated roots", slash_roots, FTS_PHYSICAL);
+
+    check_rejections(&tree);
+
+    fts_test_tree_cleanup(&tree);
+    return fts_exit_code();
+}
@@ -1,7 +1,9 @@
 #include "test_support.h"
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 static void test_invalid_flags_and_init_timing(const struct fts_test_tree* tree) {
     char* roots[] = {tree->abs_root, NULL};
@@ -107,6 +109,48 @@ static void test_timing_postorder_and_exhausted(const struct fts_test_tree* tree
     fts_check(fts_close(f) == 0, "matrix: close succeeds after timing checks");
 }
 
+static void test_root_children_nochdir(const struct fts_test_tree* tree) {
+    char* roots[] = {tree->abs_root, NULL};
+    FTS* f = fts_open(roots, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    fts_check(f != NULL, "matrix: fts_open succeeds for root children checks");
+    if (!f)
+        return;
+
+    FTSENT* root = fts_read(f);
+    errno = 0;
+    FTSENT* kids = root ? fts_children(f, 0) : NULL;
+    fts_check(kids != NULL && errno == 0, "matrix: children of a NOCHDIR root are listed");
+    fts_check(root && root->fts_info == FTS_D, "matrix: listing a NOCHDIR root leaves it FTS_D");
+    fts_check(root && strcmp(root->fts_path, tree->abs_root) == 0, "matrix: root path is intact after children");
+
+    int level1 = 0, root_post = 0;
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        if (e->fts_level == 1 && e->fts_info != FTS_DP)
+            ++level1;
+        if (e->fts_level == FTS_ROOTLEVEL && e->fts_info == FTS_DP)
+            root_post = 1;
+    }
+    fts_check(level1 > 0 && root_post, "matrix: walk continues into the listed children");
+    fts_check(fts_close(f) == 0, "matrix: close succeeds after root children checks");
+
+    /* An empty root is left again without a working-directory change. */
+    char empty[] = "/tmp/fts-empty-XXXXXX";
+    if (!mkdtemp(empty)) {
+        fts_check(0, "matrix: create empty root");
+        return;
+    }
+    char* empty_roots[] = {empty, NULL};
+    f = fts_open(empty_roots, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    FTSENT* d = f ? fts_read(f) : NULL;
+    int pre = d && d->fts_info == FTS_D;
+    FTSENT* dp = f ? fts_read(f) : NULL;
+    fts_check(pre && dp && dp->fts_info == FTS_DP, "matrix: empty NOCHDIR root is returned pre- and postorder");
+    if (f)
+        fts_close(f);
+    rmdir(empty);
+}
+
 int main(void) {
     fts_set_strict_from_env();
 
@@ -117,6 +161,7 @@ int main(void) {
     test_invalid_flags_and_init_timing(&tree);
     test_nameonly_behavior(&tree);
     test_timing_postorder_and_exhausted(&tree);
+    test_root_children_nochdir(&tree);
 
     fts_test_tree_cleanup(&tree);
     return fts_exit_code();
@@ -0,0 +1,254 @@
+#include "test_support.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NFILES 12
+#define BIG (300u << 10)
+
+static int build_files(const char* root) {
+    char p[1024];
+    snprintf(p, sizeof(p), "%s/many", root);
+    if (mkdir(p, 0755) == -1)
+        return -1;
+    snprintf(p, sizeof(p), "%s/many/sub", root);
+    if (mkdir(p, 0755) == -1)
+        return -1;
+    for (int i = 0; i < NFILES; i++) {
+        snprintf(p, sizeof(p), "%s/many/f%02d", root, i);
+        char body[64];
+        /* f00 is empty; the rest differ in content and length. */
+        snprintf(body, sizeof(body), "%.*s", i * 3, "file-content-pattern-0123456789abcdefghij");
+        if (fts_write_file(p, body) == -1)
+            return -1;
+    }
+    snprintf(p, sizeof(p), "%s/many/sub/big", root);
+    FILE* f = fopen(p, "w");
+    if (!f)
+        return -1;
+    for (unsigned i = 0; i < BIG; i++)
+        fputc('a' + (int)(i * 7 % 26), f);
+    return fclose(f);
+}
+
+static int open_fds(void) {
+    int n = 0;
+    for (int fd = 0; fd < 1024; fd++)
+        if (fcntl(fd, F_GETFD) != -1)
+            n++;
+    return n;
+}
+
+/* Read the whole file through stdio for comparison. */
+static char* slurp(const char* path, size_t* len) {
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return NULL;
+    size_t cap = 4096, n = 0;
+    char* buf = malloc(cap);
+    size_t got;
+    while (buf && (got = fread(buf + n, 1, cap - n, f)) > 0) {
+        n += got;
+        if (n == cap)
+            buf = realloc(buf, cap *= 2);
+    }
+    fclose(f);
+    *len = n;
+    return buf;
+}
+
+struct result {
+    int files;
+    int chunks;
+    bool match;
+    bool bounded;
+};
+
+static struct result walk(char* const* roots, int opts, int mode, size_t window) {
+    struct result r = {0, 0, true, true};
+    int base = open_fds();
+    FTS* f = fts_open(roots, opts, fts_cmp_asc);
+    if (!f || fts_set_content(f, mode, window) != 0) {
+        r.match = false;
+        if (f)
+            fts_close(f);
+        return r;
+    }
+
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        if (open_fds() > base + (int)window + 3)
+            r.bounded = false;
+        const void* data;
+        if (e->fts_info != FTS_F) {
+            errno = 0;
+            if (fts_content(f, &data) != -1 || errno != EINVAL)
+                r.match = false;
+            continue;
+        }
+        r.files++;
+
+        size_t want_len;
+        char* want = slurp(e->fts_path, &want_len);
+        size_t off = 0;
+        ssize_t n;
+        while ((n = fts_content(f, &data)) > 0) {
+            r.chunks++;
+            if (off + (size_t)n > want_len || memcmp(want + off, data, (size_t)n) != 0)
+                r.match = false;
+            off += (size_t)n;
+        }
+        if (n == -1 || off != want_len)
+            r.match = false;
+        free(want);
+    }
+    if (errno != 0 || fts_close(f) != 0)
+        r.match = false;
+    if (open_fds() != base)
+        r.bounded = false;
+    return r;
+}
+
+static void check_modes(char* const* roots) {
+    static const struct {
+        const char* label;
+        int opts;
+    } walks[] = {
+        {"PHYSICAL", FTS_PHYSICAL},
+        {"NOCHDIR", FTS_PHYSICAL | FTS_NOCHDIR},
+        {"LOGICAL", FTS_LOGICAL},
+        {"BREADTHFIRST", FTS_PHYSICAL | FTS_BREADTHFIRST},
+        {"NOSTAT", FTS_LOGICAL | FTS_NOSTAT},
+    };
+    for (size_t i = 0; i < sizeof(walks) / sizeof(walks[0]); i++) {
+        for (size_t window = 0; window <= 4; window += 4) {
+            struct result m = walk(roots, walks[i].opts, FTS_CONTENT_MMAP, window);
+            fts_check(m.match && m.files > NFILES, "%s window %zu: mapped content matches (%d files)",
+                      walks[i].label, window, m.files);
+            fts_check(m.bounded, "%s window %zu: mapped walk holds a bounded number of files", walks[i].label,
+                      window);
+
+            struct result r = walk(roots, walks[i].opts, FTS_CONTENT_READ, window);
+            fts_check(r.match && r.files == m.files, "%s window %zu: buffered content matches", walks[i].label,
+                      window);
+            fts_check(r.chunks > m.chunks, "%s window %zu: large files are read in several chunks", walks[i].label,
+                      window);
+            fts_check(r.bounded, "%s window %zu: buffered walk holds a bounded number of files", walks[i].label,
+                      window);
+        }
+    }
+}
+
+static void check_skips(char* const* roots) {
+    FTS* f = fts_open(roots, FTS_PHYSICAL, fts_cmp_asc);
+    if (!f || fts_set_content(f, FTS_CONTENT_READ, 3) != 0) {
+        fts_check(0, "open stream for skip checks");
+        if (f)
+            fts_close(f);
+        return;
+    }
+
+    bool ok = true;
+    int seen = 0;
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        if (e->fts_info != FTS_F || !strstr(e->fts_path, "/many/f"))
+            continue;
+        seen++;
+        /* Skip the next file, which is already open ahead. */
+        if (e->fts_link && e->fts_link->fts_info == FTS_F)
+            fts_set(f, e->fts_link, FTS_SKIP);
+        const void* data;
+        ssize_t n = fts_content(f, &data);
+        size_t want_len;
+        char* want = slurp(e->fts_path, &want_len);
+        if (n < 0 || (size_t)n != want_len || (n && memcmp(want, data, (size_t)n) != 0))
+            ok = false;
+        free(want);
+    }
+    fts_check(ok && seen == NFILES / 2, "skipped files do not disturb the window (%d seen)", seen);
+    fts_check(fts_close(f) == 0, "close skip-check stream");
+}
+
+/* Under FTS_NOSTAT there is no stat buffer; regular roots are still
+   delivered, and listed files are skipped or opened without read-ahead. */
+static void check_nostat(char* const* roots) {
+    char file[1024], big[1024];
+    snprintf(file, sizeof(file), "%s/many/f07", roots[0]);
+    snprintf(big, sizeof(big), "%s/many/sub/big", roots[0]);
+    char* files[] = {file, big, NULL};
+
+    for (size_t window = 0; window <= 2; window += 2) {
+        struct result m = walk(files, FTS_PHYSICAL | FTS_NOSTAT, FTS_CONTENT_MMAP, window);
+        fts_check(m.match && m.files == 2 && m.bounded, "NOSTAT window %zu: mapped file roots", window);
+        struct result r = walk(files, FTS_PHYSICAL | FTS_NOSTAT, FTS_CONTENT_READ, window);
+        fts_check(r.match && r.files == 2 && r.bounded, "NOSTAT window %zu: buffered file roots", window);
+        struct result t = walk(roots, FTS_PHYSICAL | FTS_NOSTAT, FTS_CONTENT_MMAP, window);
+        fts_check(t.match && t.bounded, "NOSTAT window %zu: unstatted entries are refused", window);
+    }
+}
+
+static void check_errors(char* const* roots) {
+    FTS* f = fts_open(roots, FTS_PHYSICAL, NULL);
+    if (!f)
+        return;
+    const void* data;
+    errno = 0;
+    fts_check(fts_set_content(f, 7, 1) == -1 && errno == EINVAL, "unknown content mode is rejected");
+    fts_read(f);
+    errno = 0;
+    fts_check(fts_content(f, &data) == -1 && errno == EINVAL, "fts_content needs the stage enabled");
+    fts_check(fts_set_content(f, FTS_CONTENT_MMAP, 2) == 0 && fts_set_content(f, 0, 0) == 0,
+              "the stage can be enabled and disabled mid-walk");
+    fts_close(f);
+
+    /* A file replaced after it was listed is not delivered. */
+    char path[1024], tmp[1024];
+    snprintf(path, sizeof(path), "%s/many/f05", roots[0]);
+    snprintf(tmp, sizeof(tmp), "%s/many/f05.new", roots[0]);
+    f = fts_open(roots, FTS_PHYSICAL | FTS_NOCHDIR, fts_cmp_asc);
+    if (!f || fts_set_content(f, FTS_CONTENT_READ, 0) != 0) {
+        if (f)
+            fts_close(f);
+        return;
+    }
+    FTSENT* e;
+    bool replaced = false, refused = false;
+    while ((e = fts_read(f)) != NULL) {
+        if (e->fts_info == FTS_F && strcmp(e->fts_name, "f04") == 0)
+            replaced = fts_write_file(tmp, "other\n") == 0 && rename(tmp, path) == 0;
+        if (e->fts_info == FTS_F && strcmp(e->fts_name, "f05") == 0) {
+            errno = 0;
+            refused = fts_content(f, &data) == -1 && errno == ENOENT;
+        }
+    }
+    fts_check(replaced && refused, "a file replaced after its stat is refused");
+    fts_close(f);
+}
+
+int main(void) {
+    fts_set_strict_from_env();
+
+    struct fts_test_tree tree;
+    if (fts_test_tree_init(&tree) == -1)
+        return 1;
+    if (build_files(tree.abs_root) == -1) {
+        fts_test_tree_cleanup(&tree);
+        return 1;
+    }
+
+    char* roots[] = {tree.abs_root, NULL};
+    check_modes(roots);
+    check_skips(roots);
+    check_nostat(roots);
+    check_errors(roots);
+
+    fts_test_tree_cleanup(&tree);
+    return fts_exit_code();
+}
@@ -0,0 +1,99 @@
+extern "C" {
+#include "test_support.h"
+}
+
+#include "musl-bsd/fts.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+static_assert(std::input_iterator<musl_bsd::fts_stream::iterator>);
+static_assert(std::ranges::input_range<musl_bsd::fts_stream&>);
+static_assert(!std::is_copy_constructible_v<musl_bsd::fts_stream>);
+static_assert(std::is_nothrow_move_constructible_v<musl_bsd::fts_stream>);
+
+static std::vector<std::string> c_walk(const char* root) {
+    std::vector<std::string> out;
+    char* roots[] = {const_cast<char*>(root), nullptr};
+    FTS* f = fts_open(roots, FTS_PHYSICAL, fts_cmp_asc);
+    if (!f)
+        return out;
+    while (FTSENT* e = fts_read(f))
+        out.emplace_back(e->fts_path);
+    fts_close(f);
+    return out;
+}
+
+int main() {
+    fts_set_strict_from_env();
+
+    struct fts_test_tree tree;
+    if (fts_test_tree_init(&tree) == -1)
+        return 1;
+
+    /* Roots are sliced out of a larger buffer, so none is NUL-terminated. */
+    std::string joined = std::string(tree.abs_root) + "|" + tree.abs_root + "/a";
+    std::string_view all(joined);
+    std::string_view roots[] = {all.substr(0, all.find('|')), all.substr(all.find('|') + 1)};
+
+    std::vector<std::string> want = c_walk(tree.abs_root);
+    std::vector<std::string> want_a = c_walk((std::string(tree.abs_root) + "/a").c_str());
+    want.insert(want.end(), want_a.begin(), want_a.end());
+
+    try {
+        musl_bsd::fts_stream s(roots, FTS_PHYSICAL, fts_cmp_asc);
+        std::vector<std::string> got;
+        for (FTSENT& e : s)
+            got.emplace_back(e.fts_path);
+        fts_check(got == want, "range-for matches the C API walk (%zu entries)", got.size());
+        fts_check(!s.error(), "completed walk reports no error");
+        fts_check(!s.close(), "explicit close succeeds");
+        fts_check(!s, "closed handle is empty");
+    }
+    catch (const std::system_error& e) {
+        fts_check(0, "fts_stream opens: %s", e.what());
+    }
+
+    try {
+        musl_bsd::fts_stream s(std::span<const std::string_view>(roots, 1), FTS_PHYSICAL | FTS_NOCHDIR, fts_cmp_asc);
+        auto files = std::ranges::count_if(s, [](const FTSENT& e) { return e.fts_info == FTS_F; });
+        fts_check(files > 0, "std::ranges::count_if over the stream (%td files)", files);
+
+        musl_bsd::fts_stream t(std::span<const std::string_view>(roots, 1), FTS_PHYSICAL, fts_cmp_asc);
+        auto dirs = t | std::views::filter([](const FTSENT& e) { return e.fts_info == FTS_D; }) |
+                    std::views::transform([](const FTSENT& e) { return std::string(e.fts_name); });
+        auto it = std::ranges::begin(dirs);
+        fts_check(it != std::ranges::end(dirs), "views compose over the stream");
+
+        /* Moving mid-walk keeps the position. */
+        FTSENT* before = t.begin().operator->();
+        musl_bsd::fts_stream moved(std::move(t));
+        fts_check(!t && moved, "moved-from handle is empty");
+        fts_check(moved.begin().operator->() == before, "moved handle continues from the same entry");
+    }
+    catch (const std::system_error& e) {
+        fts_check(0, "fts_stream opens: %s", e.what());
+    }
+
+    std::string_view missing[] = {std::string_view("")};
+    bool threw = false;
+    try {
+        musl_bsd::fts_stream s(missing, FTS_PHYSICAL);
+    }
+    catch (const std::system_error& e) {
+        threw = e.code() == std::errc::no_such_file_or_directory;
+    }
+    fts_check(threw, "open failure throws std::system_error with errno");
+
+    fts_test_tree_cleanup(&tree);
+    return fts_exit_code();
+}
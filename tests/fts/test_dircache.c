@@ -0,0 +1,171 @@
+#include "test_support.h"
+#include "musl-bsd/fts_ops.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_STEPS 512
+
+static int dotdot_opens;
+static int live_fds;
+static int max_live_fds;
+
+static int tracking_open(const char* path, int flags) {
+    int fd = open(path, flags);
+    if (fd != -1) {
+        if (strcmp(path, "..") == 0)
+            dotdot_opens++;
+        if (++live_fds > max_live_fds)
+            max_live_fds = live_fds;
+    }
+    return fd;
+}
+
+static int tracking_close(int fd) {
+    int rc = close(fd);
+    if (rc == 0)
+        live_fds--;
+    return rc;
+}
+
+static int tracking_closedir(DIR* d) {
+    int rc = closedir(d);
+    if (rc == 0)
+        live_fds--;
+    return rc;
+}
+
+static const struct fts_ops tracking_ops = {
+    .open_fn = tracking_open,
+    .close_fn = tracking_close,
+    .fstat_fn = fstat,
+    .fstatat_fn = fstatat,
+    .fchdir_fn = fchdir,
+    .fdopendir_fn = fdopendir,
+    .readdir_fn = readdir,
+    .closedir_fn = tracking_closedir
+};
+
+extern const struct fts_ops* __fts_ops_override;
+
+struct walk {
+    char paths[MAX_STEPS][256];
+    int info[MAX_STEPS];
+    size_t n;
+    int dotdot;
+    int max_fds;
+    int balance;
+};
+
+/* wide/NN/inner/leaf: every NN ascends back into wide. */
+static int build_wide(const char* root) {
+    char p[1024];
+    snprintf(p, sizeof(p), "%s/wide", root);
+    if (mkdir(p, 0755) == -1)
+        return -1;
+    for (int i = 0; i < 12; i++) {
+        snprintf(p, sizeof(p), "%s/wide/%02d", root, i);
+        if (mkdir(p, 0755) == -1)
+            return -1;
+        snprintf(p, sizeof(p), "%s/wide/%02d/inner", root, i);
+        if (mkdir(p, 0755) == -1)
+            return -1;
+        snprintf(p, sizeof(p), "%s/wide/%02d/inner/leaf", root, i);
+        if (fts_write_file(p, "x\n") == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static void run(char* const* roots, size_t budget, struct walk* w) {
+    memset(w, 0, sizeof(*w));
+    dotdot_opens = live_fds = max_live_fds = 0;
+    __fts_ops_override = &tracking_ops;
+
+    FTS* f = fts_open(roots, FTS_PHYSICAL, fts_cmp_asc);
+    if (f) {
+        fts_check(fts_set_dircache(f, budget) == 0, "set dircache budget %zu", budget);
+        FTSENT* e;
+        while ((e = fts_read(f)) != NULL && w->n < MAX_STEPS) {
+            snprintf(w->paths[w->n], sizeof(w->paths[w->n]), "%s", e->fts_path);
+            w->info[w->n++] = e->fts_info;
+        }
+        fts_check(errno == 0, "budget %zu walk completes", budget);
+        fts_close(f);
+    }
+
+    __fts_ops_override = NULL;
+    w->dotdot = dotdot_opens;
+    w->max_fds = max_live_fds;
+    w->balance = live_fds;
+}
+
+static bool same_walk(const struct walk* a, const struct walk* b) {
+    if (a->n != b->n)
+        return false;
+    for (size_t i = 0; i < a->n; i++)
+        if (strcmp(a->paths[i], b->paths[i]) != 0 || a->info[i] != b->info[i])
+            return false;
+    return true;
+}
+
+int main(void) {
+    fts_set_strict_from_env();
+
+    struct fts_test_tree tree;
+    if (fts_test_tree_init(&tree) == -1)
+        return 1;
+    if (build_wide(tree.abs_root) == -1) {
+        fts_test_tree_cleanup(&tree);
+        return 1;
+    }
+
+    char* roots[] = {tree.abs_root, NULL};
+    static struct walk off, small, big;
+    run(roots, 0, &off);
+    run(roots, 1, &small);
+    run(roots, 64, &big);
+
+    fts_check(off.n > 40, "reference walk saw %zu entries", off.n);
+    fts_check(same_walk(&off, &small) && same_walk(&off, &big), "cached walks match the uncached walk");
+    /* Only the first of the twelve ascents into wide has to open "..". */
+    fts_check(off.dotdot - big.dotdot >= 11, "cache avoids re-opening \"..\" (%d vs %d)", big.dotdot, off.dotdot);
+    fts_check(small.dotdot <= off.dotdot, "a one-fd budget never opens more");
+    fts_check(small.max_fds <= off.max_fds + 1, "budget bounds held descriptors (%d vs %d)", small.max_fds, off.max_fds);
+    fts_check(off.balance == 0 && small.balance == 0 && big.balance == 0, "fts_close releases cached descriptors");
+
+    /* Shrinking the budget mid-walk evicts straight away. */
+    dotdot_opens = live_fds = max_live_fds = 0;
+    __fts_ops_override = &tracking_ops;
+    FTS* f = fts_open(roots, FTS_PHYSICAL, fts_cmp_asc);
+    if (f) {
+        fts_set_dircache(f, 64);
+        FTSENT* e;
+        int before = 0;
+        while ((e = fts_read(f)) != NULL)
+            if (e->fts_info == FTS_DP && strcmp(e->fts_name, "05") == 0) {
+                before = live_fds;
+                break;
+            }
+        fts_set_dircache(f, 0);
+        fts_check(before > live_fds, "lowering the budget closes cached fds (%d -> %d)", before, live_fds);
+        while (fts_read(f) != NULL)
+            ;
+        fts_close(f);
+        fts_check(live_fds == 0, "no descriptors outlive the stream");
+    }
+    __fts_ops_override = NULL;
+
+    errno = 0;
+    fts_check(fts_set_dircache(NULL, 4) == -1 && errno == EINVAL, "NULL stream is rejected");
+
+    fts_test_tree_cleanup(&tree);
+    return fts_exit_code();
+}
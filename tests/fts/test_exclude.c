@@ -0,0 +1,166 @@
+#include "test_support.h"
+#include "musl-bsd/fts_ops.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static int excluded_touches;
+
+static bool names_excluded(const char* path) {
+    const char* leaf = strrchr(path, '/');
+    leaf = leaf ? leaf + 1 : path;
+    return strcmp(leaf, "a") == 0 || strcmp(leaf, "file2") == 0 || strcmp(leaf, "7") == 0;
+}
+
+static int counting_open(const char* path, int flags) {
+    if (names_excluded(path))
+        excluded_touches++;
+    return open(path, flags);
+}
+
+static int counting_fstatat(int dfd, const char* path, struct stat* st, int flags) {
+    if (names_excluded(path))
+        excluded_touches++;
+    return fstatat(dfd, path, st, flags);
+}
+
+static const struct fts_ops counting_ops = {
+    .open_fn = counting_open,
+    .close_fn = close,
+    .fstat_fn = fstat,
+    .fstatat_fn = counting_fstatat,
+    .fchdir_fn = fchdir,
+    .fdopendir_fn = fdopendir,
+    .readdir_fn = readdir,
+    .closedir_fn = closedir
+};
+
+extern const struct fts_ops* __fts_ops_override;
+
+struct seen {
+    bool a;
+    bool a_file1;
+    bool b;
+    bool b_file2;
+    bool many_7;
+    bool many_8;
+    size_t total;
+};
+
+static void walk(FTS* f, struct seen* s) {
+    memset(s, 0, sizeof(*s));
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        if (e->fts_info == FTS_DP)
+            continue;
+        s->total++;
+        const char* parent = e->fts_parent ? e->fts_parent->fts_name : "";
+        if (strcmp(e->fts_name, "a") == 0)
+            s->a = true;
+        else if (strcmp(e->fts_name, "file1") == 0)
+            s->a_file1 = true;
+        else if (strcmp(e->fts_name, "b") == 0)
+            s->b = true;
+        else if (strcmp(e->fts_name, "file2") == 0)
+            s->b_file2 = true;
+        else if (strcmp(parent, "many") == 0 && strcmp(e->fts_name, "7") == 0)
+            s->many_7 = true;
+        else if (strcmp(parent, "many") == 0 && strcmp(e->fts_name, "8") == 0)
+            s->many_8 = true;
+    }
+}
+
+static void test_absolute(const struct fts_test_tree* tree) {
+    char* roots[] = {tree->abs_root, NULL};
+    char path[4096];
+
+    FTS* f = fts_open(roots, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    fts_check(f != NULL, "fts_open for absolute exclusions");
+    if (!f)
+        return;
+
+    snprintf(path, sizeof(path), "%s/a", tree->abs_root);
+    fts_check(fts_exclude(f, path) == 0, "exclude directory a");
+    snprintf(path, sizeof(path), "%s//b/./file2", tree->abs_root);
+    fts_check(fts_exclude(f, path) == 0, "exclude un-normalized file path");
+    snprintf(path, sizeof(path), "%s/a/file1", tree->abs_root);
+    fts_check(fts_exclude(f, path) == 0, "path below an exclusion is absorbed");
+    snprintf(path, sizeof(path), "%s/many/7", tree->abs_root);
+    fts_check(fts_exclude(f, path) == 0, "exclude one of many siblings");
+    /* A large set sharing a long prefix exercises edge splitting. */
+    for (int i = 0; i < 2000; i++) {
+        snprintf(path, sizeof(path), "%s/many/missing/%d/deep/leaf", tree->abs_root, i);
+        if (fts_exclude(f, path) != 0) {
+            fts_check(0, "bulk exclusion %d", i);
+            break;
+        }
+    }
+
+    excluded_touches = 0;
+    __fts_ops_override = &counting_ops;
+    struct seen s;
+    walk(f, &s);
+    __fts_ops_override = NULL;
+
+    fts_check(!s.a && !s.a_file1, "excluded directory and its subtree are not returned");
+    fts_check(s.b && !s.b_file2, "excluded file is dropped while its directory is walked");
+    fts_check(!s.many_7 && s.many_8, "only the excluded sibling is pruned");
+    fts_check(excluded_touches == 0, "excluded entries are never opened or stat'ed");
+
+    errno = 0;
+    fts_check(fts_exclude(f, path) == -1 && errno == EBUSY, "exclusions are frozen once reading started");
+    fts_close(f);
+}
+
+static void test_relative_and_roots(const struct fts_test_tree* tree) {
+    int cwd = open(".", O_RDONLY | O_DIRECTORY);
+    fts_check(cwd != -1 && chdir(tree->abs_root) == 0, "chdir into tree");
+
+    char* roots[] = {".", "a", "b", NULL};
+    FTS* f = fts_open(roots, FTS_PHYSICAL, NULL);
+    fts_check(f != NULL, "fts_open for relative exclusions");
+    if (f) {
+        fts_check(fts_exclude(f, "./a") == 0, "exclude relative directory");
+        fts_check(fts_exclude(f, "b/file2") == 0, "exclude relative file");
+        errno = 0;
+        fts_check(fts_exclude(f, "") == -1 && errno == EINVAL, "empty exclusion is rejected");
+
+        struct seen s;
+        walk(f, &s);
+        fts_check(!s.a && !s.a_file1, "excluded root and subtree are skipped");
+        fts_check(s.b && !s.b_file2, "relative file exclusion applies");
+        fts_check(s.many_7 && s.many_8, "unrelated entries are walked");
+        fts_close(f);
+    }
+
+    if (cwd != -1) {
+        fts_check(fchdir(cwd) == 0, "restore cwd");
+        close(cwd);
+    }
+}
+
+int main(void) {
+    fts_set_strict_from_env();
+
+    struct fts_test_tree tree;
+    if (fts_test_tree_init(&tree) == -1)
+        return 1;
+    if (fts_build_many(tree.abs_root, "many", 10) == -1) {
+        fts_test_tree_cleanup(&tree);
+        return 1;
+    }
+
+    test_absolute(&tree);
+    test_relative_and_roots(&tree);
+
+    fts_test_tree_cleanup(&tree);
+    return fts_exit_code();
+}
@@ -0,0 +1,207 @@
+#include "test_support.h"
+#include "musl-bsd/fts_ops.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NLINKS 8
+#define NVIEWS 3
+
+/* real/ holds NLINKS links, every other one dangling; views/vN are
+   symlinks to real/, so a logical walk lists real/ NVIEWS + 1 times. */
+static int build_farm(const char* root) {
+    char p[1024], t[64];
+    const char* dirs[] = {"target", "real", "views", NULL};
+    for (size_t i = 0; dirs[i]; i++) {
+        snprintf(p, sizeof(p), "%s/%s", root, dirs[i]);
+        if (mkdir(p, 0755) == -1)
+            return -1;
+    }
+    for (int i = 0; i < NLINKS; i++) {
+        snprintf(p, sizeof(p), "%s/target/t%d", root, i);
+        if (i % 2 == 0 && fts_write_file(p, i ? "target data\n" : "x\n") == -1)
+            return -1;
+        snprintf(t, sizeof(t), "../target/t%d", i);
+        snprintf(p, sizeof(p), "%s/real/lnk%d", root, i);
+        if (symlink(t, p) == -1)
+            return -1;
+    }
+    for (int i = 0; i < NVIEWS; i++) {
+        snprintf(p, sizeof(p), "%s/views/v%d", root, i);
+        if (symlink("../real", p) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static int lnk_stats;
+
+static int c_fstatat(void* ctx, int dfd, const char* path, struct stat* st, int flags) {
+    (void)ctx;
+    if (strstr(path, "lnk"))
+        lnk_stats++;
+    return fstatat(dfd, path, st, flags);
+}
+
+static int c_open(void* ctx, const char* path, int flags) {
+    (void)ctx;
+    return open(path, flags);
+}
+
+static int c_close(void* ctx, int fd) {
+    (void)ctx;
+    return close(fd);
+}
+
+static int c_fstat(void* ctx, int fd, struct stat* st) {
+    (void)ctx;
+    return fstat(fd, st);
+}
+
+static int c_fchdir(void* ctx, int fd) {
+    (void)ctx;
+    return fchdir(fd);
+}
+
+static DIR* c_fdopendir(void* ctx, int fd) {
+    (void)ctx;
+    return fdopendir(fd);
+}
+
+static struct dirent* c_readdir(void* ctx, DIR* d) {
+    (void)ctx;
+    return readdir(d);
+}
+
+static int c_closedir(void* ctx, DIR* d) {
+    (void)ctx;
+    return closedir(d);
+}
+
+static int c_dirfd(void* ctx, DIR* d) {
+    (void)ctx;
+    return dirfd(d);
+}
+
+static const struct fts_backend counting_backend = {.open_fn = c_open,
+                                                    .close_fn = c_close,
+                                                    .fstat_fn = c_fstat,
+                                                    .fstatat_fn = c_fstatat,
+                                                    .fchdir_fn = c_fchdir,
+                                                    .fdopendir_fn = c_fdopendir,
+                                                    .readdir_fn = c_readdir,
+                                                    .closedir_fn = c_closedir,
+                                                    .dirfd_fn = c_dirfd};
+
+struct seen {
+    int info;
+    long long size;
+    unsigned long long ino;
+    int copies;
+};
+
+static void check_logical(const char* root) {
+    char* roots[] = {(char*)root, NULL};
+    static struct seen seen[NLINKS];
+    memset(seen, 0, sizeof(seen));
+
+    lnk_stats = 0;
+    FTS* f = fts_open_with_ops(roots, FTS_LOGICAL, fts_cmp_asc, &counting_backend, NULL);
+    if (!f) {
+        fts_check(0, "open logical walk");
+        return;
+    }
+    bool consistent = true;
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        int i;
+        if (sscanf(e->fts_name, "lnk%d", &i) != 1 || i < 0 || i >= NLINKS)
+            continue;
+        struct seen* s = &seen[i];
+        long long size = (long long)e->fts_statp->st_size;
+        unsigned long long ino = (unsigned long long)e->fts_statp->st_ino;
+        if (s->copies && (s->info != e->fts_info || s->size != size || s->ino != ino))
+            consistent = false;
+        s->info = e->fts_info;
+        s->size = size;
+        s->ino = ino;
+        s->copies++;
+    }
+    fts_check(errno == 0 && fts_close(f) == 0, "logical walk over the farm completes");
+
+    bool classified = true, listed = true;
+    for (int i = 0; i < NLINKS; i++) {
+        if (seen[i].copies != NVIEWS + 1)
+            listed = false;
+        if (seen[i].info != (i % 2 ? FTS_SLNONE : FTS_F))
+            classified = false;
+    }
+    fts_check(listed, "each link is reached through every view");
+    fts_check(classified, "resolved links are FTS_F and dangling ones FTS_SLNONE");
+    fts_check(consistent, "every view reports the same stat data");
+    fts_check(lnk_stats == NLINKS + NLINKS / 2, "each link is resolved once per stream (%d lookups)", lnk_stats);
+}
+
+static void check_again(const char* root) {
+    char* roots[] = {(char*)root, NULL};
+    lnk_stats = 0;
+    FTS* f = fts_open_with_ops(roots, FTS_LOGICAL, fts_cmp_asc, &counting_backend, NULL);
+    if (!f)
+        return;
+    int again = 0;
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        /* Restat resolved links under the last view a few times. */
+        if (strstr(e->fts_path, "/v2/lnk") && e->fts_info == FTS_F && again < NLINKS / 2 &&
+            e->fts_instr == FTS_NOINSTR) {
+            fts_set(f, e, FTS_AGAIN);
+            again++;
+        }
+    }
+    fts_close(f);
+    fts_check(again == NLINKS / 2 && lnk_stats == NLINKS + NLINKS / 2 + again,
+              "FTS_AGAIN bypasses the cache (%d lookups)", lnk_stats);
+}
+
+static void check_physical(const char* root) {
+    char* roots[] = {(char*)root, NULL};
+    lnk_stats = 0;
+    FTS* f = fts_open_with_ops(roots, FTS_PHYSICAL, fts_cmp_asc, &counting_backend, NULL);
+    if (!f)
+        return;
+    int links = 0;
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL)
+        if (e->fts_info == FTS_SL && strncmp(e->fts_name, "lnk", 3) == 0)
+            links++;
+    fts_close(f);
+    fts_check(links == NLINKS && lnk_stats == NLINKS, "physical walks still lstat each link once");
+}
+
+int main(void) {
+    fts_set_strict_from_env();
+
+    struct fts_test_tree tree;
+    if (fts_test_tree_init(&tree) == -1)
+        return 1;
+    char root[1024];
+    snprintf(root, sizeof(root), "%s/farm", tree.abs_root);
+    if (mkdir(root, 0755) == -1 || build_farm(root) == -1) {
+        fts_test_tree_cleanup(&tree);
+        return 1;
+    }
+
+    check_logical(root);
+    check_again(root);
+    check_physical(root);
+
+    fts_test_tree_cleanup(&tree);
+    return fts_exit_code();
+}
@@ -0,0 +1,283 @@
+#include "test_support.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#ifndef FS_IOC_GETFLAGS
+#define FS_IOC_GETFLAGS _IOR('f', 1, long)
+#endif
+
+#define NFILES 6
+
+static bool have_xattrs;
+
+static int build_tree(const char* root) {
+    char p[1024], v[2000];
+    snprintf(p, sizeof(p), "%s/meta", root);
+    if (mkdir(p, 0755) == -1)
+        return -1;
+    snprintf(p, sizeof(p), "%s/meta/sub", root);
+    if (mkdir(p, 0755) == -1)
+        return -1;
+    have_xattrs = setxattr(p, "user.dir", "d", 1, 0) == 0;
+
+    for (int i = 0; i < NFILES; i++) {
+        snprintf(p, sizeof(p), "%s/meta/%s%d", root, i % 2 ? "sub/g" : "f", i);
+        if (fts_write_file(p, "data\n") == -1)
+            return -1;
+        /* Values of varying length, one far past a small buffer. */
+        memset(v, 'a' + i, sizeof(v));
+        for (int k = 0; have_xattrs && k <= i; k++) {
+            char name[32];
+            size_t len = i == 3 && k == 0 ? sizeof(v) : (size_t)(i * 5 + k);
+            snprintf(name, sizeof(name), "user.k%d", k);
+            if (setxattr(p, name, v, len, 0) == -1)
+                return -1;
+        }
+    }
+    snprintf(p, sizeof(p), "%s/meta/fifo", root);
+    if (mkfifo(p, 0644) == -1)
+        return -1;
+    snprintf(p, sizeof(p), "%s/meta/link", root);
+    return symlink("f0", p);
+}
+
+static int open_fds(void) {
+    int n = 0;
+    for (int fd = 0; fd < 1024; fd++)
+        if (fcntl(fd, F_GETFD) != -1)
+            n++;
+    return n;
+}
+
+/* Compare against attributes read by path. */
+static bool same_xattrs(const char* path, int follow, const struct fts_meta* m) {
+    char names[8192], value[8192];
+    ssize_t len = follow ? listxattr(path, names, sizeof(names)) : llistxattr(path, names, sizeof(names));
+    if (len == -1)
+        return m->xattr_errno == errno && m->nxattrs == 0;
+    if (m->xattr_errno != 0)
+        return false;
+
+    size_t n = 0;
+    for (ssize_t i = 0; i < len; i += (ssize_t)strlen(names + i) + 1, n++) {
+        const char* name = names + i;
+        ssize_t size = follow ? getxattr(path, name, value, sizeof(value)) : lgetxattr(path, name, value, sizeof(value));
+        bool found = false;
+        for (size_t j = 0; j < m->nxattrs; j++)
+            if (strcmp(m->xattrs[j].name, name) == 0 && m->xattrs[j].size == (size_t)size &&
+                memcmp(m->xattrs[j].value, value, (size_t)size) == 0)
+                found = true;
+        if (!found)
+            return false;
+    }
+    return n == m->nxattrs;
+}
+
+static bool same_flags(const char* path, const struct stat* st, const struct fts_meta* m) {
+    if (!S_ISREG(st->st_mode) && !S_ISDIR(st->st_mode))
+        return m->flags_errno == ENOTTY;
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+        return m->flags_errno == errno;
+    int flags, rc = ioctl(fd, FS_IOC_GETFLAGS, &flags), err = errno;
+    close(fd);
+    return rc == 0 ? m->flags_errno == 0 && m->flags == (unsigned int)flags : m->flags_errno == err;
+}
+
+struct result {
+    int entries;
+    int user; /* user.* attributes seen */
+    bool match;
+};
+
+static struct result walk(char* const* roots, int opts, int what) {
+    struct result r = {0, 0, true};
+    FTS* f = fts_open(roots, opts, fts_cmp_asc);
+    if (!f || fts_set_meta(f, what) != 0) {
+        r.match = false;
+        if (f)
+            fts_close(f);
+        return r;
+    }
+
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        struct fts_meta m;
+        if (e->fts_info == FTS_DP)
+            continue;
+        if (fts_meta(f, e, &m) != 0) {
+            r.match = false;
+            continue;
+        }
+        r.entries++;
+        for (size_t i = 0; i < m.nxattrs; i++)
+            if (strncmp(m.xattrs[i].name, "user.", 5) == 0)
+                r.user++;
+        int follow = (opts & FTS_LOGICAL) && e->fts_info != FTS_SLNONE;
+        if ((what & FTS_META_XATTR) ? !same_xattrs(e->fts_path, follow, &m) : m.xattr_errno != ENODATA)
+            r.match = false;
+        if ((what & FTS_META_FLAGS) ? !same_flags(e->fts_path, e->fts_statp, &m) : m.flags_errno != ENODATA)
+            r.match = false;
+    }
+    if (errno != 0 || fts_close(f) != 0)
+        r.match = false;
+    return r;
+}
+
+static void check_modes(char* const* roots) {
+    static const struct {
+        const char* label;
+        int opts;
+    } walks[] = {
+        {"PHYSICAL", FTS_PHYSICAL},
+        {"NOCHDIR", FTS_PHYSICAL | FTS_NOCHDIR},
+        {"LOGICAL", FTS_LOGICAL},
+        {"BREADTHFIRST", FTS_PHYSICAL | FTS_BREADTHFIRST},
+    };
+    /* 1 + 3 + 5 from the even files, 2 + 4 + 6 from the odd ones. */
+    const int user = have_xattrs ? 1 + 3 + 5 + 2 + 4 + 6 + 1 : 0;
+    for (size_t i = 0; i < sizeof(walks) / sizeof(walks[0]); i++) {
+        int base = open_fds();
+        struct result r = walk(roots, walks[i].opts, FTS_META_XATTR | FTS_META_FLAGS);
+        int expect = user + ((walks[i].opts & FTS_LOGICAL) && have_xattrs ? 1 : 0);
+        fts_check(r.match && r.entries == NFILES + 4, "%s: metadata matches path lookups (%d entries)", walks[i].label,
+                  r.entries);
+        fts_check(r.user == expect, "%s: every user attribute is collected (%d)", walks[i].label, r.user);
+        fts_check(open_fds() == base, "%s: no descriptors are left open", walks[i].label);
+    }
+
+    struct result x = walk(roots, FTS_PHYSICAL, FTS_META_XATTR);
+    struct result fl = walk(roots, FTS_PHYSICAL, FTS_META_FLAGS);
+    fts_check(x.match && fl.match && fl.user == 0, "each part of the stage can be requested alone");
+}
+
+static void check_children(char* const* roots) {
+    FTS* f = fts_open(roots, FTS_PHYSICAL, fts_cmp_asc);
+    if (!f || fts_set_meta(f, FTS_META_XATTR) != 0) {
+        fts_check(0, "open stream for child checks");
+        if (f)
+            fts_close(f);
+        return;
+    }
+
+    bool ok = true;
+    int listed = 0;
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        if (e->fts_info != FTS_D || strcmp(e->fts_name, "sub") != 0)
+            continue;
+        /* Records stay valid while the whole list is held. */
+        for (FTSENT* c = fts_children(f, 0); c; c = c->fts_link) {
+            char path[1024];
+            struct fts_meta m;
+            snprintf(path, sizeof(path), "%s/sub/%s", roots[0], c->fts_name);
+            if (fts_meta(f, c, &m) != 0 || !same_xattrs(path, 0, &m))
+                ok = false;
+            listed++;
+        }
+    }
+    fts_check(ok && listed == NFILES / 2, "fts_children() entries carry their records (%d)", listed);
+    fts_check(fts_close(f) == 0, "close child-check stream");
+}
+
+/* Under FTS_NOSTAT entries are not stat'ed, so the type comes from d_type;
+   records are still collected as each directory is read. */
+static void check_nostat(char* const* roots) {
+    static const int modes[] = {FTS_PHYSICAL | FTS_NOSTAT, FTS_PHYSICAL | FTS_NOSTAT | FTS_NOCHDIR,
+                                FTS_LOGICAL | FTS_NOSTAT};
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        FTS* f = fts_open(roots, modes[i], fts_cmp_asc);
+        if (!f || fts_set_meta(f, FTS_META_XATTR | FTS_META_FLAGS) != 0) {
+            fts_check(0, "open NOSTAT stream (mode %#x)", modes[i]);
+            if (f)
+                fts_close(f);
+            continue;
+        }
+
+        bool ok = true;
+        int entries = 0, user = 0, listed = 0;
+        FTSENT* e;
+        while ((e = fts_read(f)) != NULL) {
+            if (e->fts_info == FTS_DP)
+                continue;
+            int follow = (modes[i] & FTS_LOGICAL) && e->fts_info != FTS_SLNONE;
+            struct stat st;
+            struct fts_meta m;
+            if (fts_meta(f, e, &m) != 0 || (follow ? stat(e->fts_path, &st) : lstat(e->fts_path, &st)) != 0 ||
+                !same_xattrs(e->fts_path, follow, &m) || !same_flags(e->fts_path, &st, &m)) {
+                ok = false;
+                continue;
+            }
+            entries++;
+            for (size_t k = 0; k < m.nxattrs; k++)
+                if (strncmp(m.xattrs[k].name, "user.", 5) == 0)
+                    user++;
+            if (e->fts_info == FTS_D && strcmp(e->fts_name, "sub") == 0) {
+                /* Listed entries are not current, so only a record made
+                   while reading the directory can answer. */
+                for (FTSENT* c = fts_children(f, 0); c; c = c->fts_link, listed++)
+                    if (fts_meta(f, c, &m) != 0)
+                        ok = false;
+            }
+        }
+        fts_check(ok && entries == NFILES + 4, "NOSTAT %#x: metadata matches path lookups (%d entries)", modes[i],
+                  entries);
+        fts_check(!have_xattrs || user >= 1 + 3 + 5 + 2 + 4 + 6 + 1, "NOSTAT %#x: user attributes are collected (%d)",
+                  modes[i], user);
+        fts_check(listed == NFILES / 2, "NOSTAT %#x: listed entries carry their records (%d)", modes[i], listed);
+        fts_check(fts_close(f) == 0, "close NOSTAT stream");
+    }
+}
+
+static void check_errors(char* const* roots) {
+    FTS* f = fts_open(roots, FTS_PHYSICAL, fts_cmp_asc);
+    if (!f)
+        return;
+    struct fts_meta m;
+    errno = 0;
+    fts_check(fts_set_meta(f, 0x80) == -1 && errno == EINVAL, "unknown metadata bits are rejected");
+    FTSENT* root = fts_read(f);
+    FTSENT* first = fts_children(f, 0);
+    errno = 0;
+    fts_check(fts_meta(f, root, &m) == -1 && errno == EINVAL, "fts_meta needs the stage enabled");
+    fts_check(fts_set_meta(f, FTS_META_XATTR) == 0 && fts_meta(f, root, &m) == 0,
+              "the current entry is collected on first use");
+    errno = 0;
+    fts_check(first && fts_meta(f, first, &m) == -1 && errno == ENODATA,
+              "entries read before the stage have no record");
+    fts_close(f);
+}
+
+int main(void) {
+    fts_set_strict_from_env();
+
+    struct fts_test_tree tree;
+    if (fts_test_tree_init(&tree) == -1)
+        return 1;
+    if (build_tree(tree.abs_root) == -1) {
+        fts_test_tree_cleanup(&tree);
+        return 1;
+    }
+    if (!have_xattrs)
+        printf("skip: no user xattrs on the test file system; checking flags and structure only\n");
+
+    char root[1024];
+    snprintf(root, sizeof(root), "%s/meta", tree.abs_root);
+    char* roots[] = {root, NULL};
+    check_modes(roots);
+    check_children(roots);
+    check_nostat(roots);
+    check_errors(roots);
+
+    fts_test_tree_cleanup(&tree);
+    return fts_exit_code();
+}
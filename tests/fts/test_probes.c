@@ -0,0 +1,129 @@
+#include "test_support.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NT_STAPSDT 3
+
+struct probe {
+    const char* name;
+    int nargs;
+    const char* args;
+    int found;
+};
+
+static struct probe probes[] = {
+    {"build_entry", 2, NULL, 0},
+    {"build_return", 3, NULL, 0},
+    {"stat", 3, NULL, 0},
+    {"changedir", 3, NULL, 0},
+    {"cycle", 2, NULL, 0},
+    {"palloc", 2, NULL, 0},
+};
+
+#define NPROBES (sizeof(probes) / sizeof(probes[0]))
+
+static int count_args(const char* args) {
+    int n = *args ? 1 : 0;
+    for (; *args; args++)
+        if (*args == ' ')
+            n++;
+    return n;
+}
+
+/* Walk the .note.stapsdt section of our own executable, which links libfts
+   statically. */
+static int scan_notes(const unsigned char* image, size_t size) {
+    const ElfW(Ehdr)* eh = (const ElfW(Ehdr)*)image;
+    if (size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_shoff == 0)
+        return -1;
+    const ElfW(Shdr)* sh = (const ElfW(Shdr)*)(image + eh->e_shoff);
+    const char* names = (const char*)image + sh[eh->e_shstrndx].sh_offset;
+    int sections = 0;
+
+    for (unsigned i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_NOTE || strcmp(names + sh[i].sh_name, ".note.stapsdt") != 0)
+            continue;
+        sections++;
+        const unsigned char* p = image + sh[i].sh_offset;
+        const unsigned char* end = p + sh[i].sh_size;
+        while (p + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr)* nh = (const ElfW(Nhdr)*)p;
+            const char* owner = (const char*)(nh + 1);
+            const unsigned char* desc = (const unsigned char*)owner + ((nh->n_namesz + 3) & ~3u);
+            p = desc + ((nh->n_descsz + 3) & ~3u);
+            if (nh->n_type != NT_STAPSDT || strcmp(owner, "stapsdt") != 0)
+                continue;
+
+            const char* provider = (const char*)desc + 3 * sizeof(ElfW(Addr));
+            const char* name = provider + strlen(provider) + 1;
+            const char* args = name + strlen(name) + 1;
+            ElfW(Addr) pc;
+            memcpy(&pc, desc, sizeof(pc));
+            if (strcmp(provider, "fts") != 0 || pc == 0)
+                continue;
+            for (size_t j = 0; j < NPROBES; j++) {
+                if (strcmp(probes[j].name, name) != 0)
+                    continue;
+                probes[j].found++;
+                if (count_args(args) != probes[j].nargs)
+                    fts_check(0, "fts:%s has %d arguments, not %d", name, count_args(args), probes[j].nargs);
+                probes[j].args = args;
+            }
+        }
+    }
+    return sections;
+}
+
+int main(void) {
+    fts_set_strict_from_env();
+
+#ifdef MUSL_BSD_NO_SDT
+    printf("skip: probes are compiled out\n");
+    return 0;
+#endif
+
+    int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        printf("skip: /proc/self/exe unavailable\n");
+        return 0;
+    }
+    void* image = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        fts_check(0, "map own executable");
+        return fts_exit_code();
+    }
+
+    fts_check(scan_notes(image, (size_t)st.st_size) == 1, "executable carries one .note.stapsdt section");
+    for (size_t i = 0; i < NPROBES; i++)
+        fts_check(probes[i].found > 0, "probe fts:%s is present", probes[i].name);
+
+    /* stat's result is an unsigned short and its errno a signed int. */
+    const char* args = probes[2].args;
+    char ptr[16];
+    snprintf(ptr, sizeof(ptr), "%zu@", sizeof(void*));
+    fts_check(args && strncmp(args, ptr, strlen(ptr)) == 0, "pointer arguments are unsigned (%s)", args ? args : "");
+    fts_check(args && strstr(args, " 2@") && strstr(args, " -4@"), "argument sizes carry their signedness (%s)",
+              args ? args : "");
+
+    munmap(image, (size_t)st.st_size);
+
+    /* Probe sites stay inert when nothing is attached. */
+    struct fts_test_tree tree;
+    if (fts_test_tree_init(&tree) == -1)
+        return 1;
+    struct fts_walk_stats stats;
+    char* roots[] = {tree.abs_root, NULL};
+    fts_run_walk("probes", tree.abs_root, roots, FTS_PHYSICAL, true, false, &stats);
+    fts_check(stats.n_errors == 0 && stats.n_files > 0, "walk through every probe site");
+    fts_test_tree_cleanup(&tree);
+    return fts_exit_code();
+}
@@ -0,0 +1,163 @@
+#include "test_support.h"
+#include "musl-bsd/fts_ops.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+struct tally {
+    int entries;
+    int below;   /* entries strictly under the pruned directory */
+    int visited; /* FTS_D + FTS_DP of the pruned directory */
+};
+
+static struct tally walk(char* const* roots, int opts, const char* pruned, const char* name, unsigned long magic) {
+    struct tally t = {0, 0, 0};
+    size_t plen = pruned ? strlen(pruned) : 0;
+    FTS* f = fts_open(roots, opts, fts_cmp_asc);
+    if (!f)
+        return t;
+    if (name)
+        fts_skip_fstype(f, name);
+    if (magic)
+        fts_skip_fsmagic(f, magic);
+
+    FTSENT* e;
+    while ((e = fts_read(f)) != NULL) {
+        t.entries++;
+        if (!pruned || strncmp(e->fts_path, pruned, plen) != 0)
+            continue;
+        if (e->fts_path[plen] == '/')
+            t.below++;
+        else if (e->fts_path[plen] == '\0' && (e->fts_info == FTS_D || e->fts_info == FTS_DP))
+            t.visited++;
+    }
+    fts_close(f);
+    return t;
+}
+
+static void check_local(const struct fts_test_tree* tree) {
+    char* roots[] = {tree->abs_root, NULL};
+    struct statfs sfs;
+
+    struct tally plain = walk(roots, FTS_PHYSICAL, NULL, NULL, 0);
+    struct tally builtin = walk(roots, FTS_PHYSICAL | FTS_SKIPFSTYPE, NULL, NULL, 0);
+    fts_check(plain.entries > 10 && builtin.entries == plain.entries,
+              "built-in set leaves an ordinary tree alone (%d entries)", builtin.entries);
+
+    if (statfs(tree->abs_root, &sfs) != 0) {
+        fts_check(0, "statfs test root");
+        return;
+    }
+    const int modes[] = {FTS_PHYSICAL, FTS_PHYSICAL | FTS_NOCHDIR, FTS_PHYSICAL | FTS_BREADTHFIRST};
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        struct tally t = walk(roots, modes[i], tree->abs_root, NULL, (unsigned long)sfs.f_type);
+        fts_check(t.below == 0 && t.visited >= 1, "magic prunes a root on that file system (mode %#x)", modes[i]);
+    }
+}
+
+static void check_proc(void) {
+    struct stat root, proc;
+    if (stat("/", &root) != 0 || stat("/proc/self", &proc) != 0 || root.st_dev == proc.st_dev) {
+        printf("skip: no separate /proc mount\n");
+        return;
+    }
+
+    char* roots[] = {"/proc", NULL};
+    struct tally t = walk(roots, FTS_PHYSICAL | FTS_SKIPFSTYPE, "/proc", NULL, 0);
+    fts_check(t.entries == 2 && t.visited == 2 && t.below == 0, "/proc is returned but not entered (%d entries)",
+              t.entries);
+    t = walk(roots, FTS_PHYSICAL, "/proc", "proc", 0);
+    fts_check(t.below == 0, "a registered type name prunes without the built-in set");
+    t = walk(roots, FTS_PHYSICAL | FTS_NOCHDIR, "/proc", "pro", 0);
+    fts_check(t.below > 0, "type names match whole names only");
+}
+
+static void check_crossing(void) {
+    struct stat dev, pts;
+    if (stat("/dev", &dev) != 0 || stat("/dev/pts", &pts) != 0 || dev.st_dev == pts.st_dev) {
+        printf("skip: no separate /dev/pts mount\n");
+        return;
+    }
+
+    char* roots[] = {"/dev", NULL};
+    struct tally t = walk(roots, FTS_PHYSICAL | FTS_SKIPFSTYPE, "/dev/pts", NULL, 0);
+    fts_check(t.entries > 2 && t.visited == 2 && t.below == 0, "a pseudo mount below the root is pruned");
+    t = walk(roots, FTS_PHYSICAL, "/dev/pts", NULL, 0);
+    fts_check(t.visited == 2 && t.below > 0, "without the filter the mount is entered");
+}
+
+static void check_args(const struct fts_test_tree* tree) {
+    char* roots[] = {tree->abs_root, NULL};
+    FTS* f = fts_open(roots, FTS_PHYSICAL | FTS_SKIPFSTYPE, NULL);
+    fts_check(f != NULL, "fts_open accepts FTS_SKIPFSTYPE");
+    if (!f)
+        return;
+    errno = 0;
+    fts_check(fts_skip_fstype(f, "") == -1 && errno == EINVAL, "empty type name is rejected");
+    errno = 0;
+    fts_check(fts_skip_fstype(NULL, "proc") == -1 && errno == EINVAL, "NULL stream is rejected");
+    fts_close(f);
+}
+
+/* A backend has no statfs() or mount table to filter by. */
+static void check_backend(const struct fts_test_tree* tree) {
+    char* roots[] = {tree->abs_root, NULL};
+    char file[] = "/tmp/fts-snap-XXXXXX";
+    int fd = mkstemp(file);
+    if (fd == -1) {
+        fts_check(0, "create snapshot file");
+        return;
+    }
+    close(fd);
+    struct fts_snapshot* snap = NULL;
+    if (fts_snapshot_save(file, roots) != 0 || !(snap = fts_snapshot_open(file))) {
+        fts_check(0, "record snapshot");
+        unlink(file);
+        return;
+    }
+
+    errno = 0;
+    FTS* f = fts_open_with_ops(roots, FTS_PHYSICAL | FTS_SKIPFSTYPE, NULL, &fts_snapshot_backend, snap);
+    fts_check(f == NULL && errno == EINVAL, "FTS_SKIPFSTYPE is rejected over a backend");
+    if (f)
+        fts_close(f);
+
+    f = fts_open_with_ops(roots, FTS_PHYSICAL, NULL, &fts_snapshot_backend, snap);
+    fts_check(f != NULL, "open snapshot stream");
+    if (f) {
+        errno = 0;
+        fts_check(fts_skip_fstype(f, "proc") == -1 && errno == EINVAL, "type names are rejected over a backend");
+        errno = 0;
+        fts_check(fts_skip_fsmagic(f, 0x9fa0) == -1 && errno == EINVAL, "magic is rejected over a backend");
+        int n = 0;
+        while (fts_read(f))
+            n++;
+        fts_check(n > 10, "the snapshot walk is unfiltered (%d entries)", n);
+        fts_close(f);
+    }
+    fts_snapshot_close(snap);
+    unlink(file);
+}
+
+int main(void) {
+    fts_set_strict_from_env();
+
+    struct fts_test_tree tree;
+    if (fts_test_tree_init(&tree) == -1)
+        return 1;
+
+    check_local(&tree);
+    check_proc();
+    check_crossing();
+    check_args(&tree);
+    check_backend(&tree);
+
+    fts_test_tree_cleanup(&tree);
+    return fts_exit_code();
+}
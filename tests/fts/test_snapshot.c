@@ -0,0 +1,272 @@
+#include "test_support.h"
+#include "musl-bsd/fts_ops.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_STEPS 128
+
+struct step {
+    char path[512];
+    int info;
+    long long size;
+    unsigned long long ino;
+};
+
+struct walk {
+    struct step s[MAX_STEPS];
+    size_t n;
+};
+
+static void record(FTS* f, struct walk* w) {
+    FTSENT* e;
+    w->n = 0;
+    while ((e = fts_read(f)) != NULL && w->n < MAX_STEPS) {
+        struct step* s = &w->s[w->n++];
+        snprintf(s->path, sizeof(s->path), "%s", e->fts_path);
+        s->info = e->fts_info;
+        s->size = e->fts_statp ? (long long)e->fts_statp->st_size : -1;
+        s->ino = e->fts_statp ? (unsigned long long)e->fts_statp->st_ino : 0;
+    }
+}
+
+static bool same(const struct walk* a, const struct walk* b, const char* label) {
+    if (a->n != b->n) {
+        fts_check(0, "%s: %zu entries, want %zu", label, b->n, a->n);
+        return false;
+    }
+    for (size_t i = 0; i < a->n; i++) {
+        const struct step* x = &a->s[i];
+        const struct step* y = &b->s[i];
+        if (strcmp(x->path, y->path) || x->info != y->info || x->size != y->size || x->ino != y->ino) {
+            fts_check(0, "%s: step %zu got %s/%d want %s/%d", label, i, y->path, y->info, x->path, x->info);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* A backend that forwards to libc and counts calls in its own ctx. */
+struct counter {
+    int calls;
+};
+
+static int c_open(void* ctx, const char* path, int flags) {
+    ((struct counter*)ctx)->calls++;
+    return open(path, flags);
+}
+
+static int c_close(void* ctx, int fd) {
+    ((struct counter*)ctx)->calls++;
+    return close(fd);
+}
+
+static int c_fstat(void* ctx, int fd, struct stat* st) {
+    ((struct counter*)ctx)->calls++;
+    return fstat(fd, st);
+}
+
+static int c_fstatat(void* ctx, int dfd, const char* path, struct stat* st, int flags) {
+    ((struct counter*)ctx)->calls++;
+    return fstatat(dfd, path, st, flags);
+}
+
+static int c_fchdir(void* ctx, int fd) {
+    ((struct counter*)ctx)->calls++;
+    return fchdir(fd);
+}
+
+static DIR* c_fdopendir(void* ctx, int fd) {
+    ((struct counter*)ctx)->calls++;
+    return fdopendir(fd);
+}
+
+static struct dirent* c_readdir(void* ctx, DIR* d) {
+    ((struct counter*)ctx)->calls++;
+    return readdir(d);
+}
+
+static int c_closedir(void* ctx, DIR* d) {
+    ((struct counter*)ctx)->calls++;
+    return closedir(d);
+}
+
+static int c_dirfd(void* ctx, DIR* d) {
+    (void)ctx;
+    return dirfd(d);
+}
+
+static const struct fts_backend counting_backend = {.open_fn = c_open,
+                                                    .close_fn = c_close,
+                                                    .fstat_fn = c_fstat,
+                                                    .fstatat_fn = c_fstatat,
+                                                    .fchdir_fn = c_fchdir,
+                                                    .fdopendir_fn = c_fdopendir,
+                                                    .readdir_fn = c_readdir,
+                                                    .closedir_fn = c_closedir,
+                                                    .dirfd_fn = c_dirfd};
+
+static void test_per_stream(char* const* roots) {
+    struct counter one = {0}, two = {0};
+    FTS* a = fts_open_with_ops(roots, FTS_PHYSICAL | FTS_NOCHDIR, NULL, &counting_backend, &one);
+    FTS* b = fts_open_with_ops(roots, FTS_PHYSICAL, NULL, &counting_backend, &two);
+    fts_check(a && b, "fts_open_with_ops opens two streams");
+    if (!a || !b)
+        return;
+
+    /* Interleave the streams; each backend call lands in its own ctx. */
+    int na = 0, nb = 0;
+    bool more = true;
+    while (more) {
+        more = false;
+        if (fts_read(a)) {
+            na++;
+            more = true;
+        }
+        if (nb < 3 && fts_read(b)) {
+            nb++;
+            more = true;
+        }
+    }
+    fts_close(a);
+    int before_close = two.calls;
+    fts_close(b);
+    fts_check(one.calls > 0 && two.calls > 0, "each stream reaches its own backend (%d, %d calls)", one.calls,
+              two.calls);
+    fts_check(two.calls > before_close, "fts_close goes through the stream's backend");
+
+    struct fts_backend partial = counting_backend;
+    partial.dirfd_fn = NULL;
+    errno = 0;
+    fts_check(fts_open_with_ops(roots, FTS_PHYSICAL, NULL, &partial, &one) == NULL && errno == EINVAL,
+              "incomplete backend is rejected");
+}
+
+static void walk_live(char* const* roots, int opts, struct walk* w) {
+    FTS* f = fts_open(roots, opts, fts_cmp_asc);
+    w->n = 0;
+    if (f) {
+        record(f, w);
+        fts_close(f);
+    }
+}
+
+static void walk_snapshot(const char* file, char* const* roots, int opts, struct walk* w, const char* label) {
+    w->n = 0;
+    struct fts_snapshot* snap = fts_snapshot_open(file);
+    fts_check(snap != NULL, "%s: snapshot opens", label);
+    if (!snap)
+        return;
+    FTS* f = fts_open_with_ops(roots, opts, fts_cmp_asc, &fts_snapshot_backend, snap);
+    fts_check(f != NULL, "%s: walk opens over the snapshot", label);
+    if (f) {
+        record(f, w);
+        fts_check(errno == 0, "%s: snapshot walk completes", label);
+        fts_check(fts_close(f) == 0, "%s: snapshot walk closes", label);
+    }
+    fts_snapshot_close(snap);
+}
+
+/* Offsets in the snapshot file format: a 24-byte header, then 104-byte
+   nodes with the child count at byte 80. */
+#define SNAP_HEADER_SIZE 24
+#define SNAP_NODE_SIZE 104
+#define SNAP_NCHILD_OFFSET 80
+
+/* A node claiming more children than the file has nodes is rejected before
+   any of them is looked at. */
+static void test_corrupt_nchild(const char* file) {
+    char bad[] = "/tmp/fts-snap-XXXXXX";
+    FILE* in = fopen(file, "rb");
+    int fd = mkstemp(bad);
+    fts_check(in != NULL && fd != -1, "copy snapshot for corruption");
+    if (!in || fd == -1)
+        return;
+
+    static unsigned char buf[1 << 16];
+    size_t len = fread(buf, 1, sizeof(buf), in);
+    fclose(in);
+    bool patched = false;
+    for (size_t off = SNAP_HEADER_SIZE; !patched && off + SNAP_NODE_SIZE <= len; off += SNAP_NODE_SIZE) {
+        uint32_t nchild;
+        memcpy(&nchild, buf + off + SNAP_NCHILD_OFFSET, sizeof(nchild));
+        if (nchild) {
+            nchild = UINT32_MAX;
+            memcpy(buf + off + SNAP_NCHILD_OFFSET, &nchild, sizeof(nchild));
+            patched = true;
+        }
+    }
+    fts_check(patched && len < sizeof(buf) && write(fd, buf, len) == (ssize_t)len, "patch a node's child count");
+    close(fd);
+
+    errno = 0;
+    fts_check(fts_snapshot_open(bad) == NULL && errno == EINVAL, "child count past the node table is rejected");
+    unlink(bad);
+}
+
+int main(void) {
+    fts_set_strict_from_env();
+
+    struct fts_test_tree tree;
+    if (fts_test_tree_init(&tree) == -1)
+        return 1;
+    if (fts_build_symlink_loop(tree.abs_root) == -1) {
+        fts_test_tree_cleanup(&tree);
+        return 1;
+    }
+
+    char abs_root[512], snap_abs[] = "/tmp/fts-snap-XXXXXX", snap_rel[] = "/tmp/fts-snap-XXXXXX";
+    snprintf(abs_root, sizeof(abs_root), "%s", tree.abs_root);
+    int fd1 = mkstemp(snap_abs), fd2 = mkstemp(snap_rel);
+    if (fd1 == -1 || fd2 == -1)
+        return 1;
+    close(fd1);
+    close(fd2);
+
+    char* roots[] = {abs_root, NULL};
+    char* rel_roots[] = {"b", "a/file1", NULL};
+    static struct walk phys, nochdir, logical, rel, got;
+
+    test_per_stream(roots);
+
+    walk_live(roots, FTS_PHYSICAL, &phys);
+    walk_live(roots, FTS_PHYSICAL | FTS_NOCHDIR, &nochdir);
+    walk_live(roots, FTS_LOGICAL, &logical);
+    fts_check(fts_snapshot_save(snap_abs, roots) == 0, "record absolute root");
+
+    int cwd = open(".", O_RDONLY | O_DIRECTORY);
+    fts_check(cwd != -1 && chdir(abs_root) == 0, "chdir into tree");
+    walk_live(rel_roots, FTS_PHYSICAL, &rel);
+    fts_check(fts_snapshot_save(snap_rel, rel_roots) == 0, "record relative roots");
+    fts_check(cwd != -1 && fchdir(cwd) == 0, "restore cwd");
+    if (cwd != -1)
+        close(cwd);
+
+    /* Replay with the live tree gone. */
+    fts_test_tree_cleanup(&tree);
+
+    walk_snapshot(snap_abs, roots, FTS_PHYSICAL, &got, "PHYSICAL");
+    fts_check(same(&phys, &got, "PHYSICAL") && phys.n > 10, "chdir walk replays from the snapshot");
+    walk_snapshot(snap_abs, roots, FTS_PHYSICAL | FTS_NOCHDIR, &got, "NOCHDIR");
+    fts_check(same(&nochdir, &got, "NOCHDIR"), "fd-relative walk replays from the snapshot");
+    walk_snapshot(snap_abs, roots, FTS_LOGICAL, &got, "LOGICAL");
+    fts_check(same(&logical, &got, "LOGICAL"), "symlinks resolve inside the snapshot");
+    walk_snapshot(snap_rel, rel_roots, FTS_PHYSICAL, &got, "relative");
+    fts_check(same(&rel, &got, "relative"), "relative roots replay against the recorded cwd");
+
+    errno = 0;
+    fts_check(fts_snapshot_open("/dev/null") == NULL && errno == EINVAL, "non-snapshot file is rejected");
+    test_corrupt_nchild(snap_abs);
+
+    unlink(snap_abs);
+    unlink(snap_rel);
+    return fts_exit_code();
+}
@@ -0,0 +1,405 @@
+/* Allocation benchmarks: the same workloads run on an obstack, on plain
+   malloc() and on a minimal bump allocator, each in a child process so peak
+   RSS is its own.  Results go to stdout as one JSON array. */
+
+#include "obstack.h"
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define obstack_chunk_alloc xmalloc
+#define obstack_chunk_free free
+
+static size_t chunk_size;
+static long iterations = 200000;
+static volatile unsigned long sink;
+
+/* Just enough of an arena to compare against: aligned bump allocation out of
+   64 KiB blocks, growing only the newest allocation, freed all at once. */
+struct bump_block {
+    struct bump_block* prev;
+    char* end;
+    char data[];
+};
+
+struct bump {
+    struct bump_block* block;
+    char* cur;
+    char* last;
+};
+
+static void* bump_alloc(struct bump* b, size_t n) {
+    char* p = b->block ? (char*)(((uintptr_t)b->cur + 15) & ~(uintptr_t)15) : NULL;
+    if (!p || n > (size_t)(b->block->end - p)) {
+        size_t size = n > 65536 ? n : 65536;
+        struct bump_block* blk = (struct bump_block*)malloc(sizeof(*blk) + size);
+        if (!blk)
+            abort();
+        blk->prev = b->block;
+        blk->end = blk->data + size;
+        b->block = blk;
+        p = blk->data;
+    }
+    b->cur = p + n;
+    b->last = p;
+    return p;
+}
+
+/* Grows the newest allocation from OLD to NEW bytes, copying it into a new
+   block when it does not fit; returns its possibly new address. */
+static char* bump_grow(struct bump* b, size_t old, size_t new, size_t* copied) {
+    if (new <= (size_t)(b->block->end - b->last)) {
+        b->cur = b->last + new;
+        return b->last;
+    }
+    char* from = b->last;
+    char* p = (char*)bump_alloc(b, new);
+    memcpy(p, from, old);
+    *copied += old;
+    return p;
+}
+
+static void bump_free_all(struct bump* b) {
+    while (b->block) {
+        struct bump_block* prev = b->block->prev;
+        free(b->block);
+        b->block = prev;
+    }
+    b->cur = b->last = NULL;
+}
+
+enum allocator { OBSTACK, MALLOC, BUMP };
+static const char* const allocator_names[] = {"obstack", "malloc", "bump"};
+
+static void begin(struct obstack* ob) {
+    if (chunk_size)
+        obstack_begin(ob, chunk_size);
+    else
+        obstack_init(ob);
+}
+
+static size_t obstack_copied(struct obstack* ob) {
+    struct obstack_stats st;
+    return obstack_get_stats(ob, &st) == 0 ? st.bytes_copied : 0;
+}
+
+/* Each workload returns the number of operations it timed and adds the
+   bytes its allocator copied to *COPIED. */
+
+static long small_fixed(enum allocator a, size_t* copied) {
+    enum { BATCH = 1000 };
+    void* ptrs[BATCH];
+    struct obstack ob;
+    struct bump b = {0};
+    if (a == OBSTACK)
+        begin(&ob);
+    for (long i = 0; i < iterations; i += BATCH) {
+        for (int j = 0; j < BATCH; j++) {
+            char* p = a == OBSTACK ? obstack_alloc(&ob, 32) : a == MALLOC ? malloc(32) : bump_alloc(&b, 32);
+            p[0] = (char)j;
+            ptrs[j] = p;
+        }
+        sink += *(char*)ptrs[BATCH - 1];
+        if (a == MALLOC)
+            for (int j = 0; j < BATCH; j++)
+                free(ptrs[j]);
+    }
+    if (a == OBSTACK) {
+        *copied += obstack_copied(&ob);
+        obstack_free(&ob, NULL);
+    }
+    bump_free_all(&b);
+    return iterations / BATCH * BATCH;
+}
+
+/* Strings of 1 to 511 bytes built a byte at a time. */
+static long grow_string(enum allocator a, size_t* copied) {
+    struct obstack ob;
+    struct bump b = {0};
+    long ops = 0;
+    if (a == OBSTACK)
+        begin(&ob);
+    for (long i = 0; i < iterations / 64; i++) {
+        size_t len = (size_t)(i * 7919 % 511) + 1;
+        char* s = NULL;
+        size_t cap = 0;
+        if (a == BUMP) {
+            s = (char*)bump_alloc(&b, 16);
+            cap = 16;
+        }
+        for (size_t k = 0; k < len; k++) {
+            char c = (char)('a' + k % 26);
+            if (a == OBSTACK) {
+                obstack_1grow(&ob, c);
+                continue;
+            }
+            if (k == cap) {
+                char* grown;
+                if (a == MALLOC) {
+                    grown = (char*)realloc(s, cap ? cap * 2 : 16);
+                    if (!grown)
+                        abort();
+                    if (grown != s && s)
+                        *copied += cap;
+                }
+                else {
+                    grown = bump_grow(&b, cap, cap * 2, copied);
+                }
+                s = grown;
+                cap = cap ? cap * 2 : 16;
+            }
+            s[k] = c;
+        }
+        if (a == OBSTACK)
+            s = obstack_finish(&ob);
+        sink += (unsigned char)s[len - 1];
+        if (a == MALLOC)
+            free(s);
+        ops += (long)len;
+    }
+    if (a == OBSTACK) {
+        *copied += obstack_copied(&ob);
+        obstack_free(&ob, NULL);
+    }
+    bump_free_all(&b);
+    return ops;
+}
+
+static char* bump_printf(struct bump* b, const char* fmt, ...) {
+    va_list ap, ap2;
+    va_start(ap, fmt);
+    va_copy(ap2, ap);
+    char* p = (char*)bump_alloc(b, 128);
+    int n = vsnprintf(p, 128, fmt, ap);
+    if (n >= 128) {
+        p = (char*)bump_alloc(b, (size_t)n + 1);
+        vsnprintf(p, (size_t)n + 1, fmt, ap2);
+    }
+    else {
+        b->cur = p + n + 1;
+    }
+    va_end(ap2);
+    va_end(ap);
+    return p;
+}
+
+static long printf_heavy(enum allocator a, size_t* copied) {
+    struct obstack ob;
+    struct bump b = {0};
+    if (a == OBSTACK)
+        begin(&ob);
+    for (long i = 0; i < iterations; i++) {
+        const char* fmt = "%ld: key=%s value=%#lx ratio=%.3f\n";
+        char* s;
+        if (a == OBSTACK) {
+            obstack_printf(&ob, fmt, i, "request", (unsigned long)i * 2654435761u, i / 7.0);
+            obstack_1grow(&ob, '\0');
+            s = obstack_finish(&ob);
+        }
+        else if (a == MALLOC) {
+            if (asprintf(&s, fmt, i, "request", (unsigned long)i * 2654435761u, i / 7.0) < 0)
+                abort();
+        }
+        else {
+            s = bump_printf(&b, fmt, i, "request", (unsigned long)i * 2654435761u, i / 7.0);
+        }
+        sink += (unsigned char)s[0];
+        if (a == MALLOC)
+            free(s);
+    }
+    if (a == OBSTACK) {
+        *copied += obstack_copied(&ob);
+        obstack_free(&ob, NULL);
+    }
+    bump_free_all(&b);
+    return iterations;
+}
+
+/* Allocate just past a chunk's worth, then free back to the mark, as a
+   parser does per statement. */
+static long mark_free(enum allocator a, size_t* copied) {
+    enum { PER_ROUND = 40, SIZE = 104 };
+    void* ptrs[PER_ROUND];
+    struct obstack ob;
+    struct bump b = {0};
+    if (a == OBSTACK)
+        begin(&ob);
+    for (long i = 0; i < iterations; i += PER_ROUND) {
+        void* mark = a == OBSTACK ? obstack_alloc(&ob, 0) : NULL;
+        for (int j = 0; j < PER_ROUND; j++) {
+            char* p = a == OBSTACK ? obstack_alloc(&ob, SIZE) : a == MALLOC ? malloc(SIZE) : bump_alloc(&b, SIZE);
+            p[SIZE - 1] = (char)j;
+            ptrs[j] = p;
+        }
+        sink += *((char*)ptrs[PER_ROUND - 1] + SIZE - 1);
+        if (a == OBSTACK)
+            obstack_free(&ob, mark);
+        else if (a == MALLOC)
+            for (int j = 0; j < PER_ROUND; j++)
+                free(ptrs[j]);
+        else
+            b.cur = b.block->data;
+    }
+    if (a == OBSTACK) {
+        *copied += obstack_copied(&ob);
+        obstack_free(&ob, NULL);
+    }
+    bump_free_all(&b);
+    return iterations / PER_ROUND * PER_ROUND;
+}
+
+/* Small objects interleaved with 64-256 KiB ones, released in batches. */
+static long large_churn(enum allocator a, size_t* copied) {
+    enum { BATCH = 16 };
+    void* ptrs[2 * BATCH];
+    struct obstack ob;
+    struct bump b = {0};
+    long rounds = iterations / 1000 + 1;
+    if (a == OBSTACK)
+        begin(&ob);
+    for (long i = 0; i < rounds; i++) {
+        void* mark = a == OBSTACK ? obstack_alloc(&ob, 0) : NULL;
+        for (int j = 0; j < BATCH; j++) {
+            size_t big = (size_t)(64 + (i + j) % 4 * 64) << 10;
+            for (int k = 0; k < 2; k++) {
+                size_t n = k ? big : 48;
+                char* p = a == OBSTACK ? obstack_alloc(&ob, n) : a == MALLOC ? malloc(n) : bump_alloc(&b, n);
+                memset(p, k, n < 4096 ? n : 4096);
+                ptrs[2 * j + k] = p;
+            }
+        }
+        sink += *(char*)ptrs[1];
+        if (a == OBSTACK)
+            obstack_free(&ob, mark);
+        else if (a == MALLOC)
+            for (int j = 0; j < 2 * BATCH; j++)
+                free(ptrs[j]);
+        else
+            bump_free_all(&b);
+    }
+    if (a == OBSTACK) {
+        *copied += obstack_copied(&ob);
+        obstack_free(&ob, NULL);
+    }
+    return rounds * 2 * BATCH;
+}
+
+static const struct workload {
+    const char* name;
+    long (*run)(enum allocator, size_t*);
+} workloads[] = {
+    {"small_fixed", small_fixed},   {"grow_string", grow_string}, {"printf_heavy", printf_heavy},
+    {"mark_free", mark_free},       {"large_churn", large_churn},
+};
+
+struct result {
+    long ops;
+    size_t copied;
+    double ns;
+    long peak_rss_kb;
+};
+
+/* Runs one workload in a child so that its peak RSS is not another's. */
+static int measure(const struct workload* w, enum allocator a, struct result* r) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        return -1;
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        close(fds[0]);
+        struct timespec t0, t1;
+        struct result out = {0, 0, 0, 0};
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        out.ops = w->run(a, &out.copied);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        out.ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        out.peak_rss_kb = ru.ru_maxrss;
+        _exit(write(fds[1], &out, sizeof(out)) == (ssize_t)sizeof(out) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t n = read(fds[0], r, sizeof(*r));
+    close(fds[0]);
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || n != sizeof(*r))
+        return -1;
+    return 0;
+}
+
+static void usage(FILE* fp, const char* prog) {
+    fprintf(fp, "usage: %s [--workload NAME] [--iterations N] [--chunk-size BYTES]\nworkloads:", prog);
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+        fprintf(fp, " %s", workloads[i].name);
+    fputc('\n', fp);
+}
+
+int main(int argc, char** argv) {
+    static const struct option longopts[] = {
+        {"workload", required_argument, NULL, 'w'},
+        {"iterations", required_argument, NULL, 'n'},
+        {"chunk-size", required_argument, NULL, 'c'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    const char* only = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "w:n:c:h", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'w':
+            only = optarg;
+            break;
+        case 'n':
+            iterations = strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            chunk_size = (size_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+        default:
+            usage(stderr, argv[0]);
+            return 2;
+        }
+    }
+    int known = !only;
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+        known |= only && strcmp(only, workloads[i].name) == 0;
+    if (iterations <= 0 || !known) {
+        usage(stderr, argv[0]);
+        return 2;
+    }
+
+    int found = 0, failed = 0;
+    printf("[");
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        const struct workload* w = &workloads[i];
+        if (only && strcmp(only, w->name) != 0)
+            continue;
+        for (int a = OBSTACK; a <= BUMP; a++) {
+            struct result r;
+            if (measure(w, (enum allocator)a, &r) != 0) {
+                fprintf(stderr, "%s/%s failed\n", w->name, allocator_names[a]);
+                failed = 1;
+                continue;
+            }
+            printf("%s\n  {\"workload\": \"%s\", \"allocator\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.2f, "
+                   "\"bytes_copied\": %zu, \"peak_rss_kb\": %ld}",
+                   found++ ? "," : "", w->name, allocator_names[a], r.ops, r.ns / (double)r.ops, r.copied,
+                   r.peak_rss_kb);
+        }
+    }
+    printf("\n]\n");
+    return failed;
+}
@@ -0,0 +1,122 @@
+#include "test_support.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADS 4
+#define OBJECTS 20000
+
+struct trace {
+    int allocs;
+    int frees;
+};
+
+static void* trace_alloc(void* arg, size_t n) {
+    struct trace* t = (struct trace*)arg;
+    __atomic_add_fetch(&t->allocs, 1, __ATOMIC_RELAXED);
+    return malloc(n);
+}
+
+static void trace_free(void* arg, void* p) {
+    struct trace* t = (struct trace*)arg;
+    __atomic_add_fetch(&t->frees, 1, __ATOMIC_RELAXED);
+    free(p);
+}
+
+static struct obstack_arena* arena;
+static pthread_barrier_t start;
+
+/* Each thread fills its objects with its own byte, so any overlap between
+   threads shows up when they are checked after all have run. */
+static void* worker(void* arg) {
+    char fill = (char)(long)arg;
+    char** objs = (char**)malloc(OBJECTS * sizeof(*objs));
+    assert(objs != NULL);
+
+    pthread_barrier_wait(&start);
+    void* mark = obstack_arena_alloc(arena, 0);
+    for (int i = 0; i < OBJECTS; i++) {
+        size_t n = (size_t)(i % 61) + 1;
+        objs[i] = (char*)obstack_arena_alloc(arena, n);
+        memset(objs[i], fill, n);
+    }
+    struct obstack* local = obstack_arena_local(arena);
+    assert(obstack_printf(local, "thread %d", fill) > 0);
+    obstack_1grow(local, '\0');
+    char* name = (char*)obstack_finish(local);
+
+    pthread_barrier_wait(&start);
+    for (int i = 0; i < OBJECTS; i++)
+        for (size_t j = 0; j <= (size_t)(i % 61); j++)
+            assert(objs[i][j] == fill);
+    char want[32];
+    snprintf(want, sizeof(want), "thread %d", fill);
+    assert(strcmp(name, want) == 0);
+
+    /* Freeing to the mark empties this thread's obstack only. */
+    obstack_arena_free(arena, mark);
+    assert(local->next_free == (char*)mark && local->chunk->prev == NULL);
+    free(objs);
+    return NULL;
+}
+
+static void* latecomer(void* arg) {
+    (void)arg;
+    char* p = (char*)obstack_arena_alloc(arena, 100);
+    memset(p, 'L', 100);
+    return NULL;
+}
+
+static void test_threads(void) {
+    struct trace t = {0, 0};
+    arena = obstack_arena_create(4096, 0, trace_alloc, trace_free, &t);
+    assert(arena != NULL && t.allocs == 0);
+
+    pthread_t tids[THREADS];
+    pthread_barrier_init(&start, NULL, THREADS);
+    for (long i = 0; i < THREADS; i++)
+        assert(pthread_create(&tids[i], NULL, worker, (void*)(i + 1)) == 0);
+    for (int i = 0; i < THREADS; i++)
+        assert(pthread_join(tids[i], NULL) == 0);
+    pthread_barrier_destroy(&start);
+    assert(t.frees < t.allocs);
+
+    /* A new thread takes over an obstack left by one that exited. */
+    int allocs = t.allocs;
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, latecomer, NULL) == 0);
+    assert(pthread_join(tid, NULL) == 0);
+    assert(t.allocs == allocs);
+
+    /* So does this one; a null object frees all it holds. */
+    char* p = (char*)obstack_arena_alloc(arena, 8000);
+    memset(p, 'M', 8000);
+    obstack_arena_free(arena, NULL);
+    assert(obstack_arena_local(arena)->chunk->prev == NULL);
+
+    obstack_arena_destroy(arena);
+    assert(t.frees == t.allocs);
+}
+
+static void test_default_allocator(void) {
+    struct obstack_arena* a = obstack_arena_create(0, 16, NULL, NULL, NULL);
+    assert(a != NULL);
+    void* mark = obstack_arena_alloc(a, 0);
+    double* d = (double*)obstack_arena_alloc(a, 10 * sizeof(double));
+    assert(((uintptr_t)d & 15) == 0);
+    d[9] = 1.5;
+    assert(obstack_arena_local(a)->alignment_mask == 15);
+    obstack_arena_free(a, mark);
+    obstack_arena_destroy(a);
+    obstack_arena_destroy(NULL);
+}
+
+int main(void) {
+    test_threads();
+    test_default_allocator();
+    puts("test_arena ok");
+    return 0;
+}
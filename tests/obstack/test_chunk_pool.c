@@ -0,0 +1,143 @@
+#include "test_support.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void* __real_malloc(size_t size);
+
+static int malloc_calls;
+
+void* __wrap_malloc(size_t size) {
+    malloc_calls++;
+    return __real_malloc(size);
+}
+
+/* Allocate past the chunk edge and free back to a mark, as a parser does per
+   statement. */
+static void cycle(struct obstack* ob, int rounds) {
+    for (int i = 0; i < rounds; i++) {
+        void* mark = obstack_alloc(ob, 1);
+        (void)obstack_build_string(ob, 3000, 'c');
+        (void)obstack_build_string(ob, 3000, 'd');
+        obstack_free(ob, mark);
+    }
+}
+
+static void check_spares(void) {
+    struct extra_state st = {0, 0, 0};
+    struct obstack ob;
+    assert(_obstack_begin_1(&ob, 1024, 0, obstack_extra_alloc, obstack_extra_free, &st) == 1);
+
+    cycle(&ob, 1);
+    int warm = st.calls;
+    assert(warm > 1);
+    cycle(&ob, 100);
+    assert(st.calls == warm);
+
+    /* Spares are not part of the chain, and obstack_free(NULL) drops them. */
+    assert(ob.chunk->prev == NULL);
+    assert(_obstack_memory_used(&ob) == 1024);
+    obstack_free(&ob, NULL);
+    assert(ob.temp.p == NULL);
+}
+
+static void* pooled_thread(void* arg) {
+    (void)arg;
+    struct obstack ob;
+    obstack_init(&ob);
+    cycle(&ob, 10);
+    obstack_free(&ob, NULL);
+    return NULL;
+}
+
+static pthread_barrier_t step;
+
+/* Fills its cache, then lets the main thread turn the pool off and on
+   around one chunk operation of its own; returns the malloc() calls its
+   next chunk takes. */
+static void* draining_thread(void* arg) {
+    (void)arg;
+    struct obstack ob;
+    obstack_init(&ob);
+    cycle(&ob, 10);
+    obstack_free(&ob, NULL);
+    pthread_barrier_wait(&step);
+
+    pthread_barrier_wait(&step); /* pool off */
+    obstack_init(&ob);
+    obstack_free(&ob, NULL);
+    pthread_barrier_wait(&step);
+
+    pthread_barrier_wait(&step); /* pool on */
+    malloc_calls = 0;
+    obstack_init(&ob);
+    intptr_t calls = malloc_calls;
+    obstack_free(&ob, NULL);
+    return (void*)calls;
+}
+
+static void check_pool(void) {
+    struct obstack a;
+    struct obstack b;
+
+    assert(obstack_chunk_pool(64) == 0);
+
+    obstack_init(&a);
+    for (int i = 0; i < 8; i++)
+        (void)obstack_alloc(&a, 3000);
+    obstack_free(&a, NULL);
+
+    /* Standard chunks released by one obstack serve the next. */
+    malloc_calls = 0;
+    obstack_init(&b);
+    for (int i = 0; i < 8; i++)
+        (void)obstack_alloc(&b, 3000);
+    assert(malloc_calls == 0);
+    obstack_free(&b, NULL);
+
+    /* Oversized chunks bypass the pool. */
+    obstack_init(&b);
+    (void)obstack_alloc(&b, 16);
+    malloc_calls = 0;
+    (void)obstack_alloc(&b, 10000);
+    assert(malloc_calls == 1);
+    obstack_free(&b, NULL);
+
+    /* A thread's cache goes back to the depot when it exits. */
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, pooled_thread, NULL) == 0);
+    assert(pthread_join(tid, NULL) == 0);
+
+    assert(obstack_chunk_pool(0) == 64);
+    malloc_calls = 0;
+    obstack_init(&b);
+    assert(malloc_calls == 1);
+    obstack_free(&b, NULL);
+
+    /* Turning the pool off empties a live thread's cache too, once that
+       thread next handles a chunk. */
+    void* calls;
+    assert(obstack_chunk_pool(64) == 0);
+    assert(pthread_barrier_init(&step, NULL, 2) == 0);
+    assert(pthread_create(&tid, NULL, draining_thread, NULL) == 0);
+    pthread_barrier_wait(&step);
+    assert(obstack_chunk_pool(0) == 64);
+    pthread_barrier_wait(&step);
+    pthread_barrier_wait(&step);
+    assert(obstack_chunk_pool(64) == 0);
+    pthread_barrier_wait(&step);
+    assert(pthread_join(tid, &calls) == 0);
+    assert((intptr_t)calls == 1);
+    pthread_barrier_destroy(&step);
+    assert(obstack_chunk_pool(0) == 64);
+}
+
+int main(void) {
+    check_spares();
+    check_pool();
+    puts("test_chunk_pool ok");
+    return 0;
+}
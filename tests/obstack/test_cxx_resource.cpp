@@ -0,0 +1,72 @@
+extern "C" {
+#include "test_support.h"
+}
+
+#include "musl-bsd/obstack.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <memory_resource>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+static_assert(!std::is_copy_constructible_v<musl_bsd::unique_obstack>);
+static_assert(std::is_nothrow_move_constructible_v<musl_bsd::unique_obstack>);
+
+static void test_containers() {
+    musl_bsd::unique_obstack ob(4096);
+    musl_bsd::obstack_resource res(ob);
+    void* base = obstack_base(ob.get());
+
+    {
+        musl_bsd::obstack_scope scope(ob);
+        std::pmr::vector<std::pmr::string> words(&res);
+        for (int i = 0; i < 1000; i++)
+            words.emplace_back("a string long enough to need its own storage " + std::to_string(i));
+        assert(words.size() == 1000 && words[999].ends_with(" 999"));
+        assert(obstack_memory_used(ob.get()) > 4096);
+    }
+
+    /* The scope freed everything back to where it began. */
+    assert(obstack_base(ob.get()) == base && ob->chunk->prev == nullptr);
+}
+
+static void test_alignment() {
+    musl_bsd::unique_obstack ob(0, 8);
+    musl_bsd::obstack_resource res(ob.get());
+    musl_bsd::obstack_scope scope(ob);
+    void* first = res.allocate(8);
+
+    for (std::size_t align = 1; align <= 4096; align *= 2) {
+        (void)res.allocate(3, 1);
+        void* p = res.allocate(100, align);
+        assert(reinterpret_cast<std::uintptr_t>(p) % align == 0);
+        res.deallocate(p, 100, align);
+    }
+
+    /* Rewinding keeps the scope open for reuse. */
+    scope.rewind();
+    assert(res.allocate(8) == first);
+}
+
+static void test_move() {
+    struct extra_state st = {0, 0, 0};
+    musl_bsd::unique_obstack a(256, 0, obstack_extra_alloc, obstack_extra_free, &st);
+    char* s = static_cast<char*>(obstack_copy0(a.get(), "kept", 4));
+
+    musl_bsd::unique_obstack b(std::move(a));
+    assert(!a && b && std::string(s) == "kept" && st.calls == 1);
+    b = musl_bsd::unique_obstack();
+    assert(b && obstack_object_size(b.get()) == 0);
+}
+
+int main() {
+    test_containers();
+    test_alignment();
+    test_move();
+    std::puts("test_cxx_resource ok");
+    return 0;
+}
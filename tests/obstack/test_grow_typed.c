@@ -0,0 +1,92 @@
+#include "test_support.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct obstack ob;
+
+/* Finish the object as a string and compare it with what printf produced. */
+static void expect(int len, const char* want) {
+    obstack_1grow(&ob, '\0');
+    char* got = obstack_finish(&ob);
+    if (strcmp(got, want) != 0 || len != (int)strlen(want)) {
+        fprintf(stderr, "got \"%s\" (%d), want \"%s\"\n", got, len, want);
+        abort();
+    }
+    obstack_free(&ob, got);
+}
+
+static void check_fixed(double v, int prec) {
+    char want[512];
+    snprintf(want, sizeof(want), "%.*f", prec, v);
+    expect(obstack_grow_fixed(&ob, v, prec), want);
+}
+
+static void test_integers(void) {
+    static const long long dec[] = {0, 1, -1, 9, 10, -10, 123456789, LLONG_MAX, LLONG_MIN};
+    static const unsigned long long udec[] = {0, 7, 10, 0xdeadbeef, ULLONG_MAX};
+    char want[64];
+
+    for (size_t i = 0; i < sizeof(dec) / sizeof(dec[0]); i++) {
+        snprintf(want, sizeof(want), "%lld", dec[i]);
+        expect(obstack_grow_dec(&ob, dec[i]), want);
+    }
+    for (size_t i = 0; i < sizeof(udec) / sizeof(udec[0]); i++) {
+        snprintf(want, sizeof(want), "%llu", udec[i]);
+        expect(obstack_grow_udec(&ob, udec[i]), want);
+        snprintf(want, sizeof(want), "%llx", udec[i]);
+        expect(obstack_grow_hex(&ob, udec[i]), want);
+    }
+
+    /* Pieces append to the same object. */
+    int len = obstack_grow_dec(&ob, -5);
+    obstack_1grow(&ob, ',');
+    len += 1 + obstack_grow_hex(&ob, 255);
+    expect(len, "-5,ff");
+}
+
+static void test_fixed(void) {
+    static const double values[] = {0.0, -0.0, 0.5, 1.5, 2.5, 0.125, -0.125, 0.001, -0.001,
+                                    1.0 / 3, 2.0 / 3, 123.456, 1e11, 1e15, 1e300, -1e300};
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+        for (int prec = 0; prec <= 12; prec++)
+            check_fixed(values[i], prec);
+
+    check_fixed(INFINITY, 2);
+    check_fixed(-INFINITY, 2);
+    check_fixed(NAN, 2);
+
+    srand(12345);
+    for (int i = 0; i < 20000; i++) {
+        double v = (rand() - RAND_MAX / 2) / (double)(1 + rand() % 100000);
+        check_fixed(v, i % 10);
+    }
+}
+
+static void test_escaped(void) {
+    static const char raw[] = "plain \"q\" back\\slash\n\ttab\r\x01"
+                              "7\x7f\xff";
+    int len = obstack_grow_escaped(&ob, raw, sizeof(raw) - 1);
+    expect(len, "plain \\\"q\\\" back\\\\slash\\n\\ttab\\r\\0017\\177\\377");
+
+    expect(obstack_grow_escaped(&ob, "a\0b", 3), "a\\000b");
+    expect(obstack_grow_escaped(&ob, "", 0), "");
+}
+
+int main(void) {
+    int ok = _obstack_begin(&ob, 64, 0, obstack_plain_alloc, obstack_plain_free);
+    assert(ok == 1);
+
+    test_integers();
+    test_fixed();
+    test_escaped();
+
+    obstack_free(&ob, NULL);
+    puts("test_grow_typed ok");
+    return 0;
+}
@@ -0,0 +1,43 @@
+#include "test_support.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+int main(void) {
+    struct obstack ob;
+    struct obstack_stats st;
+    int ok = _obstack_begin(&ob, 128, 0, obstack_plain_alloc, obstack_plain_free);
+    assert(ok == 1);
+
+    char key[] = "key", sep[] = "=", big[300];
+    memset(big, 'v', sizeof(big));
+    struct iovec iov[] = {
+        {key, 3},
+        {sep, 1},
+        {NULL, 0},
+        {big, sizeof(big)},
+    };
+
+    /* A partial object followed by a record larger than the room moves once. */
+    obstack_grow(&ob, "<", 1);
+    assert(obstack_get_stats(&ob, &st) == 0 && st.chunks_allocated == 1);
+    obstack_growv(&ob, iov, 4);
+    assert(obstack_get_stats(&ob, &st) == 0);
+    assert(st.chunks_allocated == 2 && st.bytes_copied == 1);
+    assert(obstack_object_size(&ob) == 1 + 3 + 1 + sizeof(big));
+
+    char* rec = obstack_copyv(&ob, iov, 2);
+    assert(memcmp(rec, "<key=", 5) == 0 && rec[5] == 'v' && rec[4 + sizeof(big)] == 'v');
+    assert(memcmp(rec + 5 + sizeof(big), "key=", 4) == 0);
+    assert(obstack_object_size(&ob) == 0);
+
+    /* Nothing to copy still yields an object. */
+    char* empty = obstack_copyv(&ob, iov, 0);
+    assert(empty != NULL && obstack_object_size(&ob) == 0);
+
+    obstack_free(&ob, NULL);
+    puts("test_growv ok");
+    return 0;
+}
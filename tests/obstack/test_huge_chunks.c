@@ -0,0 +1,68 @@
+#include "test_support.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MIB ((size_t)1 << 20)
+
+static int huge_aligned(const void* p) {
+    return ((uintptr_t)p & (OBSTACK_HUGE_CHUNK - 1)) == 0;
+}
+
+static void test_chunks_fill_aligned_mappings(void) {
+    struct obstack ob;
+    assert(obstack_huge_init(&ob) == 1);
+    assert(huge_aligned(ob.chunk));
+    assert(_obstack_memory_used(&ob) == OBSTACK_HUGE_CHUNK);
+
+    /* Several objects share the first chunk before a second is mapped. */
+    char* a = obstack_alloc(&ob, MIB);
+    char* b = obstack_alloc(&ob, MIB / 2);
+    memset(a, 'a', MIB);
+    memset(b, 'b', MIB / 2);
+    assert(ob.chunk->prev == NULL);
+
+    char* c = obstack_alloc(&ob, MIB);
+    memset(c, 'c', MIB);
+    assert(ob.chunk->prev != NULL && huge_aligned(ob.chunk));
+    assert((size_t)(ob.chunk_limit - (char*)ob.chunk) % OBSTACK_HUGE_CHUNK == 0);
+    assert(a[MIB - 1] == 'a' && b[0] == 'b');
+
+    /* The released mapping is handed out again. */
+    void* second = ob.chunk;
+    obstack_free(&ob, b);
+    assert(ob.chunk->prev == NULL);
+    b = obstack_alloc(&ob, MIB / 2);
+    c = obstack_alloc(&ob, MIB);
+    assert(ob.chunk == second);
+    memset(c, 'd', MIB);
+
+    obstack_free(&ob, NULL);
+}
+
+static void test_growing_object_is_remapped(void) {
+    struct obstack ob;
+    assert(obstack_huge_init(&ob) == 1);
+
+    for (size_t i = 0; i < 10 * MIB; i += 4096) {
+        char page[4096];
+        memset(page, (int)('a' + i / 4096 % 26), sizeof(page));
+        obstack_grow(&ob, page, sizeof(page));
+    }
+    assert(ob.chunk->prev == NULL);
+    assert(obstack_object_size(&ob) == 10 * MIB);
+    char* s = obstack_finish(&ob);
+    for (size_t i = 0; i < 10 * MIB; i += 4096)
+        assert(s[i] == (char)('a' + i / 4096 % 26) && s[i + 4095] == s[i]);
+
+    obstack_free(&ob, NULL);
+}
+
+int main(void) {
+    test_chunks_fill_aligned_mappings();
+    test_growing_object_is_remapped();
+    puts("test_huge_chunks ok");
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "test_support.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void* __real_realloc(void* p, size_t size);
+
+static int realloc_calls;
+
+void* __wrap_realloc(void* p, size_t size) {
+    realloc_calls++;
+    return __real_realloc(p, size);
+}
+
+#define BIG (1u << 20)
+
+static void grow_bytes(struct obstack* ob, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        obstack_1grow(ob, (char)('a' + i % 26));
+}
+
+static void check_bytes(const char* s, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        assert(s[i] == (char)('a' + i % 26));
+}
+
+static void test_sole_object_is_resized(void) {
+    struct obstack ob;
+    obstack_init(&ob);
+
+    realloc_calls = 0;
+    grow_bytes(&ob, BIG);
+    assert(realloc_calls > 0 && realloc_calls < 32);
+    assert(ob.chunk->prev == NULL);
+    check_bytes(obstack_finish(&ob), BIG);
+    obstack_free(&ob, NULL);
+}
+
+static void test_shared_chunk_is_copied_once(void) {
+    struct obstack ob;
+    obstack_init(&ob);
+    char* first = obstack_copy0(&ob, "first", 5);
+
+    realloc_calls = 0;
+    grow_bytes(&ob, BIG);
+    assert(realloc_calls > 0 && realloc_calls < 32);
+    assert(ob.chunk->prev != NULL && ob.chunk->prev->prev == NULL);
+    check_bytes(obstack_finish(&ob), BIG);
+    assert(first[0] == 'f' && first[4] == 't');
+    obstack_free(&ob, NULL);
+}
+
+static void test_custom_allocator_grows_geometrically(void) {
+    struct extra_state st = {0, 0, 0};
+    struct obstack ob;
+
+    assert(obstack_set_growth(100) == 50);
+    assert(_obstack_begin_1(&ob, 4000, 0, obstack_extra_alloc, obstack_extra_free, &st) == 1);
+    realloc_calls = 0;
+    grow_bytes(&ob, BIG);
+    assert(realloc_calls == 0);
+    /* Each chunk at least doubles the object: about log2(BIG / 4000). */
+    assert(st.calls <= 10);
+    check_bytes(obstack_finish(&ob), BIG);
+    obstack_free(&ob, NULL);
+
+    assert(obstack_set_growth(5000) == 100);
+    assert(obstack_set_growth(50) == 1000);
+}
+
+int main(void) {
+    test_sole_object_is_resized();
+    test_shared_chunk_is_copied_once();
+    test_custom_allocator_grows_geometrically();
+    puts("test_inplace_growth ok");
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "test_support.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct trace {
+    int allocs;
+    int frees;
+    size_t last;
+};
+
+static void* trace_alloc(void* arg, size_t n) {
+    struct trace* t = (struct trace*)arg;
+    t->allocs++;
+    t->last = n;
+    return malloc(n);
+}
+
+static void trace_free(void* arg, void* p) {
+    struct trace* t = (struct trace*)arg;
+    t->frees++;
+    free(p);
+}
+
+static int in_chunk(const struct _obstack_chunk* c, const void* p) {
+    return (const char*)p > (const char*)c && (const char*)p < c->limit;
+}
+
+static void test_small_objects_return_to_their_chunk(void) {
+    struct trace t = {0, 0, 0};
+    struct obstack ob;
+    assert(_obstack_begin_1(&ob, 4096, 0, trace_alloc, trace_free, &t) == 1);
+    struct _obstack_chunk* first = ob.chunk;
+
+    char* a = obstack_alloc(&ob, 100);
+    char* big = obstack_alloc(&ob, 100000);
+    memset(big, 'B', 100000);
+    assert(t.allocs == 2 && t.last < 100000 + 64);
+
+    /* Later small objects continue where the large one began. */
+    char* b = obstack_copy0(&ob, "after the large one", 19);
+    assert(in_chunk(first, b) && b < a + 200);
+    for (int i = 0; i < 30; i++)
+        (void)obstack_alloc(&ob, 100);
+    assert(t.allocs == 2);
+    assert(_obstack_memory_used(&ob) == 4096 + t.last);
+
+    /* A second large object, then freeing in LIFO order. */
+    char* c = obstack_alloc(&ob, 50000);
+    memset(c, 'C', 50000);
+    char* d = obstack_copy0(&ob, "after the second one", 20);
+    assert(in_chunk(first, d) && t.allocs == 3);
+
+    obstack_free(&ob, d);
+    assert(t.frees == 0 && c[49999] == 'C' && big[0] == 'B' && strcmp(b, "after the large one") == 0);
+    obstack_free(&ob, c);
+    assert(t.frees == 0 && ob.next_free == c);
+    obstack_free(&ob, b);
+    assert(big[99999] == 'B' && ob.next_free == b);
+    obstack_free(&ob, big);
+    assert(ob.chunk != first && ob.next_free == big);
+    obstack_free(&ob, a);
+    assert(ob.chunk == first && _obstack_memory_used(&ob) == 4096);
+
+    obstack_free(&ob, NULL);
+    assert(t.frees == t.allocs);
+}
+
+static void test_grown_large_object(void) {
+    struct obstack ob;
+    obstack_init(&ob);
+    char* small = obstack_copy0(&ob, "small", 5);
+
+    for (int i = 0; i < 200000; i++)
+        obstack_1grow(&ob, (char)('a' + i % 26));
+    char* big = obstack_finish(&ob);
+    char* next = obstack_copy0(&ob, "next", 4);
+    (void)obstack_alloc(&ob, 1000000);
+    char* after = obstack_copy0(&ob, "after the large block", 21);
+    assert(in_chunk(ob.chunk->prev->prev, after));
+
+    assert(strcmp(small, "small") == 0 && strcmp(next, "next") == 0 && strcmp(after, "after the large block") == 0);
+    for (int i = 0; i < 200000; i++)
+        assert(big[i] == (char)('a' + i % 26));
+    obstack_free(&ob, small);
+    assert(ob.chunk->prev == NULL);
+    obstack_free(&ob, NULL);
+}
+
+int main(void) {
+    test_small_objects_return_to_their_chunk();
+    test_grown_large_object();
+    puts("test_large_objects ok");
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "test_support.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static char* finish_string(struct obstack* ob) {
+    obstack_1grow(ob, '\0');
+    return (char*)obstack_finish(ob);
+}
+
+int main(void) {
+    struct obstack ob;
+    int ok = _obstack_begin(&ob, 64, 0, obstack_plain_alloc, obstack_plain_free);
+    assert(ok == 1);
+
+    FILE* fp = open_obstack_stream(&ob);
+    assert(fp != NULL);
+
+    /* Output reaches the object when the stream is flushed. */
+    assert(fprintf(fp, "x=%d;", 42) == 5);
+    assert(fflush(fp) == 0);
+    assert(obstack_object_size(&ob) == 5);
+    assert(memcmp(obstack_base(&ob), "x=42;", 5) == 0);
+    char* first = finish_string(&ob);
+    assert(strcmp(first, "x=42;") == 0);
+
+    /* The next write starts a new object; large ones cross chunks. */
+    for (int i = 0; i < 200; i++)
+        assert(fprintf(fp, "%03d,", i) == 4);
+    assert(fflush(fp) == 0);
+    assert(obstack_object_size(&ob) == 800);
+    char* second = finish_string(&ob);
+    assert(strncmp(second, "000,001,", 8) == 0 && strcmp(second + 796, "199,") == 0);
+    assert(strcmp(first, "x=42;") == 0);
+
+    /* Seeking overwrites in place and zero-fills past the end. */
+    fputs("hello world", fp);
+    assert(fseek(fp, 6, SEEK_SET) == 0);
+    fputs("W", fp);
+    assert(ftell(fp) == 7);
+    assert(fseek(fp, 3, SEEK_END) == 0);
+    assert(obstack_object_size(&ob) == 14);
+    fputs("!", fp);
+    assert(fflush(fp) == 0 && obstack_object_size(&ob) == 15);
+    assert(memcmp(obstack_base(&ob), "hello World\0\0\0!", 15) == 0);
+    assert(fseek(fp, -100, SEEK_CUR) == -1);
+
+    /* Growing the object directly moves the stream to its end. */
+    obstack_grow(&ob, "??", 2);
+    fputc('.', fp);
+    assert(fflush(fp) == 0);
+    assert(memcmp((char*)obstack_base(&ob) + 15, "??.", 3) == 0);
+
+    /* Closing flushes and leaves the object growing. */
+    fputs("end", fp);
+    assert(fclose(fp) == 0);
+    assert(obstack_object_size(&ob) == 21);
+    (void)obstack_finish(&ob);
+
+    obstack_free(&ob, NULL);
+    puts("test_open_stream ok");
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "test_support.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static size_t walk_chunks(struct obstack* ob) {
+    size_t total = 0;
+    for (struct _obstack_chunk* c = ob->chunk; c; c = c->prev)
+        total += (size_t)(c->limit - (char*)c);
+    return total;
+}
+
+static void test_counters(void) {
+    struct obstack ob;
+    struct obstack_stats st;
+    assert(_obstack_begin(&ob, 256, 0, obstack_plain_alloc, obstack_plain_free) == 1);
+    assert(obstack_get_stats(&ob, &st) == 0);
+    assert(st.chunks_allocated == 1 && st.memory_used == 256 && st.peak_footprint == 256);
+
+    /* A finished object stays; the next one moves to a new chunk. */
+    void* mark = obstack_alloc(&ob, 100);
+    obstack_grow(&ob, "0123456789", 10);
+    obstack_blank(&ob, 240);
+    assert(obstack_get_stats(&ob, &st) == 0);
+    assert(st.chunks_allocated == 2 && st.bytes_copied == 10);
+    assert(st.tail_waste > 0 && st.tail_waste < 256);
+    assert(st.memory_used == walk_chunks(&ob) && _obstack_memory_used(&ob) == st.memory_used);
+    (void)obstack_finish(&ob);
+
+    /* Freeing to the mark keeps the chunk as a spare, then reuses it. */
+    size_t peak = st.peak_footprint;
+    obstack_free(&ob, mark);
+    assert(obstack_get_stats(&ob, &st) == 0);
+    assert(st.memory_used == 256 && st.spare_bytes > 0 && st.chunks_freed == 0);
+    assert(st.peak_footprint == peak);
+    obstack_grow(&ob, "0123456789", 10);
+    obstack_blank(&ob, 240);
+    assert(obstack_get_stats(&ob, &st) == 0);
+    assert(st.chunks_reused == 1 && st.spare_bytes == 0 && st.chunks_allocated == 2);
+    assert(_obstack_memory_used(&ob) == walk_chunks(&ob));
+
+    obstack_free(&ob, NULL);
+    assert(_obstack_memory_used(&ob) == 0);
+    assert(obstack_get_stats(&ob, &st) == -1 && st.chunks_allocated == 0);
+}
+
+static void test_in_place_growth(void) {
+    struct obstack ob;
+    struct obstack_stats st;
+    obstack_init(&ob);
+    for (int i = 0; i < 100000; i++)
+        obstack_1grow(&ob, 'g');
+    assert(obstack_get_stats(&ob, &st) == 0);
+    assert(st.bytes_copied == 0 && st.chunks_allocated == 1);
+    assert(st.memory_used == walk_chunks(&ob) && st.peak_footprint == st.memory_used);
+    obstack_free(&ob, NULL);
+}
+
+/* Run ourselves with OBSTACK_STATS set and read the report. */
+static void test_exit_report(void) {
+    int fds[2];
+    assert(pipe(fds) == 0);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        dup2(fds[1], 2);
+        close(fds[0]);
+        setenv("OBSTACK_STATS", "1", 1);
+        execl("/proc/self/exe", "test_obstack_stats", "child", (char*)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    char buf[512];
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fds[0], buf + len, sizeof(buf) - 1 - len)) > 0)
+        len += (size_t)n;
+    buf[len] = '\0';
+    close(fds[0]);
+    int status;
+    assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(strncmp(buf, "obstack: 3 chunks allocated, 3 freed", 36) == 0);
+    assert(strstr(buf, "0 bytes in use"));
+}
+
+int main(int argc, char** argv) {
+    (void)argv;
+    if (argc > 1) {
+        struct obstack ob;
+        obstack_init(&ob);
+        (void)obstack_alloc(&ob, 3000);
+        (void)obstack_alloc(&ob, 3000);
+        (void)obstack_alloc(&ob, 3000);
+        obstack_free(&ob, NULL);
+        return 0;
+    }
+
+    test_counters();
+    test_in_place_growth();
+    test_exit_report();
+    puts("test_stats ok");
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "test_support.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define obstack_chunk_alloc xmalloc
+#define obstack_chunk_free free
+
+static size_t resident_pages(void* start, size_t len) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t from = (uintptr_t)start & ~(uintptr_t)(page - 1);
+    size_t n = ((uintptr_t)start + len - from + page - 1) / page;
+    unsigned char* vec = (unsigned char*)malloc(n);
+    assert(vec != NULL && mincore((void*)from, n * page, vec) == 0);
+    size_t resident = 0;
+    for (size_t i = 0; i < n; i++)
+        resident += vec[i] & 1;
+    free(vec);
+    return resident;
+}
+
+static void test_spares(void) {
+    struct obstack ob;
+    struct obstack_stats st;
+    assert(_obstack_begin(&ob, 256, 0, obstack_plain_alloc, obstack_plain_free) == 1);
+
+    /* Two trips past the chunk edge leave two spares behind. */
+    void* mark = obstack_alloc(&ob, 100);
+    (void)obstack_build_string(&ob, 300, 'a');
+    (void)obstack_build_string(&ob, 600, 'b');
+    obstack_free(&ob, mark);
+    assert(obstack_get_stats(&ob, &st) == 0 && st.spare_bytes > 0);
+    size_t spares = st.spare_bytes, freed = st.chunks_freed;
+
+    /* Nothing to do within the budget; custom chunks are not discarded. */
+    assert(obstack_trim(&ob, spares) == 0);
+    assert(obstack_trim(&ob, 0) == spares);
+    assert(obstack_get_stats(&ob, &st) == 0);
+    assert(st.spare_bytes == 0 && st.chunks_freed == freed + 2 && st.memory_used == 256);
+    assert(obstack_trim(&ob, 0) == 0);
+
+    char* s = obstack_build_string(&ob, 500, 'c');
+    assert(strlen(s) == 500);
+    obstack_free(&ob, NULL);
+    assert(obstack_trim(&ob, 0) == 0);
+}
+
+static void test_current_chunk(void) {
+    const size_t size = 1 << 20;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    struct obstack ob;
+    obstack_begin(&ob, size);
+
+    char* start = obstack_base(&ob);
+    char* big = obstack_alloc(&ob, size - 4096);
+    memset(big, 'x', size - 4096);
+    obstack_free(&ob, big);
+    (void)obstack_copy0(&ob, "kept", 4);
+    assert(resident_pages(start, size - 4096) >= (size - 4096) / page - 1);
+
+    size_t released = obstack_trim(&ob, 0);
+    assert(released >= size - 4096 - 2 * page && released % page == 0);
+    assert(resident_pages(start + page, size - 4096 - page) == 0);
+    assert(strcmp(start, "kept") == 0);
+
+    /* The trimmed room is still there to allocate from. */
+    char* again = obstack_alloc(&ob, size / 2);
+    memset(again, 'y', size / 2);
+    assert(again > start && again < start + page && ob.chunk->prev == NULL);
+    obstack_free(&ob, NULL);
+}
+
+int main(void) {
+    test_spares();
+    test_current_chunk();
+    puts("test_trim ok");
+    return 0;
+}
@@ -4,13 +4,14 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 int __real_vsnprintf(char* str, size_t size, const char* format, va_list ap);
 
 enum fail_stage {
     FAIL_NONE = 0,
-    FAIL_MEASURE,
-    FAIL_WRITE,
+    FAIL_FIRST,
+    FAIL_RETRY,
 };
 
 static enum fail_stage active_fail_stage;
@@ -19,8 +20,8 @@ static int wrapped_calls;
 int __wrap_vsnprintf(char* str, size_t size, const char* format, va_list ap) {
     wrapped_calls++;
 
-    if ((active_fail_stage == FAIL_MEASURE && wrapped_calls == 1) ||
-        (active_fail_stage == FAIL_WRITE && wrapped_calls == 2)) {
+    if ((active_fail_stage == FAIL_FIRST && wrapped_calls == 1) ||
+        (active_fail_stage == FAIL_RETRY && wrapped_calls == 2)) {
         errno = EIO;
         return -1;
     }
@@ -36,13 +37,13 @@ static int call_obstack_vprintf(struct obstack* ob, const char* fmt, ...) {
     return rc;
 }
 
-static void test_measure_failure_does_not_advance_state(void) {
+static void test_first_failure_does_not_advance_state(void) {
     struct obstack ob;
     int ok = _obstack_begin(&ob, 128, 0, obstack_plain_alloc, obstack_plain_free);
     assert(ok == 1);
 
     char* before = ob.next_free;
-    active_fail_stage = FAIL_MEASURE;
+    active_fail_stage = FAIL_FIRST;
     wrapped_calls = 0;
 
     int rc = call_obstack_vprintf(&ob, "x=%d", 42);
@@ -55,28 +56,49 @@ static void test_measure_failure_does_not_advance_state(void) {
     _obstack_free(&ob, NULL);
 }
 
-static void test_write_failure_does_not_advance_state(void) {
+static void test_output_that_fits_is_formatted_once(void) {
     struct obstack ob;
     int ok = _obstack_begin(&ob, 128, 0, obstack_plain_alloc, obstack_plain_free);
     assert(ok == 1);
 
     char* before = ob.next_free;
-    active_fail_stage = FAIL_WRITE;
     wrapped_calls = 0;
 
     int rc = call_obstack_vprintf(&ob, "tag:%s", "abc");
+    assert(rc == 7);
+    assert(wrapped_calls == 1);
+    assert(ob.next_free == before + 7);
+
+    _obstack_free(&ob, NULL);
+}
+
+static void test_retry_failure_keeps_object(void) {
+    struct obstack ob;
+    int ok = _obstack_begin(&ob, 128, 0, obstack_plain_alloc, obstack_plain_free);
+    assert(ok == 1);
+
+    char big[300];
+    memset(big, 'b', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    obstack_grow(&ob, "keep", 4);
+    active_fail_stage = FAIL_RETRY;
+    wrapped_calls = 0;
+
+    /* The retry runs in a new chunk; the object moves but is not extended. */
+    int rc = call_obstack_vprintf(&ob, "tag:%s", big);
     assert(rc == -1);
     assert(wrapped_calls == 2);
-    assert(ob.next_free == before);
-    assert(ob.object_base == before);
+    assert(obstack_object_size(&ob) == 4);
+    assert(memcmp(ob.object_base, "keep", 4) == 0);
 
     active_fail_stage = FAIL_NONE;
     _obstack_free(&ob, NULL);
 }
 
 int main(void) {
-    test_measure_failure_does_not_advance_state();
-    test_write_failure_does_not_advance_state();
+    test_first_failure_does_not_advance_state();
+    test_output_that_fits_is_formatted_once();
+    test_retry_failure_keeps_object();
     puts("test_vprintf_failures ok");
     return 0;
 }